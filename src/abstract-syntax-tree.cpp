@@ -101,12 +101,17 @@ Value* StringNode::generateCode(CodeGenerationContext& context) {
 
     indices[1] = ConstantInt::get(int32Type, 1); // (0, 1)
     auto stringAllocatedSize = GetElementPtrInst::Create(stringValueType, objectReference, indices, "allocatedSize", context.currentBlock());
-    new StoreInst(ConstantInt::get(integerType, value.length()+1), stringAllocatedSize, context.currentBlock());
+    // the characters are a constant, nothing may be written to them
+    new StoreInst(ConstantInt::get(integerType, 0), stringAllocatedSize, context.currentBlock());
 
     indices[1] = ConstantInt::get(int32Type, 2); // (0, 2)
     auto stringUsedSize = GetElementPtrInst::Create(stringValueType, objectReference, indices, "usedSize", context.currentBlock());
     new StoreInst(ConstantInt::get(integerType, value.length()), stringUsedSize, context.currentBlock());
 
+    indices[1] = ConstantInt::get(int32Type, 3); // (0, 3)
+    auto stringOwner = GetElementPtrInst::Create(stringValueType, objectReference, indices, "owner", context.currentBlock());
+    new StoreInst(ConstantPointerNull::get(cast<PointerType>(stringType)), stringOwner, context.currentBlock());
+
     return objectReference;
 }
 
@@ -119,6 +124,16 @@ Value* IdentifierNode::generateCode(CodeGenerationContext& context) {
 }
 
 Value* ReferenceNode::generateCode(CodeGenerationContext& context) {
+    if (assignable != nullptr && assignable->index != nullptr) {
+        // element of a collection
+        Value* element = assignable->generateCode(context);
+        if (element == nullptr) {
+            return nullptr;
+        }
+        LoadInst* load = new LoadInst(element, "", false, context.currentBlock());
+        context.getCollections().setElementAccess(load, load->getType());
+        return load;
+    }
     const string name = createReferenceName(reference);
     auto scope = context.fullScope();
     if (scope.find(name) == scope.end()) {
@@ -127,7 +142,88 @@ Value* ReferenceNode::generateCode(CodeGenerationContext& context) {
     return new LoadInst(scope[name], "", false, context.currentBlock());
 }
 
+Value* CollectionNode::generateCode(CodeGenerationContext& context) {
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Type* type = typeConverter.getType(typeName);
+    if (type == nullptr) {
+        return nullptr;
+    }
+    Value* sizeValue = ConstantInt::get(typeConverter.getIntegerType(), 0);
+    if (size != nullptr) {
+        sizeValue = size->generateCode(context);
+        if (sizeValue == nullptr) {
+            return nullptr;
+        }
+        if (sizeValue->getType() != typeConverter.getIntegerType()) {
+            return error(context, "Size of " + typeName + " must be of type Integer.");
+        }
+    }
+    if (context.getMaps().isMap(type)) {
+        return context.getMaps().create(type, sizeValue);
+    }
+    return context.getCollections().create(type, sizeValue);
+}
+
+Value* AtomicNode::generateCode(CodeGenerationContext& context) {
+    Type* type = context.getTypeConverter().getType(typeName);
+    if (type == nullptr) {
+        return nullptr;
+    }
+    if (!context.getAtomics().isAtomic(type)) {
+        return error(context, typeName + " is not supported, only Atomic<Integer> and Atomic<Boolean>");
+    }
+    Value* value = initialValue.generateCode(context);
+    if (value == nullptr) {
+        return nullptr;
+    }
+    return context.getAtomics().create(type, value);
+}
+
+Value* ChannelNode::generateCode(CodeGenerationContext& context) {
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Type* type = typeConverter.getType(typeName);
+    if (type == nullptr) {
+        return nullptr;
+    }
+    if (!context.getChannels().isChannel(type)) {
+        return error(context, typeName + " is not supported, only Channels of Boolean, Integer, Double and String");
+    }
+    Value* capacityValue = ConstantInt::get(typeConverter.getIntegerType(), 0);
+    if (capacity != nullptr) {
+        capacityValue = capacity->generateCode(context);
+        if (capacityValue == nullptr) {
+            return nullptr;
+        }
+        if (capacityValue->getType() != typeConverter.getIntegerType()) {
+            return error(context, "Capacity of " + typeName + " must be of type Integer.");
+        }
+    }
+    return context.getChannels().create(type, capacityValue);
+}
+
 Value* FunctionCallNode::generateCode(CodeGenerationContext& context) {
+    vector<Value*> convertedArguments;
+    Function* function = generateArguments(context, convertedArguments);
+    if (function == nullptr) {
+        return nullptr;
+    }
+    ConstantEvaluation& constantEvaluation = context.getConstantEvaluation();
+    if (constantEvaluation.isConstFunction(function)) {
+        string problem;
+        Constant* result = constantEvaluation.fold(function, convertedArguments, problem);
+        if (result != nullptr) {
+            return result;
+        }
+        if (!problem.empty()) {
+            warning(context, "Unable to evaluate " + function->getName().str() + " at compile time, " + problem + ", it is called at run time instead");
+        }
+    }
+    CallInst *call = CallInst::Create(function, makeArrayRef(convertedArguments), "", context.currentBlock());
+    return call;
+}
+
+/* Find the called function and convert the arguments to its argument types */
+Function* FunctionCallNode::generateArguments(CodeGenerationContext& context, vector<Value*>& convertedArguments) {
     const string functionName = createReferenceName(reference);
     vector<Value*> callingArguments;
     vector<Type*> callingTypes;
@@ -141,9 +237,9 @@ Value* FunctionCallNode::generateCode(CodeGenerationContext& context) {
     OolongFunction targetFunction(nullptr, functionName, callingTypes, &context);
     Function *function = context.getImporter().findFunction(targetFunction);
     if (function == nullptr) {
-        return error(context, "No such function: " + to_string(targetFunction));
+        error(context, "No such function: " + to_string(targetFunction));
+        return nullptr;
     }
-    vector<Value*> convertedArguments;
     auto declaredIt = function->arg_begin();
     size_t position = 0;
     while (declaredIt != function->arg_end()) {
@@ -151,20 +247,103 @@ Value* FunctionCallNode::generateCode(CodeGenerationContext& context) {
         Value* callingArgument = callingArguments[position];
         Value* convertedArgument = context.getTypeConverter().convertType(callingArgument, declaredArgument->getType());
         if (convertedArgument == nullptr) {
-            return error(context, "Invalid argument for function " + functionName + " (position " + to_string(position+1) + ")");
+            error(context, "Invalid argument for function " + functionName + " (position " + to_string(position+1) + ")");
+            return nullptr;
         }
         convertedArguments.push_back(convertedArgument);
         declaredIt++;
         position++;
     }
-    CallInst *call = CallInst::Create(function, makeArrayRef(convertedArguments), "", context.currentBlock());
-    return call;
+    return function;
 }
 
-Value* BinaryOperatorNode::generateCode(CodeGenerationContext& context) {
-    Value* left = leftHandSide.generateCode(context);
-    Value* right = rightHandSide.generateCode(context);
+Value* SpawnNode::generateCode(CodeGenerationContext& context) {
+    vector<Value*> convertedArguments;
+    Function* function = generateArguments(context, convertedArguments);
+    if (function == nullptr) {
+        return nullptr;
+    }
+    return context.getFutures().spawn(function, convertedArguments);
+}
+
+Value* AwaitNode::generateCode(CodeGenerationContext& context) {
+    auto scope = context.fullScope();
+    if (scope.find(identifier.name) == scope.end()) {
+        return error(context, "Undeclared variable " + identifier.name);
+    }
+    Value* variable = scope[identifier.name];
+    Type* type = variable->getType()->getPointerElementType();
+    if (!context.getFutures().isFuture(type)) {
+        return error(context, "Unable to await " + identifier.name + " of type " + context.getTypeConverter().getTypeName(type));
+    }
+    Coroutines& coroutines = context.getCoroutines();
+    if (coroutines.isAsyncFunction(context.currentFunction())) {
+        // the worker runs other tasks meanwhile instead of waiting with this function on its stack
+        coroutines.suspendUntilDone(new LoadInst(variable, "", context.currentBlock()));
+    }
+    return context.getFutures().await(variable);
+}
+
+/* a + b + c is parsed as (a + b) + c, collect the operands of the whole chain in evaluation order */
+static void collectAdditionOperands(ExpressionNode& expression, vector<ExpressionNode*>& operands) {
+    BinaryOperatorNode* addition = dynamic_cast<BinaryOperatorNode*>(&expression);
+    if (addition != nullptr && addition->operation == TOKEN_PLUS) {
+        collectAdditionOperands(addition->leftHandSide, operands);
+        operands.push_back(&addition->rightHandSide);
+    }
+    else {
+        operands.push_back(&expression);
+    }
+}
+
+/* Concatenate a chain of Strings with a single allocation sized for all of them, instead of one String per + */
+static bool checkConcatenated(CodeGenerationContext& context, Value* piece, Type* stringType) {
+    if (piece->getType() != stringType) {
+        error(context, "Unable to concatenate String and " + context.getTypeConverter().getTypeName(piece->getType()) + ", convert it with toString");
+        return false;
+    }
+    return true;
+}
+
+/* One call of the runtime for all pieces, each String is copied once */
+static Value* concatenatePieces(CodeGenerationContext& context, const vector<Value*>& pieces) {
+    Type* stringType = pieces[0]->getType();
+    Type* integerType = context.getTypeConverter().getIntegerType();
+    ArrayType* piecesType = ArrayType::get(stringType, pieces.size());
+    AllocaInst* piecesArray = context.createEntryBlockAlloca(context.currentFunction(), piecesType, "pieces");
+    Type* int32Type = IntegerType::getInt32Ty(context.getLLVMContext());
+    Value* firstPiece = nullptr;
+    for (size_t i=0; i<pieces.size(); i++) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, i) };
+        Value* element = GetElementPtrInst::CreateInBounds(piecesType, piecesArray, indices, "", context.currentBlock());
+        new StoreInst(pieces[i], element, context.currentBlock());
+        if (i == 0) {
+            firstPiece = element;
+        }
+    }
 
+    Function* concatenate = context.getRuntimeFunction("oolong_concatenate", stringType, { stringType->getPointerTo(), integerType });
+    Value* arguments[] = { firstPiece, ConstantInt::get(integerType, pieces.size()) };
+    return CallInst::Create(concatenate, arguments, "", context.currentBlock());
+}
+
+static Value* generateConcatenation(CodeGenerationContext& context, Value* first, const vector<ExpressionNode*>& operands) {
+    vector<Value*> pieces;
+    pieces.push_back(first);
+    for (size_t i=1; i<operands.size(); i++) {
+        Value* piece = operands[i]->generateCode(context);
+        if (piece == nullptr || !checkConcatenated(context, piece, first->getType())) {
+            return nullptr;
+        }
+        pieces.push_back(piece);
+    }
+    return concatenatePieces(context, pieces);
+}
+
+static Value* generateBinaryOperation(CodeGenerationContext& context, Value* left, int operation, Value* right) {
+    if (left == nullptr || right == nullptr) {
+        return nullptr;
+    }
     Type* leftType = left->getType();
     Type* rightType = right->getType();
 
@@ -174,19 +353,28 @@ Value* BinaryOperatorNode::generateCode(CodeGenerationContext& context) {
     Type* booleanType = typeConverter.getBooleanType(llvmContext);
     Type* integerType = typeConverter.getIntegerType(llvmContext);
     Type* doubleType = typeConverter.getDoubleType(llvmContext);
-    // change isInteger if either type is a float
-    if (!(leftType == booleanType || leftType == integerType || leftType == doubleType)) {
-        // leftType is not integer or float
-        return error(context, "Unable to perform binary operation with type " + typeConverter.getTypeName(leftType));
-    }
-    if (!(rightType == booleanType || rightType == integerType || rightType == doubleType)) {
-        // rightType is not integer or double
-        return error(context, "Unable to perform binary operation with type " + typeConverter.getTypeName(rightType));
+    if (leftType->isVectorTy() || rightType->isVectorTy()) {
+        // lane-wise operation, comparisons result in a Vector<Boolean, N>
+        if (!context.getSimd().matchOperands(left, right)) {
+            return nullptr;
+        }
+        isInteger = left->getType()->getVectorElementType() != doubleType;
     }
-    if (leftType == doubleType || rightType == doubleType) {
-        left = typeConverter.convertType(left, doubleType);
-        right = typeConverter.convertType(right, doubleType);
-        isInteger = false;
+    else {
+        // change isInteger if either type is a float
+        if (!(leftType == booleanType || leftType == integerType || leftType == doubleType)) {
+            // leftType is not integer or float
+            return error(context, "Unable to perform binary operation with type " + typeConverter.getTypeName(leftType));
+        }
+        if (!(rightType == booleanType || rightType == integerType || rightType == doubleType)) {
+            // rightType is not integer or double
+            return error(context, "Unable to perform binary operation with type " + typeConverter.getTypeName(rightType));
+        }
+        if (leftType == doubleType || rightType == doubleType) {
+            left = typeConverter.convertType(left, doubleType);
+            right = typeConverter.convertType(right, doubleType);
+            isInteger = false;
+        }
     }
 
     bool isBinary = true;
@@ -220,6 +408,26 @@ Value* BinaryOperatorNode::generateCode(CodeGenerationContext& context) {
     }
 }
 
+Value* BinaryOperatorNode::generateCode(CodeGenerationContext& context) {
+    if (operation != TOKEN_PLUS) {
+        Value* left = leftHandSide.generateCode(context);
+        Value* right = rightHandSide.generateCode(context);
+        return generateBinaryOperation(context, left, operation, right);
+    }
+
+    vector<ExpressionNode*> operands;
+    collectAdditionOperands(*this, operands);
+    Value* result = operands[0]->generateCode(context);
+    if (result != nullptr && result->getType() == context.getTypeConverter().getType("String")) {
+        return generateConcatenation(context, result, operands);
+    }
+    for (size_t i=1; i<operands.size(); i++) {
+        Value* right = operands[i]->generateCode(context);
+        result = generateBinaryOperation(context, result, TOKEN_PLUS, right);
+    }
+    return result;
+}
+
 Value* UnaryOperatorNode::generateCode(CodeGenerationContext& context) {
     Value* value = expression.generateCode(context);
 
@@ -230,17 +438,18 @@ Value* UnaryOperatorNode::generateCode(CodeGenerationContext& context) {
     Type* booleanType = typeConverter.getBooleanType(llvmContext);
     Type* integerType = typeConverter.getIntegerType(llvmContext);
     Type* doubleType = typeConverter.getDoubleType(llvmContext);
-    if (!(type == booleanType || type == integerType || type == doubleType)) {
+    // vectors are negated lane-wise
+    Type* scalarType = type->isVectorTy() ? type->getVectorElementType() : type;
+    if (!(scalarType == booleanType || scalarType == integerType || scalarType == doubleType)) {
         // expression is not integer or double
         return error(context, "Unable to perform unary operation with type " + typeConverter.getTypeName(type));
     }
-    bool isInteger = (type != doubleType);
+    bool isInteger = (scalarType != doubleType);
 
-    Value* zero = isInteger ? ConstantInt::get(type, 0) : ConstantFP::get(doubleType, 0.0);
+    Value* zero = Constant::getNullValue(type);
     switch (operation) {
         case TOKEN_MINUS: {
             // subtract from zero
-            Value* zero = isInteger ? ConstantInt::get(integerType, 0) : ConstantFP::get(doubleType, 0.0);
             Instruction::BinaryOps instruction = isInteger ? Instruction::Sub : Instruction::FSub;
             return BinaryOperator::Create(instruction, zero, value, "", context.currentBlock());
         } break;
@@ -262,20 +471,143 @@ Value* UnaryOperatorNode::generateCode(CodeGenerationContext& context) {
 }
 
 Value* AssignableNode::generateCode(CodeGenerationContext& context) {
+    return generatePointer(context, READ);
+}
+
+Value* AssignableNode::generateAssignedCode(CodeGenerationContext& context) {
+    return generatePointer(context, ASSIGN);
+}
+
+/* The index is evaluated once, then the operand. The element pointer comes last, since the operand might add
+   to the collection (and move its elements), the value is loaded and stored through that pointer. */
+Value* AssignableNode::generateUpdate(CodeGenerationContext& context, int operation, ExpressionNode& operand, Value*& originalValue) {
+    Value* collection = nullptr;
+    Value* indexValue = nullptr;
+    Value* pointer = generateIndex(context, collection, indexValue);
+    if (pointer == nullptr) {
+        return nullptr;
+    }
+    Value* operandValue = operand.generateCode(context);
+    if (operandValue == nullptr) {
+        return nullptr;
+    }
+    if (index != nullptr) {
+        pointer = generateElementPointer(context, collection, indexValue, UPDATE);
+        if (pointer == nullptr) {
+            return nullptr;
+        }
+    }
+    Collections& collections = context.getCollections();
+    Type* type = pointer->getType()->getPointerElementType();
+    LoadInst* load = new LoadInst(pointer, "", false, context.currentBlock());
+    if (index != nullptr) {
+        collections.setElementAccess(load, type);
+    }
+    originalValue = load;
+    Value* result = nullptr;
+    if (operation == TOKEN_PLUS && type == context.getTypeConverter().getType("String")) {
+        if (!checkConcatenated(context, operandValue, type)) {
+            return nullptr;
+        }
+        result = concatenatePieces(context, { load, operandValue });
+    }
+    else {
+        result = generateBinaryOperation(context, load, operation, operandValue);
+    }
+    if (result == nullptr) {
+        return nullptr;
+    }
+    // e.g. Integer values added to a Double variable
+    result = context.getTypeConverter().convertType(result, type);
+    if (result == nullptr) {
+        return nullptr;
+    }
+    StoreInst* store = new StoreInst(result, pointer, false, context.currentBlock());
+    if (index != nullptr) {
+        collections.setElementAccess(store, type);
+    }
+    return result;
+}
+
+Value* AssignableNode::generatePointer(CodeGenerationContext& context, Access access) {
+    Value* collection = nullptr;
+    Value* indexValue = nullptr;
+    Value* variable = generateIndex(context, collection, indexValue);
+    if (variable == nullptr || index == nullptr) {
+        return variable;
+    }
+    return generateElementPointer(context, collection, indexValue, access);
+}
+
+/* Pointer to the variable, nullptr after an error. With an index, loads the collection and evaluates the index. */
+Value* AssignableNode::generateIndex(CodeGenerationContext& context, Value*& collection, Value*& indexValue) {
     auto scope = context.fullScope();
     if (scope.find(identifier.name) == scope.end()) {
         return error(context, "Undeclared variable " + identifier.name);
     }
     Value* variable = scope[identifier.name];
+    if (index == nullptr) {
+        return variable;
+    }
+
+    Collections& collections = context.getCollections();
+    Maps& maps = context.getMaps();
+    TypeConverter& typeConverter = context.getTypeConverter();
+    collection = new LoadInst(variable, identifier.name, false, context.currentBlock());
+    bool isMap = maps.isMap(collection->getType());
+    if (!isMap && !collections.isCollection(collection->getType())) {
+        return error(context, "Unable to index " + identifier.name + " of type " + typeConverter.getTypeName(collection->getType()));
+    }
+    indexValue = index->generateCode(context);
+    if (indexValue == nullptr) {
+        return nullptr;
+    }
+    if (isMap) {
+        Type* keyType = maps.getKeyType(collection->getType());
+        if (indexValue->getType() != keyType) {
+            return error(context, "Key of " + identifier.name + " must be of type " + typeConverter.getTypeName(keyType) + ".");
+        }
+    }
+    else if (indexValue->getType() != typeConverter.getIntegerType()) {
+        return error(context, "Index of " + identifier.name + " must be of type Integer.");
+    }
     return variable;
 }
 
+/* Pointer to the element, after a bounds check, or to the value of the key. Only valid until the collection changes. */
+Value* AssignableNode::generateElementPointer(CodeGenerationContext& context, Value* collection, Value* indexValue, Access access) {
+    Maps& maps = context.getMaps();
+    TypeConverter& typeConverter = context.getTypeConverter();
+    if (maps.isMap(collection->getType())) {
+        // updating a missing key starts from zero, there's no String to start from
+        bool insert = access == ASSIGN || (access == UPDATE && maps.getValueType(collection->getType()) != typeConverter.getType("String"));
+        return maps.getValuePointer(collection, indexValue, insert);
+    }
+    return context.getCollections().getElementPointer(collection, indexValue);
+}
+
 Value* AssignmentNode::generateCode(CodeGenerationContext& context) {
+    if (operation != 0) {
+        Value* originalValue = nullptr;
+        return leftHandSide->generateUpdate(context, operation, rightHandSide, originalValue);
+    }
     Value* value = rightHandSide.generateCode(context);
     if (variable == nullptr) {
-        variable = leftHandSide->generateCode(context);
+        variable = leftHandSide->generateAssignedCode(context);
+    }
+    if (value == nullptr || variable == nullptr) {
+        return nullptr;
+    }
+    // e.g. Integer literals stored into a Double element
+    Type* variableType = variable->getType()->getPointerElementType();
+    value = context.getTypeConverter().convertType(value, variableType);
+    if (value == nullptr) {
+        return nullptr;
+    }
+    StoreInst* store = new StoreInst(value, variable, false, context.currentBlock());
+    if (leftHandSide != nullptr && leftHandSide->index != nullptr) {
+        context.getCollections().setElementAccess(store, variableType);
     }
-    new StoreInst(value, variable, false, context.currentBlock());
     // return stored value
     return value;
 }
@@ -287,7 +619,9 @@ Value* BlockNode::generateCode(CodeGenerationContext& context) {
         if (context.currentBlockReturns()) {
             return error(context, "Unreachable code after return statement.");
         }
+        DebugInformation::StatementMark mark = context.getDebugInformation().markStatement(context.currentBlock());
         last = (**it).generateCode(context);
+        context.getDebugInformation().setLocation(mark, (**it).lineNumber);
     }
     return last;
 }
@@ -299,10 +633,37 @@ Value* ExpressionStatementNode::generateCode(CodeGenerationContext& context) {
 Value* ReturnStatementNode::generateCode(CodeGenerationContext& context) {
     Value* returnValue = expression.generateCode(context);
     context.setCurrentReturnValue(returnValue);
+    Coroutines& coroutines = context.getCoroutines();
+    Function* function = context.currentFunction();
+    if (coroutines.isGeneratorFunction(function)) {
+        return error(context, "Generator function " + function->getName().str() + " can't return a value, it ends at the end of its block");
+    }
+    coroutines.destroyIterated();
+    if (coroutines.isAsyncFunction(function)) {
+        if (returnValue != nullptr && !coroutines.returnValue(returnValue)) {
+            return error(context, "Unable to return a value of type " + context.getTypeConverter().getTypeName(returnValue->getType()) + " from async function " + function->getName().str());
+        }
+        return nullptr;
+    }
     ReturnInst::Create(context.getLLVMContext(), returnValue, context.currentBlock());
     return nullptr; // no value, so unnecessary PHINodes don't get created
 }
 
+Value* YieldStatementNode::generateCode(CodeGenerationContext& context) {
+    Coroutines& coroutines = context.getCoroutines();
+    if (!coroutines.isGeneratorFunction(context.currentFunction())) {
+        return error(context, "yield outside of a generator function");
+    }
+    Value* value = expression.generateCode(context);
+    if (value == nullptr) {
+        return nullptr;
+    }
+    if (!coroutines.yield(value)) {
+        return error(context, "Unable to yield a value of type " + context.getTypeConverter().getTypeName(value->getType()) + " from generator function " + context.currentFunction()->getName().str());
+    }
+    return nullptr;
+}
+
 Value* VariableDeclarationNode::generateCode(CodeGenerationContext& context) {
     auto scope = context.fullScope();
     if (scope.find(id.name) != scope.end()) {
@@ -312,6 +673,7 @@ Value* VariableDeclarationNode::generateCode(CodeGenerationContext& context) {
     Type* identifierType = typeConverter.getType(type.name);
     AllocaInst *alloc = new AllocaInst(identifierType, 0 /* generic address space */, id.name, context.currentBlock());
     context.localScope()[id.name] = alloc;
+    context.getDebugInformation().declareVariable(alloc, id.name, lineNumber, argumentNumber);
     if (assignmentExpression != nullptr) {
         AssignmentNode assignmentNode(alloc, *assignmentExpression);
         assignmentNode.generateCode(context);
@@ -319,6 +681,38 @@ Value* VariableDeclarationNode::generateCode(CodeGenerationContext& context) {
     return alloc;
 }
 
+/* Call the runtime's entry hook (package/instrument.c) at the start of the function */
+static void instrumentFunctionEntry(CodeGenerationContext& context, Function* function) {
+    LLVMContext& llvmContext = context.getLLVMContext();
+    Module* module = context.getModule();
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+
+    // slot in which the runtime caches the counters for this function
+    GlobalVariable* slot = new GlobalVariable(*module, bytePointerType, false, GlobalValue::PrivateLinkage, ConstantPointerNull::get(bytePointerType), function->getName() + ".instrumentation");
+    // name used in the report
+    Constant* nameConstant = ConstantDataArray::getString(llvmContext, function->getName(), true);
+    GlobalVariable* name = new GlobalVariable(*module, nameConstant->getType(), true, GlobalValue::PrivateLinkage, nameConstant, ".str");
+    Constant* zero = ConstantInt::get(Type::getInt32Ty(llvmContext), 0);
+    Constant* indices[] = { zero, zero };
+    Constant* namePointer = ConstantExpr::getInBoundsGetElementPtr(nameConstant->getType(), name, indices);
+
+    Function* enterHook = context.getRuntimeFunction("oolong_instrument_enter", Type::getVoidTy(llvmContext), { slot->getType(), bytePointerType });
+    Value* arguments[] = { slot, namePointer };
+    CallInst::Create(enterHook, arguments, "", context.currentBlock());
+}
+
+/* Call the runtime's exit hook before every return of the function */
+static void instrumentFunctionExits(CodeGenerationContext& context, Function* function) {
+    Function* exitHook = context.getRuntimeFunction("oolong_instrument_exit", Type::getVoidTy(context.getLLVMContext()), {});
+    for (BasicBlock& block : *function) {
+        ReturnInst* returnInstruction = dyn_cast_or_null<ReturnInst>(block.getTerminator());
+        if (returnInstruction != nullptr) {
+            CallInst* call = CallInst::Create(exitHook, "", returnInstruction);
+            call->setDebugLoc(returnInstruction->getDebugLoc());
+        }
+    }
+}
+
 Value* FunctionDeclarationNode::generateCode(CodeGenerationContext& context) {
     LLVMContext& llvmContext = context.getLLVMContext();
     TypeConverter& typeConverter = context.getTypeConverter();
@@ -328,6 +722,23 @@ Value* FunctionDeclarationNode::generateCode(CodeGenerationContext& context) {
     }
 
     Type* returnType = typeConverter.getType(type.name);
+    Coroutines& coroutines = context.getCoroutines();
+    if (kind != PLAIN && id.name == "main") {
+        return error(context, "main can't be a generator or async function");
+    }
+    if (kind == GENERATOR && returnType != nullptr) {
+        // the caller gets the generator, values come from yield
+        returnType = coroutines.getGeneratorType(returnType);
+        if (returnType == nullptr) {
+            return error(context, "Unable to declare generator function " + id.name + ", there is no Generator<" + type.name + ">");
+        }
+    }
+    else if (kind == ASYNC && returnType != nullptr) {
+        returnType = context.getFutures().getFutureType(returnType);
+        if (returnType == nullptr) {
+            return error(context, "Unable to declare async function " + id.name + ", there is no Future<" + type.name + ">");
+        }
+    }
     OolongFunction oolongFunction(returnType, id.name, argumentTypes, &context);
     if (context.getImporter().findFunction(oolongFunction, true) != nullptr) {
         // exact match
@@ -339,6 +750,9 @@ Value* FunctionDeclarationNode::generateCode(CodeGenerationContext& context) {
     }
     FunctionType *ftype = FunctionType::get(returnType, makeArrayRef(argumentTypes), false);
     Function *function = nullptr;
+    if (constant && id.name == "main") {
+        return error(context, "Function main can't be const");
+    }
     if (id.name == "main") {
         // main function, externally linked
         function = Function::Create(ftype, GlobalValue::ExternalLinkage, id.name.c_str(), context.getModule());
@@ -348,17 +762,49 @@ Value* FunctionDeclarationNode::generateCode(CodeGenerationContext& context) {
         // normal function, internally linked
         function = Function::Create(ftype, GlobalValue::InternalLinkage, id.name.c_str(), context.getModule());
     }
+    // keep unwind tables even when functions are inferred not to throw, the sampling profiler walks the stack with them
+    function->addFnAttr(Attribute::UWTable);
 
     context.getImporter().declareFunction(oolongFunction, function);
+    context.getDebugInformation().declareFunction(function, lineNumber);
+
+    // the declared function checks the cache, the block goes into the implementation it calls on a miss
+    Function* implementation = function;
+    if (memoized) {
+        Memoization& memoization = context.getMemoization();
+        if (!memoization.canMemoize(function)) {
+            return error(context, "Unable to memoize function " + id.name + ", only Boolean, Integer and Double arguments and results are cached");
+        }
+        implementation = Function::Create(ftype, GlobalValue::InternalLinkage, id.name + ".uncached", context.getModule());
+        implementation->addFnAttr(Attribute::UWTable);
+        memoization.createWrapper(function, implementation, cacheLimit);
+        context.getDebugInformation().setLocation(function, lineNumber);
+        context.getDebugInformation().declareFunction(implementation, lineNumber);
+    }
+    // before the block, so recursive calls pass the check
+    if (constant) {
+        context.getConstantEvaluation().declare(function);
+    }
 
-    BasicBlock *bblock = BasicBlock::Create(llvmContext, "entry", function, 0);
+    BasicBlock *bblock = BasicBlock::Create(llvmContext, "entry", implementation, 0);
 
     context.pushBlock(bblock);
 
+    // the arguments of coroutines are stored after the frame was allocated, CoroSplit moves them into it
+    if (kind == GENERATOR) {
+        coroutines.beginGenerator(function);
+    }
+    else if (kind == ASYNC) {
+        coroutines.beginAsync(function);
+    }
+
     // add arguments to function scope
-    Function::arg_iterator argumentValueIterator = function->arg_begin();
+    Function::arg_iterator argumentValueIterator = implementation->arg_begin();
+    unsigned argumentNumber = 1;
     for (VariableDeclarationNode* argument : arguments) {
         string argumentName = argument->id.name;
+        argument->lineNumber = lineNumber;
+        argument->argumentNumber = argumentNumber++;
         argument->generateCode(context);
 
         // associate declaration with function argument
@@ -366,14 +812,38 @@ Value* FunctionDeclarationNode::generateCode(CodeGenerationContext& context) {
         argumentValue->setName(argumentName);
 
         // store value created during argument code generation
-        new StoreInst(argumentValue, context.localScope()[argumentName], false, bblock);
+        new StoreInst(argumentValue, context.localScope()[argumentName], false, context.currentBlock());
+    }
+    // coroutines return at every suspend, so entries and exits wouldn't match, the hooks aren't const functions
+    bool instrument = context.getInstrumentFunctions() && kind == PLAIN && !constant;
+    if (instrument) {
+        instrumentFunctionEntry(context, implementation);
     }
+    if (kind != PLAIN) {
+        coroutines.startBody(function);
+    }
+    // argument handling belongs to the declaration line
+    context.getDebugInformation().setLocation(implementation, lineNumber);
 
     // add code for statements
     block.generateCode(context);
 
+    if (kind != PLAIN) {
+        coroutines.finish(function);
+    }
+    if (instrument) {
+        instrumentFunctionExits(context, implementation);
+    }
+    // what no statement generated, e.g. the implicit return
+    context.getDebugInformation().setLocation(implementation, lineNumber);
+
     context.popBlock();
 
+    string problem;
+    if (constant && !context.getConstantEvaluation().check(function, problem)) {
+        return error(context, "Unable to declare const function " + id.name + ", it " + problem);
+    }
+
     return function;
 }
 
@@ -565,20 +1035,413 @@ Value* ForLoopNode::generateCode(CodeGenerationContext& context) {
     return nullptr;
 }
 
-Value* IncrementExpressionNode::generateCode(CodeGenerationContext& context) {
-    ReferenceNode* variableReference = new ReferenceNode(assignable);
+/* Channels and generators produce their values one at a time, there's no size known upfront */
+static bool isStream(CodeGenerationContext& context, Type* type) {
+    return context.getChannels().isChannel(type) || context.getCoroutines().isGenerator(type);
+}
 
-    Value* originalValue = nullptr;
-    if (postfix) {
-        // need to return original value
-        originalValue = variableReference->generateCode(context);
+/* Lowered directly to the shape the loop passes expect: a guard, an induction variable in a PHINode counting
+   up by one without signed overflow and the exit test at the bottom, so the trip count is end - start. */
+
+Value* RangeLoopNode::generateCode(CodeGenerationContext& context) {
+    LLVMContext& llvmContext = context.getLLVMContext();
+    Function* currentFunction = context.currentBlock()->getParent();
+
+    BasicBlock* initBlock = BasicBlock::Create(llvmContext, "loopInit", currentFunction);
+    // jump to loop initializer
+    BranchInst::Create(initBlock, context.currentBlock());
+    context.pushBlock(initBlock);
+
+    // bounds are evaluated once, before the loop variable exists
+    Value* startValue = nullptr;
+    Value* endValue = nullptr;
+    Value* collectionValue = nullptr;
+    if (!generateBounds(context, startValue, endValue, collectionValue)) {
+        return nullptr;
     }
-    IntegerNode* one = new IntegerNode(1);
-    BinaryOperatorNode* add = new BinaryOperatorNode(*variableReference, TOKEN_PLUS, *one);
-    Value* incrementedValue = add->generateCode(context);
+    BasicBlock* exitBlock = nullptr;
+    if (collectionValue != nullptr && isStream(context, collectionValue->getType())) {
+        exitBlock = generateStreamLoop(context, collectionValue);
+    }
+    else {
+        exitBlock = generateLoop(context, startValue, endValue, collectionValue);
+    }
+    if (exitBlock == nullptr) {
+        return nullptr;
+    }
+    context.popBlock(); // initBlock (descope loop variable)
 
-    Value* variable = assignable.generateCode(context);
-    new StoreInst(incrementedValue, variable, false, context.currentBlock());
+    // manually pushing back exitBlock to keep things in order
+    currentFunction->getBasicBlockList().push_back(exitBlock);
+    // make exitBlock the new current block
+    context.replaceCurrentBlock(exitBlock);
+
+    return nullptr;
+}
+
+bool RangeLoopNode::generateBounds(CodeGenerationContext& context, Value*& startValue, Value*& endValue, Value*& collectionValue) {
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Collections& collections = context.getCollections();
+    Type* integerType = typeConverter.getIntegerType();
+    if (collection != nullptr) {
+        collectionValue = collection->generateCode(context);
+        if (collectionValue == nullptr) {
+            return false;
+        }
+        if (isStream(context, collectionValue->getType())) {
+            // received until closed or resumed until the generator ends, there are no bounds
+            return true;
+        }
+        if (!collections.isCollection(collectionValue->getType())) {
+            error(context, "Unable to iterate over type " + typeConverter.getTypeName(collectionValue->getType()));
+            return false;
+        }
+        startValue = ConstantInt::get(integerType, 0);
+        // elements added by the loop body are not visited
+        endValue = collections.getSize(collectionValue);
+    }
+    else {
+        startValue = start->generateCode(context);
+        endValue = end->generateCode(context);
+        if (startValue == nullptr || endValue == nullptr) {
+            return false;
+        }
+        if (startValue->getType() != integerType || endValue->getType() != integerType) {
+            error(context, "Range bounds must be of type Integer.");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Declares the loop variable in the current scope and generates the loop from startValue to endValue,
+   visiting the elements of collectionValue if it isn't null. Returns the exit block, which still has to
+   be added to the function. */
+BasicBlock* RangeLoopNode::generateLoop(CodeGenerationContext& context, Value* startValue, Value* endValue, Value* collectionValue) {
+    LLVMContext& llvmContext = context.getLLVMContext();
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Collections& collections = context.getCollections();
+    Type* integerType = typeConverter.getIntegerType();
+    Function* currentFunction = context.currentBlock()->getParent();
+
+    Value* variableReference = variable->generateCode(context);
+    if (variableReference == nullptr) {
+        return nullptr;
+    }
+    Type* variableType = variableReference->getType()->getPointerElementType();
+    Type* valueType = collectionValue != nullptr ? collections.getElementType(collectionValue->getType()) : integerType;
+    if (!typeConverter.canConvertType(valueType, variableType)) {
+        error(context, "Loop variable " + variable->id.name + " of type " + typeConverter.getTypeName(variableType) + " can't hold values of type " + typeConverter.getTypeName(valueType));
+        return nullptr;
+    }
+
+    BasicBlock* bodyBlock = BasicBlock::Create(llvmContext, "loopBody", currentFunction);
+    BasicBlock* exitBlock = BasicBlock::Create(llvmContext, "loopExit");
+
+    // skip the loop for empty ranges
+    BasicBlock* guardBlock = context.currentBlock();
+    Value* notEmpty = new ICmpInst(*guardBlock, CmpInst::ICMP_SLT, startValue, endValue, "notEmpty");
+    BranchInst::Create(bodyBlock, exitBlock, notEmpty, guardBlock);
+
+    context.pushBlock(bodyBlock);
+    PHINode* index = PHINode::Create(integerType, 2, "index", bodyBlock);
+    index->addIncoming(startValue, guardBlock);
+    // the body sees a copy, assigning to the loop variable doesn't change the iteration
+    Value* value = index;
+    if (collectionValue != nullptr) {
+        Value* element = collections.getElementPointer(collectionValue, index);
+        LoadInst* load = new LoadInst(element, "", false, context.currentBlock());
+        collections.setElementAccess(load, valueType);
+        value = load;
+    }
+    new StoreInst(typeConverter.convertType(value, variableType), variableReference, false, context.currentBlock());
+    block.generateCode(context);
+    bool blockReturns = context.currentBlockReturns();
+    if (!blockReturns) {
+        BasicBlock* latchBlock = context.currentBlock();
+        Value* nextIndex = BinaryOperator::CreateNSWAdd(index, ConstantInt::get(integerType, 1), "nextIndex", latchBlock);
+        Value* again = new ICmpInst(*latchBlock, CmpInst::ICMP_SLT, nextIndex, endValue, "again");
+        BranchInst::Create(bodyBlock, exitBlock, again, latchBlock);
+        index->addIncoming(nextIndex, latchBlock);
+    }
+    context.popBlock(); // bodyBlock
+
+    return exitBlock;
+}
+
+/* Declares the loop variable in the current scope and runs the body for every value received from the
+   channel until it is closed and empty, or yielded by the generator until its body ends. The loop consumes
+   the generator, its frame is freed afterwards or by a return from the body. Returns the exit block, which still has to be added to the
+   function. */
+BasicBlock* RangeLoopNode::generateStreamLoop(CodeGenerationContext& context, Value* streamValue) {
+    LLVMContext& llvmContext = context.getLLVMContext();
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Coroutines& coroutines = context.getCoroutines();
+    Function* currentFunction = context.currentBlock()->getParent();
+    bool isGenerator = coroutines.isGenerator(streamValue->getType());
+
+    Value* variableReference = variable->generateCode(context);
+    if (variableReference == nullptr) {
+        return nullptr;
+    }
+    Type* variableType = variableReference->getType()->getPointerElementType();
+    Type* valueType = isGenerator ? coroutines.getValueType(streamValue->getType()) : context.getChannels().getValueType(streamValue->getType());
+    if (!typeConverter.canConvertType(valueType, variableType)) {
+        error(context, "Loop variable " + variable->id.name + " of type " + typeConverter.getTypeName(variableType) + " can't hold values of type " + typeConverter.getTypeName(valueType));
+        return nullptr;
+    }
+
+    BasicBlock* startBlock = BasicBlock::Create(llvmContext, "loopStart", currentFunction);
+    BasicBlock* bodyBlock = BasicBlock::Create(llvmContext, "loopBody", currentFunction);
+    BasicBlock* exitBlock = BasicBlock::Create(llvmContext, "loopExit");
+    BranchInst::Create(startBlock, context.currentBlock());
+
+    context.pushBlock(startBlock);
+    Value* value = nullptr;
+    Value* received = isGenerator ? coroutines.next(streamValue, value) : context.getChannels().receive(streamValue, value);
+    BasicBlock* doneBlock = exitBlock;
+    if (isGenerator) {
+        doneBlock = BasicBlock::Create(llvmContext, "generatorDone", currentFunction);
+    }
+    BranchInst::Create(bodyBlock, doneBlock, received, context.currentBlock());
+    context.popBlock(); // startBlock
+
+    if (isGenerator) {
+        context.pushBlock(doneBlock);
+        coroutines.destroy(streamValue);
+        BranchInst::Create(exitBlock, context.currentBlock());
+        context.popBlock(); // doneBlock
+    }
+
+    context.pushBlock(bodyBlock);
+    new StoreInst(typeConverter.convertType(value, variableType), variableReference, false, context.currentBlock());
+    if (isGenerator) {
+        coroutines.beginIteration(streamValue);
+    }
+    block.generateCode(context);
+    if (isGenerator) {
+        coroutines.endIteration();
+    }
+    if (!context.currentBlockReturns()) {
+        BranchInst::Create(startBlock, context.currentBlock());
+    }
+    context.popBlock(); // bodyBlock
+
+    return exitBlock;
+}
+
+Value* ParallelLoopNode::generateCode(CodeGenerationContext& context) {
+    LLVMContext& llvmContext = context.getLLVMContext();
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Type* integerType = typeConverter.getIntegerType();
+    Type* doubleType = typeConverter.getDoubleType();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    const unsigned MAXIMUM_REDUCTIONS = 8; // see package/parallel.c
+
+    Value* startValue = nullptr;
+    Value* endValue = nullptr;
+    Value* collectionValue = nullptr;
+    if (!generateBounds(context, startValue, endValue, collectionValue)) {
+        return nullptr;
+    }
+    if (collectionValue != nullptr && context.getChannels().isChannel(collectionValue->getType())) {
+        return error(context, "Unable to receive from a Channel in a parallel for");
+    }
+    if (collectionValue != nullptr && context.getCoroutines().isGenerator(collectionValue->getType())) {
+        return error(context, "Unable to resume a Generator in a parallel for");
+    }
+
+    // the body sees every variable in scope through a pointer in the environment, except the reductions
+    map<string, Value*> scope = context.fullScope();
+    vector<string> reductionNames;
+    vector<Value*> reductionVariables;
+    uint64_t doubleReductions = 0;
+    for (IdentifierNode* reduction : reductions) {
+        auto variable = scope.find(reduction->name);
+        if (variable == scope.end()) {
+            return error(context, "Undeclared variable " + reduction->name);
+        }
+        Type* reductionType = variable->second->getType()->getPointerElementType();
+        if (reductionType != integerType && reductionType != doubleType) {
+            return error(context, "Unable to reduce " + reduction->name + " of type " + typeConverter.getTypeName(reductionType) + ", only Integer and Double can be reduced");
+        }
+        if (reductionNames.size() == MAXIMUM_REDUCTIONS) {
+            return error(context, "A parallel for can have at most " + to_string(MAXIMUM_REDUCTIONS) + " reductions");
+        }
+        if (reductionType == doubleType) {
+            doubleReductions |= uint64_t(1) << reductionNames.size();
+        }
+        reductionNames.push_back(reduction->name);
+        reductionVariables.push_back(variable->second);
+        scope.erase(variable);
+    }
+    vector<Type*> environmentMembers;
+    for (auto variable : scope) {
+        environmentMembers.push_back(variable.second->getType());
+    }
+    if (collectionValue != nullptr) {
+        environmentMembers.push_back(collectionValue->getType());
+    }
+    StructType* environmentType = StructType::get(llvmContext, environmentMembers);
+
+    // void body(i8* environment, Integer start, Integer end, Integer* partials)
+    Type* partialsType = integerType->getPointerTo();
+    FunctionType* bodyType = FunctionType::get(Type::getVoidTy(llvmContext), { bytePointerType, integerType, integerType, partialsType }, false);
+    Function* body = Function::Create(bodyType, GlobalValue::InternalLinkage, context.currentFunction()->getName() + ".parallel", context.getModule());
+    body->addFnAttr(Attribute::UWTable);
+    context.getDebugInformation().declareFunction(body, lineNumber);
+    Function::arg_iterator arguments = body->arg_begin();
+    Value* bodyEnvironment = &*arguments++;
+    Value* bodyStart = &*arguments++;
+    Value* bodyEnd = &*arguments++;
+    Value* partials = &*arguments++;
+
+    BasicBlock* entry = BasicBlock::Create(llvmContext, "entry", body);
+    context.pushBlock(entry);
+    Value* environment = new BitCastInst(bodyEnvironment, environmentType->getPointerTo(), "environment", entry);
+    unsigned member = 0;
+    for (auto variable : scope) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, member++) };
+        Value* pointer = GetElementPtrInst::CreateInBounds(environmentType, environment, indices, "", entry);
+        context.localScope()[variable.first] = new LoadInst(pointer, variable.first, entry);
+    }
+    Value* bodyCollection = nullptr;
+    if (collectionValue != nullptr) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, member) };
+        bodyCollection = new LoadInst(GetElementPtrInst::CreateInBounds(environmentType, environment, indices, "", entry), "collection", entry);
+    }
+    vector<Value*> privateReductions;
+    for (size_t i=0; i<reductionNames.size(); i++) {
+        Type* reductionType = reductionVariables[i]->getType()->getPointerElementType();
+        AllocaInst* privateReduction = new AllocaInst(reductionType, 0, reductionNames[i], entry);
+        new StoreInst(Constant::getNullValue(reductionType), privateReduction, entry);
+        context.localScope()[reductionNames[i]] = privateReduction;
+        privateReductions.push_back(privateReduction);
+    }
+
+    BasicBlock* exitBlock = generateLoop(context, bodyStart, bodyEnd, bodyCollection);
+    if (exitBlock == nullptr) {
+        context.popBlock();
+        return nullptr;
+    }
+    body->getBasicBlockList().push_back(exitBlock);
+    context.replaceCurrentBlock(exitBlock);
+    // add this chunk's share to the partials of the worker running it
+    for (size_t i=0; i<privateReductions.size(); i++) {
+        Type* reductionType = reductionVariables[i]->getType()->getPointerElementType();
+        Value* slot = GetElementPtrInst::CreateInBounds(integerType, partials, ConstantInt::get(integerType, i), "", exitBlock);
+        slot = new BitCastInst(slot, reductionType->getPointerTo(), "", exitBlock);
+        Value* sum = BinaryOperator::Create(reductionType == doubleType ? Instruction::FAdd : Instruction::Add,
+                new LoadInst(slot, "", exitBlock), new LoadInst(privateReductions[i], "", exitBlock), "", exitBlock);
+        new StoreInst(sum, slot, exitBlock);
+    }
+    ReturnInst* bodyReturn = ReturnInst::Create(llvmContext, exitBlock);
+    context.popBlock();
+    // any other return comes from the loop body, with or without a value
+    for (BasicBlock& block : *body) {
+        ReturnInst* returnInstruction = dyn_cast_or_null<ReturnInst>(block.getTerminator());
+        if (returnInstruction != nullptr && returnInstruction != bodyReturn) {
+            return error(context, "Unable to return from inside a parallel for");
+        }
+    }
+
+    // the environment and results live in the entry block, so parallel loops nested in loops don't grow the stack
+    AllocaInst* environmentValue = context.createEntryBlockAlloca(context.currentFunction(), environmentType, "environment");
+    member = 0;
+    for (auto variable : scope) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, member++) };
+        new StoreInst(variable.second, GetElementPtrInst::CreateInBounds(environmentType, environmentValue, indices, "", context.currentBlock()), context.currentBlock());
+    }
+    if (collectionValue != nullptr) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, member) };
+        new StoreInst(collectionValue, GetElementPtrInst::CreateInBounds(environmentType, environmentValue, indices, "", context.currentBlock()), context.currentBlock());
+    }
+    AllocaInst* results = context.createEntryBlockAlloca(context.currentFunction(), ArrayType::get(integerType, MAXIMUM_REDUCTIONS), "results");
+    Value* resultIndices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, 0) };
+    Value* firstResult = GetElementPtrInst::CreateInBounds(results->getAllocatedType(), results, resultIndices, "", context.currentBlock());
+
+    Function* parallelFor = context.getRuntimeFunction("oolong_parallel_for", Type::getVoidTy(llvmContext),
+            { body->getType(), bytePointerType, integerType, integerType, integerType, integerType, partialsType });
+    Value* parallelForArguments[] = { body, new BitCastInst(environmentValue, bytePointerType, "", context.currentBlock()), startValue, endValue,
+                                      ConstantInt::get(integerType, reductionNames.size()), ConstantInt::get(integerType, doubleReductions), firstResult };
+    CallInst::Create(parallelFor, parallelForArguments, "", context.currentBlock());
+
+    for (size_t i=0; i<reductionVariables.size(); i++) {
+        Type* reductionType = reductionVariables[i]->getType()->getPointerElementType();
+        Value* result = GetElementPtrInst::CreateInBounds(integerType, firstResult, ConstantInt::get(integerType, i), "", context.currentBlock());
+        result = new BitCastInst(result, reductionType->getPointerTo(), "", context.currentBlock());
+        Value* sum = BinaryOperator::Create(reductionType == doubleType ? Instruction::FAdd : Instruction::Add,
+                new LoadInst(reductionVariables[i], "", context.currentBlock()), new LoadInst(result, "", context.currentBlock()), "", context.currentBlock());
+        new StoreInst(sum, reductionVariables[i], context.currentBlock());
+    }
+
+    return nullptr;
+}
+
+/* The runtime picks the channel and receives from it in one step, the result is a switch over the channel
+   index, -1 (all channels closed and empty) skips every case */
+Value* SelectStatementNode::generateCode(CodeGenerationContext& context) {
+    LLVMContext& llvmContext = context.getLLVMContext();
+    TypeConverter& typeConverter = context.getTypeConverter();
+    Channels& channels = context.getChannels();
+    Function* currentFunction = context.currentBlock()->getParent();
+
+    vector<Value*> channelValues;
+    for (SelectCaseNode* selectCase : cases) {
+        Value* channelValue = selectCase->channel.generateCode(context);
+        if (channelValue == nullptr) {
+            return nullptr;
+        }
+        if (!channels.isChannel(channelValue->getType())) {
+            return error(context, "Unable to select on type " + typeConverter.getTypeName(channelValue->getType()));
+        }
+        channelValues.push_back(channelValue);
+    }
+    Value* bits = nullptr;
+    Value* index = channels.select(channelValues, bits);
+
+    BasicBlock* exitBlock = BasicBlock::Create(llvmContext, "selectExit");
+    SwitchInst* selectSwitch = SwitchInst::Create(index, exitBlock, cases.size(), context.currentBlock());
+    for (size_t i=0; i<cases.size(); i++) {
+        SelectCaseNode* selectCase = cases[i];
+        BasicBlock* caseBlock = BasicBlock::Create(llvmContext, "selectCase", currentFunction);
+        selectSwitch->addCase(ConstantInt::get(cast<IntegerType>(index->getType()), i), caseBlock);
+
+        context.pushBlock(caseBlock);
+        Value* variableReference = selectCase->variable->generateCode(context);
+        if (variableReference == nullptr) {
+            return nullptr;
+        }
+        Type* variableType = variableReference->getType()->getPointerElementType();
+        Value* value = channels.getSelectedValue(bits, channelValues[i]->getType());
+        Value* convertedValue = typeConverter.convertType(value, variableType);
+        if (convertedValue == nullptr) {
+            return error(context, "Variable " + selectCase->variable->id.name + " of type " + typeConverter.getTypeName(variableType) + " can't hold values of type " + typeConverter.getTypeName(value->getType()));
+        }
+        new StoreInst(convertedValue, variableReference, false, context.currentBlock());
+        selectCase->block.generateCode(context);
+        if (!context.currentBlockReturns()) {
+            BranchInst::Create(exitBlock, context.currentBlock());
+        }
+        context.popBlock(); // caseBlock (descope the received variable)
+    }
+
+    // manually pushing back exitBlock to keep things in order
+    currentFunction->getBasicBlockList().push_back(exitBlock);
+    // make exitBlock the new current block
+    context.replaceCurrentBlock(exitBlock);
+
+    return nullptr;
+}
+
+Value* IncrementExpressionNode::generateCode(CodeGenerationContext& context) {
+    IntegerNode* one = new IntegerNode(1);
+    Value* originalValue = nullptr;
+    Value* incrementedValue = assignable.generateUpdate(context, TOKEN_PLUS, *one, originalValue);
+    if (incrementedValue == nullptr) {
+        return nullptr;
+    }
 
     if (postfix) {
         // return original value
@@ -591,26 +1454,19 @@ Value* IncrementExpressionNode::generateCode(CodeGenerationContext& context) {
 }
 
 Value* DecrementExpressionNode::generateCode(CodeGenerationContext& context) {
-    ReferenceNode* variableReference = new ReferenceNode(assignable);
-
+    IntegerNode* one = new IntegerNode(1);
     Value* originalValue = nullptr;
-    if (postfix) {
-        // need to return original value
-        originalValue = variableReference->generateCode(context);
+    Value* decrementedValue = assignable.generateUpdate(context, TOKEN_MINUS, *one, originalValue);
+    if (decrementedValue == nullptr) {
+        return nullptr;
     }
-    IntegerNode* one = new IntegerNode(1);
-    BinaryOperatorNode* subtract = new BinaryOperatorNode(*variableReference, TOKEN_MINUS, *one);
-    Value* decrementedValue = subtract->generateCode(context);
-
-    Value* variable = assignable.generateCode(context);
-    new StoreInst(decrementedValue, variable, false, context.currentBlock());
 
     if (postfix) {
         // return original value
         return originalValue;
     }
     else {
-        // prefix, return incremented value
+        // prefix, return decremented value
         return decrementedValue;
     }
 }
@@ -21,7 +21,7 @@ class Node {
 public:
     virtual ~Node() {}
 
-    int lineNumber;
+    int lineNumber = 0;
 
     virtual llvm::Value* generateCode(CodeGenerationContext& context) { return nullptr; }
 };
@@ -80,19 +80,63 @@ public:
 class AssignableNode : public ExpressionNode {
 public:
     AssignableNode(IdentifierNode& identifier) : identifier(identifier) {}
+    AssignableNode(IdentifierNode& identifier, ExpressionNode* index) : identifier(identifier), index(index) {}
 
     IdentifierNode& identifier;
+    ExpressionNode* index = nullptr; // element of a collection or value of a Map key, e.g. values[i]
 
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
+    // pointer for storing a value, inserts the key of a Map element
+    llvm::Value* generateAssignedCode(CodeGenerationContext& context);
+    // combines the value with the operand and stores the result, e.g. values[i] += 2, returns the stored value
+    llvm::Value* generateUpdate(CodeGenerationContext& context, int operation, ExpressionNode& operand, llvm::Value*& originalValue);
+
+private:
+    enum Access { READ, ASSIGN, UPDATE };
+
+    llvm::Value* generatePointer(CodeGenerationContext& context, Access access);
+    llvm::Value* generateIndex(CodeGenerationContext& context, llvm::Value*& collection, llvm::Value*& indexValue);
+    llvm::Value* generateElementPointer(CodeGenerationContext& context, llvm::Value* collection, llvm::Value* indexValue, Access access);
 };
 
 class ReferenceNode : public ExpressionNode {
 public:
     ReferenceNode(IdentifierNode& identifier) { reference.push_back(&identifier); }
-    ReferenceNode(AssignableNode& assignable) { reference.push_back(&assignable.identifier); }
+    ReferenceNode(AssignableNode& assignable) : assignable(&assignable) { reference.push_back(&assignable.identifier); }
     ReferenceNode(const IdentifierList& reference) : reference(reference) {}
 
     IdentifierList reference;
+    AssignableNode* assignable = nullptr;
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
+class CollectionNode : public ExpressionNode {
+public:
+    CollectionNode(const std::string& typeName, ExpressionNode* size) : typeName(typeName), size(size) {}
+
+    std::string typeName;
+    ExpressionNode* size = nullptr; // Array size or initial List or Map capacity
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
+class AtomicNode : public ExpressionNode {
+public:
+    AtomicNode(const std::string& typeName, ExpressionNode& initialValue) : typeName(typeName), initialValue(initialValue) {}
+
+    std::string typeName;
+    ExpressionNode& initialValue;
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
+class ChannelNode : public ExpressionNode {
+public:
+    ChannelNode(const std::string& typeName, ExpressionNode* capacity) : typeName(typeName), capacity(capacity) {}
+
+    std::string typeName;
+    ExpressionNode* capacity = nullptr; // unbuffered without
 
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
 };
@@ -105,6 +149,28 @@ public:
     const IdentifierList& reference;
     ExpressionList arguments;
 
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+
+protected:
+    llvm::Function* generateArguments(CodeGenerationContext& context, std::vector<llvm::Value*>& convertedArguments);
+};
+
+// Call that runs on the runtime's thread pool (package/future.c), the value is a Future of the result.
+class SpawnNode : public FunctionCallNode {
+public:
+    SpawnNode(const IdentifierList& reference, ExpressionList& arguments) : FunctionCallNode(reference, arguments) {}
+    SpawnNode(const IdentifierList& reference) : FunctionCallNode(reference) {}
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
+// Waits for the Future in a variable and results in its value, awaiting it again results in the same value.
+class AwaitNode : public ExpressionNode {
+public:
+    AwaitNode(IdentifierNode& identifier) : identifier(identifier) {}
+
+    IdentifierNode& identifier;
+
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
 };
 
@@ -133,9 +199,11 @@ class AssignmentNode : public StatementNode {
 public:
     AssignmentNode(llvm::Value* variable, ExpressionNode& rightHandSide) : variable(variable), rightHandSide(rightHandSide) {}
     AssignmentNode(AssignableNode* leftHandSide, ExpressionNode& rightHandSide) : leftHandSide(leftHandSide), rightHandSide(rightHandSide) {}
+    AssignmentNode(AssignableNode* leftHandSide, int operation, ExpressionNode& rightHandSide) : leftHandSide(leftHandSide), operation(operation), rightHandSide(rightHandSide) {}
 
-    llvm::Value* variable;
-    AssignableNode* leftHandSide;
+    llvm::Value* variable = nullptr;
+    AssignableNode* leftHandSide = nullptr;
+    int operation = 0; // of a compound assignment, e.g. TOKEN_PLUS for +=
     ExpressionNode& rightHandSide;
 
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
@@ -168,6 +236,15 @@ public:
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
 };
 
+class YieldStatementNode : public StatementNode {
+public:
+    YieldStatementNode(ExpressionNode& expression) : expression(expression) {}
+
+    ExpressionNode& expression;
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
 class VariableDeclarationNode : public StatementNode {
 public:
     VariableDeclarationNode(const IdentifierNode& type, IdentifierNode& id) : type(type), id(id) {}
@@ -176,18 +253,26 @@ public:
     const IdentifierNode& type;
     IdentifierNode& id;
     ExpressionNode *assignmentExpression;
+    unsigned argumentNumber = 0; // position for function arguments (starting at 1), 0 otherwise
 
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
 };
 
 class FunctionDeclarationNode : public StatementNode {
 public:
-    FunctionDeclarationNode(const IdentifierNode& type, const IdentifierNode& id, VariableList& arguments, BlockNode& block) : type(type), id(id), arguments(arguments), block(block) {}
+    // generator and async functions are coroutines (coroutines.cpp), returning Generator<T> and Future<T>
+    enum Kind { PLAIN, GENERATOR, ASYNC };
+
+    FunctionDeclarationNode(const IdentifierNode& type, const IdentifierNode& id, VariableList& arguments, BlockNode& block, Kind kind = PLAIN) : type(type), id(id), arguments(arguments), block(block), kind(kind) {}
 
     const IdentifierNode& type;
     const IdentifierNode& id;
     VariableList& arguments;
     BlockNode& block;
+    Kind kind;
+    bool memoized = false; // @memoize, calls go through a cache of results (memoization.cpp)
+    int64_t cacheLimit = 0; // results a memoized function keeps at most, 0 for no limit
+    bool constant = false; // const, calls with constant arguments are folded (constant-evaluation.cpp)
 
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
 };
@@ -247,6 +332,60 @@ public:
     virtual llvm::Value* generateCode(CodeGenerationContext& context);
 };
 
+class RangeLoopNode : public StatementNode {
+public:
+    RangeLoopNode(VariableDeclarationNode* variable, ExpressionNode* start, ExpressionNode* end, BlockNode& block) : variable(variable), start(start), end(end), block(block) {}
+    RangeLoopNode(VariableDeclarationNode* variable, ExpressionNode* collection, BlockNode& block) : variable(variable), collection(collection), block(block) {}
+
+    VariableDeclarationNode* variable = nullptr;
+    ExpressionNode* start = nullptr;
+    ExpressionNode* end = nullptr;
+    ExpressionNode* collection = nullptr;
+    BlockNode& block;
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+
+protected:
+    bool generateBounds(CodeGenerationContext& context, llvm::Value*& startValue, llvm::Value*& endValue, llvm::Value*& collectionValue);
+    llvm::BasicBlock* generateLoop(CodeGenerationContext& context, llvm::Value* startValue, llvm::Value* endValue, llvm::Value* collectionValue);
+    llvm::BasicBlock* generateStreamLoop(CodeGenerationContext& context, llvm::Value* streamValue);
+};
+
+// Range loop whose body is outlined and run on the runtime's thread pool (package/parallel.c).
+// Reductions are variables that the body only adds to, every chunk adds to a private copy.
+class ParallelLoopNode : public RangeLoopNode {
+public:
+    ParallelLoopNode(VariableDeclarationNode* variable, ExpressionNode* start, ExpressionNode* end, IdentifierList& reductions, BlockNode& block) : RangeLoopNode(variable, start, end, block), reductions(reductions) {}
+    ParallelLoopNode(VariableDeclarationNode* variable, ExpressionNode* collection, IdentifierList& reductions, BlockNode& block) : RangeLoopNode(variable, collection, block), reductions(reductions) {}
+
+    IdentifierList& reductions;
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
+// One receive of a select statement, the block runs with the received value in variable.
+class SelectCaseNode : public Node {
+public:
+    SelectCaseNode(VariableDeclarationNode* variable, ExpressionNode& channel, BlockNode& block) : variable(variable), channel(channel), block(block) {}
+
+    VariableDeclarationNode* variable = nullptr;
+    ExpressionNode& channel;
+    BlockNode& block;
+};
+
+typedef std::vector<SelectCaseNode*> SelectCaseList;
+
+// Waits until any of the channels has a value and runs the case of the channel it was received from,
+// nothing runs once all channels are closed and empty.
+class SelectStatementNode : public StatementNode {
+public:
+    SelectStatementNode(SelectCaseList& cases) : cases(cases) {}
+
+    SelectCaseList& cases;
+
+    virtual llvm::Value* generateCode(CodeGenerationContext& context);
+};
+
 class IncrementExpressionNode : public ExpressionNode {
 public:
     IncrementExpressionNode(AssignableNode& assignable, bool postfix) : assignable(assignable), postfix(postfix) {}
@@ -0,0 +1,194 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "assembly-annotator.h"
+#include "common.h"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace std;
+using namespace llvm;
+
+static string normalizeWhitespace(StringRef text) {
+    string normalized;
+    bool whitespace = false;
+    for (char c : text.trim()) {
+        if (c == ' ' || c == '\t') {
+            whitespace = true;
+            continue;
+        }
+        if (whitespace && !normalized.empty()) {
+            normalized += ' ';
+        }
+        whitespace = false;
+        normalized += c;
+    }
+    return normalized;
+}
+
+AssemblyAnnotator::AnnotatedFunction* AssemblyAnnotator::findFunction(const string& name) {
+    auto it = functionIndices.find(name);
+    if (it == functionIndices.end()) {
+        return nullptr;
+    }
+    return &functions[it->second];
+}
+
+void AssemblyAnnotator::collectIntermediateRepresentation(Module& module) {
+    for (Function& function : module) {
+        if (function.isDeclaration()) {
+            continue;
+        }
+        AnnotatedFunction annotatedFunction;
+        annotatedFunction.name = function.getName().str();
+        if (DISubprogram* subprogram = function.getSubprogram()) {
+            annotatedFunction.lineNumber = subprogram->getLine();
+        }
+        for (Instruction& instruction : instructions(function)) {
+            if (isa<DbgInfoIntrinsic>(instruction)) {
+                continue;
+            }
+            string text;
+            raw_string_ostream output(text);
+            instruction.print(output);
+            output.flush();
+            // drop the attached metadata, the line is shown by the listing itself
+            size_t debugMetadata = text.find(", !dbg");
+            if (debugMetadata != string::npos) {
+                text.erase(debugMetadata);
+            }
+            const unsigned line = instruction.getDebugLoc() ? instruction.getDebugLoc().getLine() : 0;
+            annotatedFunction.intermediateRepresentation[line].push_back(normalizeWhitespace(text));
+            annotatedFunction.intermediateInstructions++;
+        }
+        functionIndices[annotatedFunction.name] = functions.size();
+        functions.push_back(annotatedFunction);
+    }
+}
+
+// Assign instructions to lines by following the .loc directives the assembly printer emits from the line tables.
+void AssemblyAnnotator::collectMachineCode(StringRef assembly) {
+    AnnotatedFunction* function = nullptr;
+    unsigned line = 0;
+    SmallVector<StringRef, 0> assemblyLines;
+    assembly.split(assemblyLines, '\n');
+    for (StringRef assemblyLine : assemblyLines) {
+        const size_t comment = assemblyLine.find(commentString);
+        StringRef code = assemblyLine.substr(0, comment).rtrim();
+        if (code.empty()) {
+            continue;
+        }
+
+        const bool indented = code[0] == ' ' || code[0] == '\t';
+        code = code.ltrim();
+        if (!indented && code.endswith(":")) {
+            // label
+            StringRef label = code.drop_back().trim('"');
+            if (AnnotatedFunction* labelFunction = findFunction(label.str())) {
+                function = labelFunction;
+                line = function->lineNumber;
+            }
+            else if (label.startswith(".Lfunc_end")) {
+                function = nullptr;
+            }
+            else if (function != nullptr && !label.startswith(".Ltmp") && !label.startswith(".Lfunc_begin")) {
+                // keep branch targets, loops are easier to spot
+                function->machineCode[line].push_back(code.str());
+            }
+            continue;
+        }
+        if (function == nullptr) {
+            continue;
+        }
+        if (code.startswith(".loc")) {
+            unsigned file = 0;
+            unsigned locationLine = 0;
+            if (sscanf(code.str().c_str(), ".loc %u %u", &file, &locationLine) == 2) {
+                line = locationLine;
+            }
+            continue;
+        }
+        if (code.startswith(".")) {
+            // other directives
+            continue;
+        }
+        function->machineCode[line].push_back("    " + normalizeWhitespace(code));
+        function->machineInstructions++;
+    }
+}
+
+void AssemblyAnnotator::collectCodeSizes(StringRef object) {
+    for (auto& size : getFunctionSizes(object)) {
+        if (AnnotatedFunction* function = findFunction(size.first)) {
+            function->bytes = size.second;
+        }
+    }
+}
+
+bool AssemblyAnnotator::write(const string& fileName, StringRef assembly, StringRef object) {
+    collectMachineCode(assembly);
+    collectCodeSizes(object);
+
+    vector<string> sourceLines;
+    ifstream sourceFile(sourceFileName);
+    string sourceLine;
+    while (getline(sourceFile, sourceLine)) {
+        sourceLines.push_back(sourceLine);
+    }
+
+    ofstream output(fileName);
+    if (!output) {
+        return false;
+    }
+    for (AnnotatedFunction& function : functions) {
+        output << function.name << ": " << function.intermediateInstructions << " IR instructions, "
+               << function.machineInstructions << " machine instructions, " << function.bytes << " bytes\n";
+
+        // all lines that generated code, in source order
+        map<unsigned, bool> lines;
+        for (auto& entry : function.intermediateRepresentation) {
+            lines[entry.first] = true;
+        }
+        for (auto& entry : function.machineCode) {
+            lines[entry.first] = true;
+        }
+        for (auto& entry : lines) {
+            const unsigned line = entry.first;
+            if (line == 0) {
+                output << setw(6) << "-" << " | <no source line>\n";
+            }
+            else {
+                output << setw(6) << line << " | " << (line <= sourceLines.size() ? sourceLines[line-1] : "") << '\n';
+            }
+            for (const string& instruction : function.intermediateRepresentation[line]) {
+                output << setw(6) << "" << " |   IR   " << instruction << '\n';
+            }
+            for (const string& instruction : function.machineCode[line]) {
+                output << setw(6) << "" << " |   asm  " << instruction << '\n';
+            }
+        }
+        output << '\n';
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef ASSEMBLY_ANNOTATOR_H
+#define ASSEMBLY_ANNOTATOR_H
+
+#include <llvm/ADT/StringRef.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class Module;
+}
+
+// Writes a listing that interleaves every Oolong source line with the IR and
+// the machine instructions generated for it (--annotate). Lines are taken from
+// the debug line tables of the IR and the .loc directives of the assembly.
+class AssemblyAnnotator {
+private:
+    struct AnnotatedFunction {
+        std::string name;
+        unsigned lineNumber = 0;
+        unsigned intermediateInstructions = 0;
+        unsigned machineInstructions = 0;
+        uint64_t bytes = 0;
+        // by source line, 0 for code without a line
+        std::map<unsigned, std::vector<std::string>> intermediateRepresentation;
+        std::map<unsigned, std::vector<std::string>> machineCode;
+    };
+
+    std::string sourceFileName;
+    std::string commentString;
+    std::vector<AnnotatedFunction> functions;
+    std::map<std::string, size_t> functionIndices;
+
+    AnnotatedFunction* findFunction(const std::string& name);
+    void collectMachineCode(llvm::StringRef assembly);
+    void collectCodeSizes(llvm::StringRef object);
+
+public:
+    AssemblyAnnotator(const std::string& sourceFileName, const std::string& commentString) : sourceFileName(sourceFileName), commentString(commentString) {}
+
+    void collectIntermediateRepresentation(llvm::Module& module);
+    bool write(const std::string& fileName, llvm::StringRef assembly, llvm::StringRef object);
+};
+
+#endif
@@ -0,0 +1,147 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "atomics.h"
+#include "code-generation.h"
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+// atomic instructions need a size that is a power of two bytes, Booleans are stored as i8
+static const unsigned ALIGNMENT = 8;
+
+void Atomics::declare() {
+    declareAtomic("Integer");
+    declareAtomic("Boolean");
+}
+
+void Atomics::declareAtomic(const string& valueTypeName) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* valueType = typeConverter.getType(valueTypeName);
+    Type* booleanType = typeConverter.getBooleanType();
+    Type* voidType = typeConverter.getVoidType();
+    const bool isBoolean = valueType == booleanType;
+    Type* storedType = isBoolean ? Type::getInt8Ty(llvmContext) : valueType;
+    Type* atomicType = typeConverter.createType({ storedType }, "Atomic<" + valueTypeName + ">")->getPointerTo();
+    valueTypes[atomicType] = valueType;
+
+    // conversion between the stored and the Oolong value
+    auto toStored = [&](Value* value, BasicBlock* block) -> Value* {
+        return isBoolean ? new ZExtInst(value, storedType, "", block) : value;
+    };
+    auto toValue = [&](Value* value, BasicBlock* block) -> Value* {
+        return isBoolean ? new TruncInst(value, valueType, "", block) : value;
+    };
+
+    // load(Atomic<T>) : T, loadAcquire, loadRelaxed
+    const pair<string, AtomicOrdering> loads[] = { { "load", AtomicOrdering::SequentiallyConsistent },
+                                                    { "loadAcquire", AtomicOrdering::Acquire },
+                                                    { "loadRelaxed", AtomicOrdering::Monotonic } };
+    for (auto& load : loads) {
+        Function* function = context->createBuiltinFunction(valueType, load.first, { atomicType });
+        BasicBlock* block = &function->getEntryBlock();
+        LoadInst* value = new LoadInst(getValuePointer(&*function->arg_begin(), block), "value", false, block);
+        value->setAlignment(ALIGNMENT);
+        value->setAtomic(load.second);
+        ReturnInst::Create(llvmContext, toValue(value, block), block);
+    }
+
+    // store(Atomic<T>, T), storeRelease, storeRelaxed
+    const pair<string, AtomicOrdering> stores[] = { { "store", AtomicOrdering::SequentiallyConsistent },
+                                                     { "storeRelease", AtomicOrdering::Release },
+                                                     { "storeRelaxed", AtomicOrdering::Monotonic } };
+    for (auto& store : stores) {
+        Function* function = context->createBuiltinFunction(voidType, store.first, { atomicType, valueType });
+        BasicBlock* block = &function->getEntryBlock();
+        Value* value = toStored(&*(function->arg_begin() + 1), block);
+        StoreInst* storeValue = new StoreInst(value, getValuePointer(&*function->arg_begin(), block), false, block);
+        storeValue->setAlignment(ALIGNMENT);
+        storeValue->setAtomic(store.second);
+        ReturnInst::Create(llvmContext, block);
+    }
+
+    // exchange(Atomic<T>, T) : T, the previous value
+    Function* exchange = context->createBuiltinFunction(valueType, "exchange", { atomicType, valueType });
+    BasicBlock* block = &exchange->getEntryBlock();
+    Value* previous = new AtomicRMWInst(AtomicRMWInst::Xchg, getValuePointer(&*exchange->arg_begin(), block),
+            toStored(&*(exchange->arg_begin() + 1), block), AtomicOrdering::SequentiallyConsistent, SyncScope::System, block);
+    ReturnInst::Create(llvmContext, toValue(previous, block), block);
+
+    // compareExchange(Atomic<T>, expected : T, desired : T) : Boolean, true if the value was expected and is now desired
+    Function* compareExchange = context->createBuiltinFunction(booleanType, "compareExchange", { atomicType, valueType, valueType });
+    block = &compareExchange->getEntryBlock();
+    Value* result = new AtomicCmpXchgInst(getValuePointer(&*compareExchange->arg_begin(), block),
+            toStored(&*(compareExchange->arg_begin() + 1), block), toStored(&*(compareExchange->arg_begin() + 2), block),
+            AtomicOrdering::SequentiallyConsistent, AtomicOrdering::SequentiallyConsistent, SyncScope::System, block);
+    ReturnInst::Create(llvmContext, ExtractValueInst::Create(result, { 1 }, "exchanged", block), block);
+
+    if (isBoolean) {
+        return;
+    }
+    // add(Atomic<Integer>, Integer) : Integer, subtract, addRelaxed, subtractRelaxed, result is the previous value
+    const struct {
+        const char* name;
+        AtomicRMWInst::BinOp operation;
+        AtomicOrdering ordering;
+    } updates[] = { { "add", AtomicRMWInst::Add, AtomicOrdering::SequentiallyConsistent },
+                    { "addRelaxed", AtomicRMWInst::Add, AtomicOrdering::Monotonic },
+                    { "subtract", AtomicRMWInst::Sub, AtomicOrdering::SequentiallyConsistent },
+                    { "subtractRelaxed", AtomicRMWInst::Sub, AtomicOrdering::Monotonic } };
+    for (auto& update : updates) {
+        Function* function = context->createBuiltinFunction(valueType, update.name, { atomicType, valueType });
+        block = &function->getEntryBlock();
+        previous = new AtomicRMWInst(update.operation, getValuePointer(&*function->arg_begin(), block),
+                &*(function->arg_begin() + 1), update.ordering, SyncScope::System, block);
+        ReturnInst::Create(llvmContext, previous, block);
+    }
+}
+
+Value* Atomics::getValuePointer(Value* atomic, BasicBlock* block) {
+    Type* int32Type = Type::getInt32Ty(context->getLLVMContext());
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, 0) };
+    return GetElementPtrInst::CreateInBounds(atomic->getType()->getPointerElementType(), atomic, indices, "value", block);
+}
+
+bool Atomics::isAtomic(Type* type) const {
+    return valueTypes.count(type) > 0;
+}
+
+Value* Atomics::create(Type* atomicType, Value* initialValue) {
+    BasicBlock* block = context->currentBlock();
+    Type* valueType = valueTypes[atomicType];
+    Value* value = context->getTypeConverter().convertType(initialValue, valueType);
+    if (value == nullptr) {
+        return nullptr;
+    }
+    Function* allocate = context->getRuntimeFunction("oolong_atomic_new", Type::getInt8PtrTy(context->getLLVMContext()), {});
+    Value* atomic = new BitCastInst(CallInst::Create(allocate, "", block), atomicType, "", block);
+    Value* pointer = getValuePointer(atomic, block);
+    if (valueType != pointer->getType()->getPointerElementType()) {
+        value = new ZExtInst(value, pointer->getType()->getPointerElementType(), "", block);
+    }
+    // not shared yet, handing the reference to another thread (spawn, parallel for) publishes it
+    new StoreInst(value, pointer, block);
+    return atomic;
+}
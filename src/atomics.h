@@ -0,0 +1,36 @@
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Atomic<Integer> and Atomic<Boolean>, references to a value on its own cache line (package/atomic.c)
+// that is only accessed with atomic instructions. Every operation is a small internal function whose
+// name states the memory ordering when it isn't sequentially consistent, e.g. loadAcquire or addRelaxed.
+class Atomics {
+private:
+    CodeGenerationContext* context;
+    std::map<llvm::Type*, llvm::Type*> valueTypes; // Atomic<T> to T
+
+    void declareAtomic(const std::string& valueTypeName);
+    llvm::Value* getValuePointer(llvm::Value* atomic, llvm::BasicBlock* block);
+
+public:
+    Atomics(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    bool isAtomic(llvm::Type* type) const;
+    llvm::Value* create(llvm::Type* atomicType, llvm::Value* initialValue);
+};
+
+#endif
@@ -0,0 +1,167 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "channels.h"
+#include "code-generation.h"
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+void Channels::declare() {
+    declareChannel("Boolean");
+    declareChannel("Integer");
+    declareChannel("Double");
+    declareChannel("String");
+}
+
+void Channels::declareChannel(const string& valueTypeName) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* valueType = typeConverter.getType(valueTypeName);
+    Type* voidType = typeConverter.getVoidType();
+    Type* integerType = typeConverter.getIntegerType();
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    // only the runtime knows the layout
+    Type* channelType = typeConverter.createOpaqueType("Channel<" + valueTypeName + ">")->getPointerTo();
+    valueTypes[channelType] = valueType;
+
+    // send(Channel<T>, T), waits while the channel is full or, if unbuffered, until the value was received
+    Function* send = context->createBuiltinFunction(voidType, "send", { channelType, valueType });
+    BasicBlock* block = &send->getEntryBlock();
+    Function* runtimeSend = context->getRuntimeFunction("oolong_channel_send", voidType, { bytePointerType, integerType });
+    Value* sendArguments[] = { toRuntimeChannel(&*send->arg_begin(), block), toBits(&*(send->arg_begin() + 1), block) };
+    CallInst::Create(runtimeSend, sendArguments, "", block);
+    ReturnInst::Create(llvmContext, block);
+
+    // receive(Channel<T>) : T, waits while the channel is empty, the zero value once it is closed and empty
+    Function* receive = context->createBuiltinFunction(valueType, "receive", { channelType });
+    context->pushBlock(&receive->getEntryBlock());
+    Value* value = nullptr;
+    this->receive(&*receive->arg_begin(), value);
+    ReturnInst::Create(llvmContext, value, context->currentBlock());
+    context->popBlock();
+
+    // close(Channel<T>), receivers get the values sent before, sending afterwards is an error
+    Function* close = context->createBuiltinFunction(voidType, "close", { channelType });
+    block = &close->getEntryBlock();
+    Function* runtimeClose = context->getRuntimeFunction("oolong_channel_close", voidType, { bytePointerType });
+    CallInst::Create(runtimeClose, { toRuntimeChannel(&*close->arg_begin(), block) }, "", block);
+    ReturnInst::Create(llvmContext, block);
+}
+
+/* Values travel through the runtime as 64 bit integers */
+Value* Channels::toBits(Value* value, BasicBlock* block) {
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    Type* type = value->getType();
+    if (type->isPointerTy()) {
+        return new PtrToIntInst(value, integerType, "", block);
+    }
+    if (type->isDoubleTy()) {
+        return new BitCastInst(value, integerType, "", block);
+    }
+    if (type != integerType) {
+        return new ZExtInst(value, integerType, "", block);
+    }
+    return value;
+}
+
+Value* Channels::fromBits(Value* bits, Type* valueType, BasicBlock* block) {
+    if (valueType->isPointerTy()) {
+        return new IntToPtrInst(bits, valueType, "", block);
+    }
+    if (valueType->isDoubleTy()) {
+        return new BitCastInst(bits, valueType, "", block);
+    }
+    if (valueType != bits->getType()) {
+        return new TruncInst(bits, valueType, "", block);
+    }
+    return bits;
+}
+
+Value* Channels::toRuntimeChannel(Value* channel, BasicBlock* block) {
+    return new BitCastInst(channel, Type::getInt8PtrTy(context->getLLVMContext()), "", block);
+}
+
+bool Channels::isChannel(Type* type) const {
+    return valueTypes.count(type) > 0;
+}
+
+Type* Channels::getValueType(Type* channelType) const {
+    auto valueType = valueTypes.find(channelType);
+    return valueType != valueTypes.end() ? valueType->second : nullptr;
+}
+
+/* A capacity of 0 creates an unbuffered channel */
+Value* Channels::create(Type* channelType, Value* capacity) {
+    BasicBlock* block = context->currentBlock();
+    Function* allocate = context->getRuntimeFunction("oolong_channel_new", Type::getInt8PtrTy(context->getLLVMContext()), { capacity->getType() });
+    return new BitCastInst(CallInst::Create(allocate, { capacity }, "", block), channelType, "", block);
+}
+
+/* Receives the next value into value, the result is false (and value zero) once the channel is closed and empty */
+Value* Channels::receive(Value* channel, Value*& value) {
+    BasicBlock* block = context->currentBlock();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* integerType = typeConverter.getIntegerType();
+    Function* runtimeReceive = context->getRuntimeFunction("oolong_channel_receive", typeConverter.getBooleanType(),
+            { Type::getInt8PtrTy(context->getLLVMContext()), integerType->getPointerTo() });
+    // stays zero if nothing was received
+    AllocaInst* bits = context->createEntryBlockAlloca(block->getParent(), integerType, "received");
+    new StoreInst(ConstantInt::get(integerType, 0), bits, block);
+    Value* arguments[] = { toRuntimeChannel(channel, block), bits };
+    Value* received = CallInst::Create(runtimeReceive, arguments, "", block);
+    value = fromBits(new LoadInst(bits, "", false, block), valueTypes[channel->getType()], block);
+    return received;
+}
+
+/* Receives from whichever of the channels has a value first. The result is the index of the channel, or -1
+   once all of them are closed and empty. bits is the received value, see getSelectedValue. */
+Value* Channels::select(const vector<Value*>& channels, Value*& bits) {
+    BasicBlock* block = context->currentBlock();
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Function* runtimeSelect = context->getRuntimeFunction("oolong_channel_select", integerType,
+            { bytePointerType->getPointerTo(), integerType, integerType->getPointerTo() });
+
+    ArrayType* channelsType = ArrayType::get(bytePointerType, channels.size());
+    AllocaInst* channelArray = context->createEntryBlockAlloca(block->getParent(), channelsType, "channels");
+    AllocaInst* selected = context->createEntryBlockAlloca(block->getParent(), integerType, "selected");
+    for (size_t i=0; i<channels.size(); i++) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, i) };
+        Value* element = GetElementPtrInst::CreateInBounds(channelsType, channelArray, indices, "", block);
+        new StoreInst(toRuntimeChannel(channels[i], block), element, block);
+    }
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, 0) };
+    Value* arguments[] = { GetElementPtrInst::CreateInBounds(channelsType, channelArray, indices, "", block),
+                           ConstantInt::get(integerType, channels.size()), selected };
+    Value* index = CallInst::Create(runtimeSelect, arguments, "selectedIndex", block);
+    bits = new LoadInst(selected, "", false, block);
+    return index;
+}
+
+Value* Channels::getSelectedValue(Value* bits, Type* channelType) {
+    return fromBits(bits, valueTypes[channelType], context->currentBlock());
+}
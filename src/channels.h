@@ -0,0 +1,43 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Channel<T> of the primitive types, queues between threads implemented by the runtime
+// (package/channel.c), which passes every value as 64 bits. send, receive and close are small internal
+// functions that convert the value and call the runtime, range loops and select statements receive
+// through receive and select.
+class Channels {
+private:
+    CodeGenerationContext* context;
+    std::map<llvm::Type*, llvm::Type*> valueTypes; // Channel<T> to T
+
+    void declareChannel(const std::string& valueTypeName);
+    llvm::Value* toBits(llvm::Value* value, llvm::BasicBlock* block);
+    llvm::Value* fromBits(llvm::Value* bits, llvm::Type* valueType, llvm::BasicBlock* block);
+    llvm::Value* toRuntimeChannel(llvm::Value* channel, llvm::BasicBlock* block);
+
+public:
+    Channels(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    bool isChannel(llvm::Type* type) const;
+    llvm::Type* getValueType(llvm::Type* channelType) const;
+    llvm::Value* create(llvm::Type* channelType, llvm::Value* capacity);
+    llvm::Value* receive(llvm::Value* channel, llvm::Value*& value);
+    llvm::Value* select(const std::vector<llvm::Value*>& channels, llvm::Value*& bits);
+    llvm::Value* getSelectedValue(llvm::Value* bits, llvm::Type* channelType);
+};
+
+#endif
@@ -16,8 +16,12 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "abstract-syntax-tree.h"
+#include "assembly-annotator.h"
 #include "code-generation.h"
+#include "common.h"
 #include "parser.hpp"
+#include "perf-map-listener.h"
+#include "remark-handler.h"
 #include <vector>
 #include <fstream>
 #include <llvm/IR/Module.h>
@@ -32,23 +36,32 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/PassManager.h>
+#include <llvm/MC/MCAsmInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/FileSystem.h>
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Coroutines.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 using namespace std;
 using namespace llvm;
 
-CodeGenerationContext::CodeGenerationContext(const string& unitName) : llvmContext(new LLVMContext()), typeConverter(this), importer(this) {
+// TODO: determine archive path some other / allow overriding it
+static const string STANDARD_LIBRARY_ARCHIVE = "lib/libpackages.a";
+
+CodeGenerationContext::CodeGenerationContext(const string& unitName) : llvmContext(new LLVMContext()), typeConverter(this), importer(this), debugInformation(this), collections(this), maps(this), atomics(this), futures(this), channels(this), coroutines(this), memoization(this), constantEvaluation(this), simd(this) {
     module = new Module(unitName, *llvmContext);
 }
 
@@ -56,6 +69,38 @@ void CodeGenerationContext::setEmitLlvm(bool value) {
     emitLlvm = value;
 }
 
+void CodeGenerationContext::setEmitAssembly(bool value) {
+    emitAssembly = value;
+}
+
+void CodeGenerationContext::setAnnotate(bool value) {
+    annotate = value;
+}
+
+void CodeGenerationContext::setEmitDebugInformation(bool value) {
+    emitDebugInformation = value;
+}
+
+void CodeGenerationContext::setPerfMap(bool value) {
+    perfMap = value;
+}
+
+void CodeGenerationContext::setInstrumentFunctions(bool value) {
+    instrumentFunctions = value;
+}
+
+bool CodeGenerationContext::getInstrumentFunctions() {
+    return instrumentFunctions;
+}
+
+void CodeGenerationContext::setRemarksFilter(const string& value) {
+    remarksFilter = value;
+}
+
+void CodeGenerationContext::setSizeReportFormat(const string& value) {
+    sizeReportFormat = value;
+}
+
 void CodeGenerationContext::setOutputName(const string& value) {
     outputName = value;
 }
@@ -66,20 +111,34 @@ void CodeGenerationContext::setOptimizationLevel(int level) {
 
 int CodeGenerationContext::importStandardLibrary() {
     // load standard library and auto-import default package
-    // TODO: determine archive path some other / allow overriding it
-    importer.loadStandardLibrary("lib/libpackages.a");
+    importer.loadStandardLibrary(STANDARD_LIBRARY_ARCHIVE);
     importer.importPackage("");
+    collections.declare();
+    maps.declare();
+    atomics.declare();
+    futures.declare();
+    channels.declare();
+    coroutines.declare();
+    importer.declareBuiltinPackage("simd", [this]() { simd.declare(); });
 
     return 0;
 }
 
 int CodeGenerationContext::optimizeModule() {
     if (optimizationLevel == 0) {
-        // nothing to do
+        if (coroutines.hasCoroutines()) {
+            // generator and async functions have to be split into their ramp, resume and destroy functions regardless
+            legacy::PassManager coroutinePassManager;
+            coroutinePassManager.add(createCoroEarlyPass());
+            coroutinePassManager.add(createCoroSplitPass());
+            coroutinePassManager.add(createCoroCleanupPass());
+            coroutinePassManager.run(*module);
+        }
         return 0;
     }
 
     legacy::PassManager* passManager = new legacy::PassManager();
+    passManager->add(createTargetTransformInfoWrapperPass(targetMachine->getTargetIRAnalysis()));
     int sizeLevel = 0;
     PassManagerBuilder passManagerBuilder;
     passManagerBuilder.OptLevel = optimizationLevel;
@@ -89,6 +148,11 @@ int CodeGenerationContext::optimizeModule() {
     passManagerBuilder.DisableUnrollLoops = false;
     passManagerBuilder.LoopVectorize = true;
     passManagerBuilder.SLPVectorize = true;
+    targetMachine->adjustPassManager(passManagerBuilder);
+    // CoroEarly normally runs in the function pass manager, which isn't used; CoroSplit runs with the
+    // inliner so ramps can be inlined and CoroElide can move frames that don't escape to the caller's stack
+    passManager->add(createCoroEarlyPass());
+    addCoroutinePassesToExtensionPoints(passManagerBuilder);
     passManagerBuilder.populateModulePassManager(*passManager);
     passManager->run(*module);
 
@@ -124,7 +188,19 @@ int CodeGenerationContext::checkModule() {
     return 0;
 }
 
-int CodeGenerationContext::emitMachineCode() {
+static int emitCode(TargetMachine* targetMachine, Module& module, TargetMachine::CodeGenFileType fileType, SmallVectorImpl<char>& code) {
+    raw_svector_ostream output(code);
+    legacy::PassManager pass;
+    if (targetMachine->addPassesToEmitFile(pass, output, fileType)) {
+        errs() << "Target machine can't emit a file of this type";
+        return 1;
+    }
+    pass.run(module);
+    return 0;
+}
+
+/* Target of the host, known before optimizing so the vectorizer and other passes use its cost model */
+int CodeGenerationContext::initializeTarget() {
     // Initialize the target registry etc.
     InitializeAllTargetInfos();
     InitializeAllTargets();
@@ -151,37 +227,93 @@ int CodeGenerationContext::emitMachineCode() {
 
     TargetOptions opt;
     auto RM = Optional<Reloc::Model>(Reloc::Model::PIC_);
-    auto targetMachine = target->createTargetMachine(targetTriple, cpu, features, opt, RM);
+    targetMachine = target->createTargetMachine(targetTriple, cpu, features, opt, RM);
 
     module->setDataLayout(targetMachine->createDataLayout());
+    return 0;
+}
 
+int CodeGenerationContext::emitMachineCode() {
+    const TargetMachine::CodeGenFileType fileType = emitAssembly ? TargetMachine::CGFT_AssemblyFile : TargetMachine::CGFT_ObjectFile;
+    // the annotation needs both assembly and object code, the size report needs object code
+    const bool emitOtherFileType = annotate || (!sizeReportFormat.empty() && emitAssembly);
+    // code generation changes the IR, the other file type is generated from an untouched copy
+    unique_ptr<Module> otherModule;
+    AssemblyAnnotator annotator(module->getName().str(), targetMachine->getMCAsmInfo()->getCommentString());
+    if (annotate) {
+        annotator.collectIntermediateRepresentation(*module);
+    }
+    if (emitOtherFileType) {
+        otherModule = CloneModule(module);
+    }
+
+    SmallVector<char, 0> code;
+    if (int errorCode = emitCode(targetMachine, *module, fileType, code)) {
+        return errorCode;
+    }
     std::error_code errorCode;
     raw_fd_ostream dest(outputName, errorCode, sys::fs::F_None);
+    dest.write(code.data(), code.size());
+    dest.flush();
 
-    legacy::PassManager pass;
-    auto fileType = TargetMachine::CGFT_ObjectFile;
-
-    if (targetMachine->addPassesToEmitFile(pass, dest, fileType)) {
-        errs() << "Target machine can't emit a file of this type";
-        return 1;
+    SmallVector<char, 0> otherCode;
+    if (emitOtherFileType) {
+        const TargetMachine::CodeGenFileType otherFileType = emitAssembly ? TargetMachine::CGFT_ObjectFile : TargetMachine::CGFT_AssemblyFile;
+        if (int errorCode = emitCode(targetMachine, *otherModule, otherFileType, otherCode)) {
+            return errorCode;
+        }
+    }
+    const StringRef assembly = emitAssembly ? StringRef(code.data(), code.size()) : StringRef(otherCode.data(), otherCode.size());
+    const StringRef object = emitAssembly ? StringRef(otherCode.data(), otherCode.size()) : StringRef(code.data(), code.size());
+    if (annotate) {
+        const string annotationFileName = (module->getName() + ".annotated").str();
+        if (!annotator.write(annotationFileName, assembly, object)) {
+            errs() << "Unable to write " << annotationFileName << "\n";
+            return 1;
+        }
+    }
+    if (!sizeReportFormat.empty()) {
+        sizeReport.collectCodeSizes(object);
     }
-
-    pass.run(*module);
-    dest.flush();
     return 0;
 }
 
 // Compile the AST into a module
 int CodeGenerationContext::generateCode(BlockNode& root) {
+    if (emitDebugInformation) {
+        debugInformation.initialize(module->getName().str(), optimizationLevel > 0);
+    }
     if (int errorCode = importStandardLibrary()) {
         return errorCode;
     }
 
     root.generateCode(*this);
+    removeUnusedBuiltinFunctions();
+    if (mainFunction != nullptr) {
+        // start-up hook of the runtime's sampling profiler (only samples when OOLONG_PROFILE is set)
+        Function* profilerInitialize = getRuntimeFunction("oolong_profiler_initialize", Type::getVoidTy(*llvmContext), {});
+        appendToGlobalCtors(*module, profilerInitialize, 0);
+    }
+    debugInformation.finalize();
 
+    if (!remarksFilter.empty() || !sizeReportFormat.empty()) {
+        // reported by both the optimizer and the code generator passes
+        SizeReport* reportedSizes = sizeReportFormat.empty() ? nullptr : &sizeReport;
+        llvmContext->setDiagnosticHandler(unique_ptr<DiagnosticHandler>(new RemarkHandler(remarksFilter, reportedSizes)));
+    }
+    if (!sizeReportFormat.empty()) {
+        sizeReport.collectBeforeOptimization(*module);
+    }
+
+    if (int errorCode = initializeTarget()) {
+        return errorCode;
+    }
     if (int errorCode = optimizeModule()) {
         return errorCode;
     }
+    if (!sizeReportFormat.empty()) {
+        sizeReport.collectAfterOptimization(*module);
+    }
     if (int errorCode = emitIntermediateRepresentation()) {
         return errorCode;
     }
@@ -191,6 +323,10 @@ int CodeGenerationContext::generateCode(BlockNode& root) {
     if (int errorCode = emitMachineCode()) {
         return errorCode;
     }
+    if (!sizeReportFormat.empty()) {
+        sizeReport.collectRuntimeCodeSizes(STANDARD_LIBRARY_ARCHIVE);
+        sizeReport.write(outs(), module->getName().str(), sizeReportFormat == "json");
+    }
 
     return 0;
 }
@@ -198,10 +334,36 @@ int CodeGenerationContext::generateCode(BlockNode& root) {
 // Executes the AST by running the main function
 GenericValue CodeGenerationContext::runCode() {
 	std::cout << "### EXECUTING CODE ###\n";
-	ExecutionEngine *ee = EngineBuilder( unique_ptr<Module>(module) ).create();
+	// runtime start-up hooks are meant for linked executables, the JIT doesn't run static constructors
+	if (GlobalVariable* constructors = module->getNamedGlobal("llvm.global_ctors")) {
+		constructors->eraseFromParent();
+	}
+	// static, exit hooks of the runtime (e.g. the instrumentation report) still use the module's code and
+	// constants after main returned. The listener is declared first, so it outlives the engine that notifies it.
+	static unique_ptr<PerfMapListener> perfMapListener;
+	static unique_ptr<ExecutionEngine> ee;
+	ee.reset(EngineBuilder( unique_ptr<Module>(module) ).create());
+	if (perfMap) {
+		// jitdump (with line tables when compiled with debug information) for perf inject/annotate
+		JITEventListener* jitDumpListener = JITEventListener::createPerfJITEventListener();
+		if (jitDumpListener != nullptr) {
+			ee->RegisterJITEventListener(jitDumpListener);
+		}
+		else {
+			warning(*this, "LLVM was built without perf support, only writing a perf map.");
+		}
+		// plain symbol map for perf report
+		perfMapListener.reset(new PerfMapListener());
+		ee->RegisterJITEventListener(perfMapListener.get());
+	}
 	ee->finalizeObject();
 	vector<GenericValue> noargs;
 	GenericValue v = ee->runFunction(mainFunction, noargs);
+	// print output is buffered until exit otherwise, after the messages of the compiler
+	Function* flush = module->getFunction("oolong_io_flush");
+	if (flush != nullptr && !flush->isDeclaration()) {
+		ee->runFunction(flush, noargs);
+	}
 	std::cout << "### CODE EXECUTED ###\n";
 	return v;
 }
@@ -244,6 +406,46 @@ Module* CodeGenerationContext::getModule() {
     return module;
 }
 
+// Declare (once) a function of the runtime package that generated code calls directly
+Function* CodeGenerationContext::getRuntimeFunction(const string& name, Type* returnType, const vector<Type*>& arguments) {
+    Function* function = module->getFunction(name);
+    if (function == nullptr) {
+        FunctionType* functionType = FunctionType::get(returnType, arguments, false);
+        function = Function::Create(functionType, Function::ExternalLinkage, name, module);
+        function->setCallingConv(CallingConv::C);
+    }
+    return function;
+}
+
+// Internal function with an empty entry block, available to Oolong code like any imported function, e.g. the
+// functions of collections, Maps and Atomics that are small enough to inline
+Function* CodeGenerationContext::createBuiltinFunction(Type* returnType, const string& name, const vector<Type*>& arguments) {
+    FunctionType* functionType = FunctionType::get(returnType, arguments, false);
+    Function* function = Function::Create(functionType, GlobalValue::InternalLinkage, name, module);
+    function->addFnAttr(Attribute::AlwaysInline);
+    BasicBlock::Create(*llvmContext, "entry", function);
+
+    importer.declareFunction(OolongFunction(returnType, name, arguments, this), function);
+    builtinFunctions.insert(function);
+    return function;
+}
+
+// Builtin functions nobody called would otherwise end up in every program compiled without optimization
+void CodeGenerationContext::removeUnusedBuiltinFunctions() {
+    for (Function* function : builtinFunctions) {
+        if (function->use_empty()) {
+            function->eraseFromParent();
+        }
+    }
+    builtinFunctions.clear();
+}
+
+// Allocas in the entry block are allocated once per call, even when the code using them runs in a loop
+AllocaInst* CodeGenerationContext::createEntryBlockAlloca(Function* function, Type* type, const string& name) {
+    BasicBlock& entry = function->getEntryBlock();
+    return entry.empty() ? new AllocaInst(type, 0, name, &entry) : new AllocaInst(type, 0, name, &entry.front());
+}
+
 Function* CodeGenerationContext::getMainFunction() {
     return mainFunction;
 }
@@ -297,3 +499,43 @@ Importer& CodeGenerationContext::getImporter() {
     return this->importer;
 }
 
+DebugInformation& CodeGenerationContext::getDebugInformation() {
+    return this->debugInformation;
+}
+
+Collections& CodeGenerationContext::getCollections() {
+    return this->collections;
+}
+
+Maps& CodeGenerationContext::getMaps() {
+    return this->maps;
+}
+
+Atomics& CodeGenerationContext::getAtomics() {
+    return this->atomics;
+}
+
+Futures& CodeGenerationContext::getFutures() {
+    return this->futures;
+}
+
+Channels& CodeGenerationContext::getChannels() {
+    return this->channels;
+}
+
+Coroutines& CodeGenerationContext::getCoroutines() {
+    return this->coroutines;
+}
+
+Memoization& CodeGenerationContext::getMemoization() {
+    return this->memoization;
+}
+
+ConstantEvaluation& CodeGenerationContext::getConstantEvaluation() {
+    return this->constantEvaluation;
+}
+
+Simd& CodeGenerationContext::getSimd() {
+    return this->simd;
+}
+
@@ -1,17 +1,33 @@
 #ifndef CODE_GENERATION_H
 #define CODE_GENERATION_H
 
+#include "atomics.h"
+#include "channels.h"
+#include "collections.h"
+#include "constant-evaluation.h"
+#include "coroutines.h"
+#include "futures.h"
+#include "maps.h"
+#include "memoization.h"
+#include "simd.h"
+#include "debug-information.h"
 #include "importer.h"
+#include "size-report.h"
 #include "type-converter.h"
 #include <deque>
 #include <map>
+#include <set>
+#include <vector>
 
 namespace llvm {
+    class AllocaInst;
     class BasicBlock;
     class LLVMContext;
     class Module;
     class Function;
+    class TargetMachine;
     struct GenericValue;
+    class Type;
     class Value;
 }
 
@@ -28,26 +44,56 @@ class BlockNode;
 class CodeGenerationContext {
 private:
     bool emitLlvm = false;
+    bool emitAssembly = false;
+    bool annotate = false;
+    bool emitDebugInformation = false;
+    bool perfMap = false;
+    bool instrumentFunctions = false;
+    std::string remarksFilter;
+    std::string sizeReportFormat;
     std::string outputName;
     int optimizationLevel = 2;
 
     llvm::LLVMContext *llvmContext;
     llvm::Module *module;
     std::deque<CodeGenerationBlock*> blocks; // deque instead of stack to allow or iteration
-    llvm::Function *mainFunction;
+    llvm::Function *mainFunction = nullptr;
+    llvm::TargetMachine *targetMachine = nullptr;
+    std::set<llvm::Function*> builtinFunctions; // see createBuiltinFunction
     TypeConverter typeConverter;
     Importer importer;
+    DebugInformation debugInformation;
+    Collections collections;
+    Maps maps;
+    Atomics atomics;
+    Futures futures;
+    Channels channels;
+    Coroutines coroutines;
+    Memoization memoization;
+    ConstantEvaluation constantEvaluation;
+    Simd simd;
+    SizeReport sizeReport;
 
     int importStandardLibrary();
+    int initializeTarget();
     int optimizeModule();
     int emitIntermediateRepresentation();
     int checkModule();
+    void removeUnusedBuiltinFunctions();
     int emitMachineCode();
 
 public:
     CodeGenerationContext(const std::string& unitName);
 
     void setEmitLlvm(bool value);
+    void setEmitAssembly(bool value);
+    void setAnnotate(bool value);
+    void setEmitDebugInformation(bool value);
+    void setPerfMap(bool value);
+    void setInstrumentFunctions(bool value);
+    bool getInstrumentFunctions();
+    void setRemarksFilter(const std::string& value);
+    void setSizeReportFormat(const std::string& value);
     void setOutputName(const std::string& value);
     void setOptimizationLevel(int optimizationLevel);
 
@@ -59,6 +105,9 @@ public:
     llvm::Function* currentFunction();
     llvm::LLVMContext& getLLVMContext();
     llvm::Module* getModule();
+    llvm::Function* getRuntimeFunction(const std::string& name, llvm::Type* returnType, const std::vector<llvm::Type*>& arguments);
+    llvm::AllocaInst* createEntryBlockAlloca(llvm::Function* function, llvm::Type* type, const std::string& name);
+    llvm::Function* createBuiltinFunction(llvm::Type* returnType, const std::string& name, const std::vector<llvm::Type*>& arguments);
     llvm::Function* getMainFunction();
     void setMainFunction(llvm::Function* function);
     void pushBlock(llvm::BasicBlock *block);
@@ -69,6 +118,16 @@ public:
     bool currentBlockReturns();
     TypeConverter& getTypeConverter();
     Importer& getImporter();
+    DebugInformation& getDebugInformation();
+    Collections& getCollections();
+    Maps& getMaps();
+    Atomics& getAtomics();
+    Futures& getFutures();
+    Channels& getChannels();
+    Coroutines& getCoroutines();
+    Memoization& getMemoization();
+    ConstantEvaluation& getConstantEvaluation();
+    Simd& getSimd();
 };
 
 #endif
@@ -0,0 +1,200 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "collections.h"
+#include "code-generation.h"
+#include <vector>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+static const unsigned DATA_MEMBER = 0;
+static const unsigned SIZE_MEMBER = 1;
+static const unsigned CAPACITY_MEMBER = 2; // List only
+
+// weights for branches to error handling and other rarely taken paths
+static const uint32_t LIKELY_WEIGHT = 1 << 20;
+static const uint32_t UNLIKELY_WEIGHT = 1;
+
+void Collections::declare() {
+    MDBuilder builder(context->getLLVMContext());
+    MDNode* root = builder.createTBAARoot("Oolong collections");
+    MDNode* headerType = builder.createTBAAScalarTypeNode("header", root);
+    headerAccess = builder.createTBAAStructTagNode(headerType, headerType, 0);
+
+    TypeConverter& typeConverter = context->getTypeConverter();
+    for (const string elementTypeName : { "Boolean", "Integer", "Double" }) {
+        MDNode* elementType = builder.createTBAAScalarTypeNode(elementTypeName + " element", root);
+        elementAccesses[typeConverter.getType(elementTypeName)] = builder.createTBAAStructTagNode(elementType, elementType, 0);
+        declareCollection(elementTypeName);
+    }
+}
+
+void Collections::declareCollection(const string& elementTypeName) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* elementType = typeConverter.getType(elementTypeName);
+    Type* integerType = typeConverter.getIntegerType();
+    Type* voidType = typeConverter.getVoidType();
+    Type* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Constant* elementSize = ConstantExpr::getSizeOf(elementType);
+
+    // same layout as struct Array and struct List of the runtime, a List is an Array with a capacity
+    Type* arrayType = typeConverter.createType({ elementType->getPointerTo(), integerType }, "Array<" + elementTypeName + ">")->getPointerTo();
+    Type* listType = typeConverter.createType({ elementType->getPointerTo(), integerType, integerType }, "List<" + elementTypeName + ">")->getPointerTo();
+    arrayTypes.insert(arrayType);
+    listTypes.insert(listType);
+
+    // length(Array<T>) : Integer
+    Function* length = context->createBuiltinFunction(integerType, "length", { arrayType });
+    BasicBlock* block = &length->getEntryBlock();
+    ReturnInst::Create(llvmContext, loadHeader(&*length->arg_begin(), SIZE_MEMBER, "size", block), block);
+
+    // size(List<T>) : Integer
+    Function* size = context->createBuiltinFunction(integerType, "size", { listType });
+    block = &size->getEntryBlock();
+    ReturnInst::Create(llvmContext, loadHeader(&*size->arg_begin(), SIZE_MEMBER, "size", block), block);
+
+    // add(List<T>, T), grows the List when it is full
+    Function* add = context->createBuiltinFunction(voidType, "add", { listType, elementType });
+    Value* list = &*add->arg_begin();
+    Value* value = &*(add->arg_begin() + 1);
+    block = &add->getEntryBlock();
+    BasicBlock* growBlock = BasicBlock::Create(llvmContext, "grow", add);
+    BasicBlock* appendBlock = BasicBlock::Create(llvmContext, "append", add);
+    Value* currentSize = loadHeader(list, SIZE_MEMBER, "size", block);
+    Value* capacity = loadHeader(list, CAPACITY_MEMBER, "capacity", block);
+    Value* full = new ICmpInst(*block, CmpInst::ICMP_EQ, currentSize, capacity, "full");
+    BranchInst* branch = BranchInst::Create(growBlock, appendBlock, full, block);
+    branch->setMetadata(LLVMContext::MD_prof, MDBuilder(llvmContext).createBranchWeights(UNLIKELY_WEIGHT, LIKELY_WEIGHT));
+
+    Function* reserveList = context->getRuntimeFunction("oolong_list_reserve", voidType, { bytePointerType, integerType, integerType });
+    Value* newSize = BinaryOperator::CreateNSWAdd(currentSize, ConstantInt::get(integerType, 1), "newSize", growBlock);
+    Value* reserveArguments[] = { new BitCastInst(list, bytePointerType, "", growBlock), newSize, elementSize };
+    CallInst::Create(reserveList, reserveArguments, "", growBlock);
+    BranchInst::Create(appendBlock, growBlock);
+
+    Value* data = loadHeader(list, DATA_MEMBER, "data", appendBlock);
+    Value* element = GetElementPtrInst::CreateInBounds(elementType, data, currentSize, "element", appendBlock);
+    setElementAccess(new StoreInst(value, element, appendBlock), elementType);
+    newSize = BinaryOperator::CreateNSWAdd(currentSize, ConstantInt::get(integerType, 1), "newSize", appendBlock);
+    Value* sizeIndices[] = { ConstantInt::get(Type::getInt32Ty(llvmContext), 0), ConstantInt::get(Type::getInt32Ty(llvmContext), SIZE_MEMBER) };
+    Value* sizePointer = GetElementPtrInst::CreateInBounds(listType->getPointerElementType(), list, sizeIndices, "", appendBlock);
+    StoreInst* storeSize = new StoreInst(newSize, sizePointer, appendBlock);
+    storeSize->setMetadata(LLVMContext::MD_tbaa, headerAccess);
+    ReturnInst::Create(llvmContext, appendBlock);
+
+    // reserve(List<T>, Integer), room for at least the given number of elements
+    Function* reserve = context->createBuiltinFunction(voidType, "reserve", { listType, integerType });
+    block = &reserve->getEntryBlock();
+    Value* reserveCapacity[] = { new BitCastInst(&*reserve->arg_begin(), bytePointerType, "", block), &*(reserve->arg_begin() + 1), elementSize };
+    CallInst::Create(reserveList, reserveCapacity, "", block);
+    ReturnInst::Create(llvmContext, block);
+
+    // clear(List<T>), keeps the capacity
+    Function* clear = context->createBuiltinFunction(voidType, "clear", { listType });
+    block = &clear->getEntryBlock();
+    sizePointer = GetElementPtrInst::CreateInBounds(listType->getPointerElementType(), &*clear->arg_begin(), sizeIndices, "", block);
+    StoreInst* resetSize = new StoreInst(ConstantInt::get(integerType, 0), sizePointer, block);
+    resetSize->setMetadata(LLVMContext::MD_tbaa, headerAccess);
+    ReturnInst::Create(llvmContext, block);
+}
+
+Value* Collections::loadHeader(Value* collection, unsigned member, const string& name, BasicBlock* block) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, member) };
+    Value* pointer = GetElementPtrInst::CreateInBounds(collection->getType()->getPointerElementType(), collection, indices, "", block);
+    LoadInst* load = new LoadInst(pointer, name, false, block);
+    load->setMetadata(LLVMContext::MD_tbaa, headerAccess);
+    if (!isList(collection->getType())) {
+        // the header of an Array never changes after allocation, so loads can be hoisted out of any loop
+        load->setMetadata(LLVMContext::MD_invariant_load, MDNode::get(llvmContext, None));
+    }
+    return load;
+}
+
+bool Collections::isCollection(Type* type) const {
+    return arrayTypes.count(type) > 0 || listTypes.count(type) > 0;
+}
+
+bool Collections::isList(Type* type) const {
+    return listTypes.count(type) > 0;
+}
+
+Type* Collections::getElementType(Type* collectionType) const {
+    return collectionType->getPointerElementType()->getStructElementType(DATA_MEMBER)->getPointerElementType();
+}
+
+/* New Array with size zeroed elements or empty List with room for size elements */
+Value* Collections::create(Type* collectionType, Value* size) {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* integerType = typeConverter.getIntegerType();
+    Type* bytePointerType = Type::getInt8PtrTy(context->getLLVMContext());
+    const string allocateName = isList(collectionType) ? "oolong_list_new" : "oolong_array_new";
+    Function* allocate = context->getRuntimeFunction(allocateName, bytePointerType, { integerType, integerType });
+    Value* arguments[] = { size, ConstantExpr::getSizeOf(getElementType(collectionType)) };
+    CallInst* collection = CallInst::Create(allocate, arguments, "", context->currentBlock());
+    return new BitCastInst(collection, collectionType, "", context->currentBlock());
+}
+
+Value* Collections::getSize(Value* collection) {
+    return loadHeader(collection, SIZE_MEMBER, "size", context->currentBlock());
+}
+
+/* Pointer to an element after a bounds check. The check is a single comparison with the size,
+   which the optimizer removes in loops counting up to the size and hoists out of other counted loops. */
+Value* Collections::getElementPointer(Value* collection, Value* index) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    BasicBlock* block = context->currentBlock();
+    Function* function = block->getParent();
+
+    Value* data = loadHeader(collection, DATA_MEMBER, "data", block);
+    Value* size = loadHeader(collection, SIZE_MEMBER, "size", block);
+    // unsigned, so negative indices fail as well
+    Value* inBounds = new ICmpInst(*block, CmpInst::ICMP_ULT, index, size, "inBounds");
+    BasicBlock* outOfBoundsBlock = BasicBlock::Create(llvmContext, "outOfBounds", function);
+    BasicBlock* accessBlock = BasicBlock::Create(llvmContext, "access", function);
+    BranchInst* branch = BranchInst::Create(accessBlock, outOfBoundsBlock, inBounds, block);
+    branch->setMetadata(LLVMContext::MD_prof, MDBuilder(llvmContext).createBranchWeights(LIKELY_WEIGHT, UNLIKELY_WEIGHT));
+
+    Function* outOfBounds = context->getRuntimeFunction("oolong_index_out_of_bounds", Type::getVoidTy(llvmContext), { integerType, integerType });
+    outOfBounds->setDoesNotReturn();
+    outOfBounds->addFnAttr(Attribute::Cold);
+    Value* arguments[] = { index, size };
+    CallInst::Create(outOfBounds, arguments, "", outOfBoundsBlock)->setDoesNotReturn();
+    new UnreachableInst(llvmContext, outOfBoundsBlock);
+
+    context->replaceCurrentBlock(accessBlock);
+    return GetElementPtrInst::CreateInBounds(getElementType(collection->getType()), data, index, "element", accessBlock);
+}
+
+void Collections::setElementAccess(Instruction* instruction, Type* elementType) {
+    auto it = elementAccesses.find(elementType);
+    if (it != elementAccesses.end()) {
+        instruction->setMetadata(LLVMContext::MD_tbaa, it->second);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef COLLECTIONS_H
+#define COLLECTIONS_H
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Instruction;
+    class MDNode;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Array<T> and List<T> of the primitive types. The runtime (package/collections.c) allocates a header
+// followed by contiguous elements, everything else is generated inline so the optimizer sees plain
+// loads and stores: element access is a bounds check and a GEP, length/size/add are small internal
+// functions that get inlined.
+class Collections {
+private:
+    CodeGenerationContext* context;
+    std::set<llvm::Type*> arrayTypes;
+    std::set<llvm::Type*> listTypes;
+    // type based alias analysis: element accesses never alias the header of a collection
+    llvm::MDNode* headerAccess = nullptr;
+    std::map<llvm::Type*, llvm::MDNode*> elementAccesses;
+
+    void declareCollection(const std::string& elementTypeName);
+    llvm::Value* loadHeader(llvm::Value* collection, unsigned member, const std::string& name, llvm::BasicBlock* block);
+
+public:
+    Collections(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    bool isCollection(llvm::Type* type) const;
+    bool isList(llvm::Type* type) const;
+    llvm::Type* getElementType(llvm::Type* collectionType) const;
+    llvm::Value* create(llvm::Type* collectionType, llvm::Value* size);
+    llvm::Value* getSize(llvm::Value* collection);
+    llvm::Value* getElementPointer(llvm::Value* collection, llvm::Value* index);
+    void setElementAccess(llvm::Instruction* instruction, llvm::Type* elementType);
+};
+
+#endif
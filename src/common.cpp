@@ -17,11 +17,15 @@
 
 #include "common.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include <string>
 #include <iostream>
 
 using namespace std;
 using namespace llvm;
+using namespace llvm::object;
 
 extern const char* currentParseFile;
 
@@ -36,6 +40,29 @@ void replaceAll(string& value, const string& substring, const string& replacemen
     }
 }
 
+// machine code size of each function symbol in an object file
+map<string, uint64_t> getFunctionSizes(StringRef object) {
+    map<string, uint64_t> sizes;
+    Expected<unique_ptr<ObjectFile>> objectFile = ObjectFile::createObjectFile(MemoryBufferRef(object, ""));
+    if (!objectFile) {
+        consumeError(objectFile.takeError());
+        return sizes;
+    }
+    for (const pair<SymbolRef, uint64_t>& symbolSize : computeSymbolSizes(**objectFile)) {
+        Expected<SymbolRef::Type> type = symbolSize.first.getType();
+        Expected<StringRef> name = symbolSize.first.getName();
+        if (!type || !name) {
+            consumeError(type.takeError());
+            consumeError(name.takeError());
+            continue;
+        }
+        if (*type == SymbolRef::ST_Function) {
+            sizes[name->str()] = symbolSize.second;
+        }
+    }
+    return sizes;
+}
+
 static string getFunctionContext(CodeGenerationContext& context) {
     string functionContext = "";
     if (context.currentFunction() != nullptr) {
@@ -2,10 +2,14 @@
 #define COMMON_H
 
 #include "code-generation.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Value.h"
+#include <cstdint>
+#include <map>
 #include <string>
 
 void replaceAll(std::string& str, const std::string& substring, const std::string& replacement);
+std::map<std::string, uint64_t> getFunctionSizes(llvm::StringRef object);
 
 llvm::Value* warning(CodeGenerationContext& context, const std::string& warningMessage);
 llvm::Value* error(CodeGenerationContext& context, const std::string& errorMessage);
@@ -0,0 +1,508 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "constant-evaluation.h"
+#include "code-generation.h"
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+using namespace std;
+using namespace llvm;
+
+// instructions a single call may execute, including the calls it makes
+static const uint64_t STEP_BUDGET = 10000000;
+static const unsigned MAXIMUM_DEPTH = 1000;
+
+struct ConstantEvaluation::Frame {
+    unordered_map<Value*, uint64_t> values;
+    unordered_map<Value*, uint64_t> variables; // by alloca, missing until the first store
+    BasicBlock* block = nullptr;
+    BasicBlock* previous = nullptr; // chooses the incoming values of PHI nodes
+    bool returned = false;
+    uint64_t result = 0;
+};
+
+/* Values are kept as the 64 bits of a double or the zero extended bits of an integer */
+static uint64_t truncate(uint64_t bits, unsigned width) {
+    return width >= 64 ? bits : bits & ((uint64_t(1) << width) - 1);
+}
+
+static int64_t toSigned(uint64_t bits, unsigned width) {
+    return width >= 64 ? (int64_t) bits : (int64_t) (bits << (64 - width)) >> (64 - width);
+}
+
+static double toDouble(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint64_t fromDouble(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static unsigned getWidth(Type* type) {
+    return type->isIntegerTy() ? type->getIntegerBitWidth() : 64;
+}
+
+static bool compareIntegers(CmpInst::Predicate predicate, uint64_t left, uint64_t right, unsigned width) {
+    int64_t signedLeft = toSigned(left, width);
+    int64_t signedRight = toSigned(right, width);
+    switch (predicate) {
+        case CmpInst::ICMP_EQ: return left == right;
+        case CmpInst::ICMP_NE: return left != right;
+        case CmpInst::ICMP_UGT: return left > right;
+        case CmpInst::ICMP_UGE: return left >= right;
+        case CmpInst::ICMP_ULT: return left < right;
+        case CmpInst::ICMP_ULE: return left <= right;
+        case CmpInst::ICMP_SGT: return signedLeft > signedRight;
+        case CmpInst::ICMP_SGE: return signedLeft >= signedRight;
+        case CmpInst::ICMP_SLT: return signedLeft < signedRight;
+        default: return signedLeft <= signedRight;
+    }
+}
+
+static bool compareDoubles(CmpInst::Predicate predicate, double left, double right) {
+    bool unordered = std::isnan(left) || std::isnan(right);
+    switch (predicate) {
+        case CmpInst::FCMP_FALSE: return false;
+        case CmpInst::FCMP_OEQ: return !unordered && left == right;
+        case CmpInst::FCMP_OGT: return !unordered && left > right;
+        case CmpInst::FCMP_OGE: return !unordered && left >= right;
+        case CmpInst::FCMP_OLT: return !unordered && left < right;
+        case CmpInst::FCMP_OLE: return !unordered && left <= right;
+        case CmpInst::FCMP_ONE: return !unordered && left != right;
+        case CmpInst::FCMP_ORD: return !unordered;
+        case CmpInst::FCMP_UNO: return unordered;
+        case CmpInst::FCMP_UEQ: return unordered || left == right;
+        case CmpInst::FCMP_UGT: return unordered || left > right;
+        case CmpInst::FCMP_UGE: return unordered || left >= right;
+        case CmpInst::FCMP_ULT: return unordered || left < right;
+        case CmpInst::FCMP_ULE: return unordered || left <= right;
+        case CmpInst::FCMP_UNE: return unordered || left != right;
+        default: return true;
+    }
+}
+
+static bool calculateInteger(Instruction::BinaryOps opcode, uint64_t left, uint64_t right, unsigned width, uint64_t& result, string& problem) {
+    int64_t signedLeft = toSigned(left, width);
+    int64_t signedRight = toSigned(right, width);
+    bool division = opcode == Instruction::SDiv || opcode == Instruction::UDiv || opcode == Instruction::SRem || opcode == Instruction::URem;
+    if (division && right == 0) {
+        problem = "it divides by zero";
+        return false;
+    }
+    if ((opcode == Instruction::SDiv || opcode == Instruction::SRem) && signedRight == -1 && left == (uint64_t(1) << (width - 1))) {
+        problem = "its division overflows";
+        return false;
+    }
+    if ((opcode == Instruction::Shl || opcode == Instruction::LShr || opcode == Instruction::AShr) && right >= width) {
+        problem = "it shifts by " + to_string(right) + " bits";
+        return false;
+    }
+    switch (opcode) {
+        case Instruction::Add: result = left + right; break;
+        case Instruction::Sub: result = left - right; break;
+        case Instruction::Mul: result = left * right; break;
+        case Instruction::SDiv: result = (uint64_t) (signedLeft / signedRight); break;
+        case Instruction::UDiv: result = left / right; break;
+        case Instruction::SRem: result = (uint64_t) (signedLeft % signedRight); break;
+        case Instruction::URem: result = left % right; break;
+        case Instruction::Shl: result = left << right; break;
+        case Instruction::LShr: result = left >> right; break;
+        case Instruction::AShr: result = (uint64_t) (signedLeft >> right); break;
+        case Instruction::And: result = left & right; break;
+        case Instruction::Or: result = left | right; break;
+        default: result = left ^ right; break;
+    }
+    result = truncate(result, width);
+    return true;
+}
+
+static double calculateDouble(Instruction::BinaryOps opcode, double left, double right) {
+    switch (opcode) {
+        case Instruction::FAdd: return left + right;
+        case Instruction::FSub: return left - right;
+        case Instruction::FMul: return left * right;
+        case Instruction::FDiv: return left / right;
+        default: return fmod(left, right);
+    }
+}
+
+static bool convert(CastInst* conversion, uint64_t value, uint64_t& result, string& problem) {
+    unsigned sourceWidth = getWidth(conversion->getSrcTy());
+    unsigned width = getWidth(conversion->getDestTy());
+    switch (conversion->getOpcode()) {
+        case Instruction::Trunc:
+        case Instruction::ZExt:
+            result = truncate(value, width);
+            return true;
+        case Instruction::SExt:
+            result = truncate((uint64_t) toSigned(value, sourceWidth), width);
+            return true;
+        case Instruction::SIToFP:
+            result = fromDouble((double) toSigned(value, sourceWidth));
+            return true;
+        case Instruction::UIToFP:
+            result = fromDouble((double) value);
+            return true;
+        case Instruction::FPToSI: {
+            double limit = ldexp(1.0, width - 1);
+            double number = toDouble(value);
+            if (!(number >= -limit && number < limit)) {
+                problem = "it converts " + to_string(number) + " to an integer of " + to_string(width) + " bits";
+                return false;
+            }
+            result = truncate((uint64_t) (int64_t) number, width);
+            return true;
+        }
+        case Instruction::FPToUI: {
+            double number = toDouble(value);
+            if (!(number > -1.0 && number < ldexp(1.0, width))) {
+                problem = "it converts " + to_string(number) + " to an unsigned integer of " + to_string(width) + " bits";
+                return false;
+            }
+            result = truncate((uint64_t) number, width);
+            return true;
+        }
+        default:
+            // BitCast between Integer and Double keeps the bits
+            result = value;
+            return true;
+    }
+}
+
+static uint64_t getBits(Value* value, unordered_map<Value*, uint64_t>& values) {
+    if (ConstantInt* integer = dyn_cast<ConstantInt>(value)) {
+        return integer->getZExtValue();
+    }
+    if (ConstantFP* number = dyn_cast<ConstantFP>(value)) {
+        return number->getValueAPF().bitcastToAPInt().getZExtValue();
+    }
+    if (isa<UndefValue>(value)) {
+        return 0;
+    }
+    return values[value];
+}
+
+bool ConstantEvaluation::isSupportedType(Type* type) const {
+    return (type->isIntegerTy() && type->getIntegerBitWidth() <= 64) || type->isDoubleTy();
+}
+
+void ConstantEvaluation::declare(Function* function) {
+    constFunctions.insert(function);
+}
+
+bool ConstantEvaluation::isConstFunction(Function* function) const {
+    return constFunctions.find(function) != constFunctions.end();
+}
+
+/* The generated body may only use what the interpreter supports, problem describes the first thing it doesn't */
+bool ConstantEvaluation::check(Function* function, string& problem) {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    auto isPrimitive = [&typeConverter](Type* type) {
+        return type == typeConverter.getBooleanType() || type == typeConverter.getIntegerType() || type == typeConverter.getDoubleType();
+    };
+    for (Argument& argument : function->args()) {
+        if (!isPrimitive(argument.getType())) {
+            problem = "takes " + argument.getName().str() + " of type " + typeConverter.getTypeName(argument.getType()) + ", only Boolean, Integer and Double arguments are supported";
+            return false;
+        }
+    }
+    if (!isPrimitive(function->getReturnType())) {
+        problem = "returns " + typeConverter.getTypeName(function->getReturnType()) + ", only Boolean, Integer and Double results are supported";
+        return false;
+    }
+    for (BasicBlock& block : *function) {
+        for (Instruction& instruction : block) {
+            if (isa<DbgInfoIntrinsic>(instruction)) {
+                continue;
+            }
+            unsigned operandCount = instruction.getNumOperands();
+            if (AllocaInst* alloca = dyn_cast<AllocaInst>(&instruction)) {
+                if (!isSupportedType(alloca->getAllocatedType()) || alloca->isArrayAllocation()) {
+                    problem = "has a variable of type " + typeConverter.getTypeName(alloca->getAllocatedType()) + ", only Boolean, Integer and Double variables are supported";
+                    return false;
+                }
+                continue;
+            }
+            else if (LoadInst* load = dyn_cast<LoadInst>(&instruction)) {
+                if (!isa<AllocaInst>(load->getPointerOperand()) || load->isVolatile() || load->isAtomic()) {
+                    problem = "reads memory other than its variables";
+                    return false;
+                }
+                operandCount = 0;
+            }
+            else if (StoreInst* store = dyn_cast<StoreInst>(&instruction)) {
+                if (!isa<AllocaInst>(store->getPointerOperand()) || store->isVolatile() || store->isAtomic()) {
+                    problem = "writes memory other than its variables";
+                    return false;
+                }
+                operandCount = 1; // the value
+            }
+            else if (CallInst* call = dyn_cast<CallInst>(&instruction)) {
+                Function* callee = call->getCalledFunction();
+                if (callee == nullptr || !isConstFunction(callee)) {
+                    string calleeName = callee == nullptr ? "a function pointer" : callee->getName().str();
+                    problem = "calls " + calleeName + ", only calls of const functions are supported";
+                    return false;
+                }
+                operandCount = call->getNumOperands() - 1; // the arguments, the callee is the last operand
+            }
+            else if (isa<CastInst>(instruction)) {
+                switch (instruction.getOpcode()) {
+                    case Instruction::Trunc: case Instruction::ZExt: case Instruction::SExt:
+                    case Instruction::SIToFP: case Instruction::UIToFP: case Instruction::FPToSI: case Instruction::FPToUI:
+                    case Instruction::BitCast:
+                        break;
+                    default:
+                        problem = "converts between types other than Boolean, Integer and Double";
+                        return false;
+                }
+            }
+            else if (isa<BranchInst>(instruction) || isa<UnreachableInst>(instruction)) {
+                operandCount = isa<BranchInst>(instruction) && cast<BranchInst>(instruction).isConditional() ? 1 : 0;
+            }
+            else if (!isa<BinaryOperator>(instruction) && !isa<CmpInst>(instruction) && !isa<SelectInst>(instruction)
+                    && !isa<PHINode>(instruction) && !isa<ReturnInst>(instruction)) {
+                problem = "uses a " + string(instruction.getOpcodeName()) + " instruction, only computations with Boolean, Integer and Double values are supported";
+                return false;
+            }
+            if (!instruction.getType()->isVoidTy() && !isSupportedType(instruction.getType())) {
+                problem = "computes a " + typeConverter.getTypeName(instruction.getType()) + ", only Boolean, Integer and Double values are supported";
+                return false;
+            }
+            for (unsigned i=0; i<operandCount; i++) {
+                Value* operand = instruction.getOperand(i);
+                bool supportedConstant = isa<ConstantInt>(operand) || isa<ConstantFP>(operand) || isa<UndefValue>(operand);
+                if (!isSupportedType(operand->getType()) || (isa<Constant>(operand) && !supportedConstant)) {
+                    problem = "uses a " + typeConverter.getTypeName(operand->getType()) + ", only Boolean, Integer and Double values are supported";
+                    return false;
+                }
+            }
+        }
+    }
+    checkedFunctions.insert(function);
+    return true;
+}
+
+/* Runs one instruction, terminators choose the next block of the frame or return from it */
+bool ConstantEvaluation::execute(Instruction& instruction, Frame& frame, unsigned depth, string& problem) {
+    unsigned width = getWidth(instruction.getType());
+    uint64_t result = 0;
+    if (isa<AllocaInst>(instruction)) {
+        // allocas in loops start a new variable every iteration
+        frame.variables.erase(&instruction);
+        return true;
+    }
+    else if (LoadInst* load = dyn_cast<LoadInst>(&instruction)) {
+        auto variable = frame.variables.find(load->getPointerOperand());
+        if (variable == frame.variables.end()) {
+            problem = "it reads a variable before assigning it";
+            return false;
+        }
+        result = variable->second;
+    }
+    else if (StoreInst* store = dyn_cast<StoreInst>(&instruction)) {
+        frame.variables[store->getPointerOperand()] = getBits(store->getValueOperand(), frame.values);
+        return true;
+    }
+    else if (BinaryOperator* binary = dyn_cast<BinaryOperator>(&instruction)) {
+        uint64_t left = getBits(binary->getOperand(0), frame.values);
+        uint64_t right = getBits(binary->getOperand(1), frame.values);
+        if (instruction.getType()->isDoubleTy()) {
+            result = fromDouble(calculateDouble(binary->getOpcode(), toDouble(left), toDouble(right)));
+        }
+        else if (!calculateInteger(binary->getOpcode(), left, right, width, result, problem)) {
+            return false;
+        }
+    }
+    else if (CmpInst* comparison = dyn_cast<CmpInst>(&instruction)) {
+        uint64_t left = getBits(comparison->getOperand(0), frame.values);
+        uint64_t right = getBits(comparison->getOperand(1), frame.values);
+        if (isa<FCmpInst>(comparison)) {
+            result = compareDoubles(comparison->getPredicate(), toDouble(left), toDouble(right));
+        }
+        else {
+            result = compareIntegers(comparison->getPredicate(), left, right, getWidth(comparison->getOperand(0)->getType()));
+        }
+    }
+    else if (CastInst* conversion = dyn_cast<CastInst>(&instruction)) {
+        if (!convert(conversion, getBits(conversion->getOperand(0), frame.values), result, problem)) {
+            return false;
+        }
+    }
+    else if (SelectInst* select = dyn_cast<SelectInst>(&instruction)) {
+        result = getBits(getBits(select->getCondition(), frame.values) ? select->getTrueValue() : select->getFalseValue(), frame.values);
+    }
+    else if (CallInst* call = dyn_cast<CallInst>(&instruction)) {
+        if (isa<DbgInfoIntrinsic>(call)) {
+            return true;
+        }
+        vector<uint64_t> arguments;
+        for (unsigned i=0; i<call->getNumOperands() - 1; i++) {
+            arguments.push_back(getBits(call->getArgOperand(i), frame.values));
+        }
+        if (!this->call(call->getCalledFunction(), arguments, depth + 1, result, problem)) {
+            return false;
+        }
+    }
+    else if (BranchInst* branch = dyn_cast<BranchInst>(&instruction)) {
+        frame.previous = frame.block;
+        frame.block = branch->isConditional() && !getBits(branch->getCondition(), frame.values) ? branch->getSuccessor(1) : branch->getSuccessor(0);
+        return true;
+    }
+    else if (ReturnInst* ret = dyn_cast<ReturnInst>(&instruction)) {
+        frame.result = getBits(ret->getReturnValue(), frame.values);
+        frame.returned = true;
+        return true;
+    }
+    else {
+        problem = "it reaches unreachable code";
+        return false;
+    }
+    frame.values[&instruction] = result;
+    return true;
+}
+
+/* Interprets a checked function, results of earlier calls with the same arguments are reused */
+bool ConstantEvaluation::call(Function* function, const vector<uint64_t>& arguments, unsigned depth, uint64_t& result, string& problem) {
+    auto key = make_pair(function, arguments);
+    auto cached = results.find(key);
+    if (cached != results.end()) {
+        result = cached->second;
+        return true;
+    }
+    if (depth > MAXIMUM_DEPTH) {
+        problem = "it recurses deeper than " + to_string(MAXIMUM_DEPTH) + " calls";
+        return false;
+    }
+    Frame frame;
+    auto argumentIterator = arguments.begin();
+    for (Argument& argument : function->args()) {
+        frame.values[&argument] = *argumentIterator++;
+    }
+    frame.block = &function->getEntryBlock();
+    while (!frame.returned) {
+        BasicBlock* block = frame.block;
+        // the PHI nodes at the start of a block take the values of the edge all at once
+        vector<pair<PHINode*, uint64_t>> incoming;
+        for (Instruction& instruction : *block) {
+            PHINode* phi = dyn_cast<PHINode>(&instruction);
+            if (phi == nullptr) {
+                break;
+            }
+            incoming.push_back(make_pair(phi, getBits(phi->getIncomingValueForBlock(frame.previous), frame.values)));
+        }
+        for (auto& phiValue : incoming) {
+            frame.values[phiValue.first] = phiValue.second;
+        }
+        bool terminated = false;
+        for (Instruction& instruction : *block) {
+            if (isa<PHINode>(instruction)) {
+                continue;
+            }
+            if (stepsLeft == 0) {
+                problem = "it takes more than " + to_string(STEP_BUDGET) + " steps";
+                return false;
+            }
+            stepsLeft--;
+            if (!execute(instruction, frame, depth, problem)) {
+                return false;
+            }
+            // the frontend might leave code behind a return
+            if (instruction.isTerminator()) {
+                terminated = true;
+                break;
+            }
+        }
+        if (!terminated) {
+            problem = "it reaches the end of a block without returning a value";
+            return false;
+        }
+    }
+    results[key] = frame.result;
+    result = frame.result;
+    return true;
+}
+
+/* Arguments are literals or computed from literals, like the conversion of an Integer literal to a Double argument */
+bool ConstantEvaluation::evaluateArgument(Value* value, uint64_t& bits) {
+    if (isa<ConstantInt>(value) || isa<ConstantFP>(value)) {
+        Frame frame;
+        bits = getBits(value, frame.values);
+        return true;
+    }
+    Instruction* instruction = dyn_cast<Instruction>(value);
+    if (instruction == nullptr || !isSupportedType(instruction->getType())
+            || !(isa<BinaryOperator>(instruction) || isa<CmpInst>(instruction) || isa<CastInst>(instruction) || isa<SelectInst>(instruction))) {
+        return false;
+    }
+    Frame frame;
+    for (Value* operand : instruction->operands()) {
+        uint64_t operandBits;
+        if (!isSupportedType(operand->getType()) || !evaluateArgument(operand, operandBits)) {
+            return false;
+        }
+        frame.values[operand] = operandBits;
+    }
+    // like a division by zero, which happens at run time then
+    string problem;
+    if (!execute(*instruction, frame, 0, problem)) {
+        return false;
+    }
+    bits = frame.values[instruction];
+    return true;
+}
+
+Constant* ConstantEvaluation::toConstant(uint64_t bits, Type* type) {
+    if (type->isDoubleTy()) {
+        return ConstantFP::get(type, toDouble(bits));
+    }
+    return ConstantInt::get(type, bits);
+}
+
+/* The result of calling the function with the arguments, nullptr if they aren't constant, the function isn't
+   complete yet (a recursive call in its own body) or the evaluation failed, which problem describes */
+Constant* ConstantEvaluation::fold(Function* function, const vector<Value*>& arguments, string& problem) {
+    if (checkedFunctions.find(function) == checkedFunctions.end()) {
+        return nullptr;
+    }
+    vector<uint64_t> argumentBits;
+    for (Value* argument : arguments) {
+        uint64_t bits;
+        if (!evaluateArgument(argument, bits)) {
+            return nullptr;
+        }
+        argumentBits.push_back(bits);
+    }
+    stepsLeft = STEP_BUDGET;
+    uint64_t result;
+    if (!call(function, argumentBits, 0, result, problem)) {
+        return nullptr;
+    }
+    return toConstant(result, function->getReturnType());
+}
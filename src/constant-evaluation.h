@@ -0,0 +1,51 @@
+#ifndef CONSTANT_EVALUATION_H
+#define CONSTANT_EVALUATION_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+    class Constant;
+    class Function;
+    class Instruction;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// const functions: calls with constant arguments are evaluated while the caller is generated and replaced
+// by the result. The body of a const function may only compute with Boolean, Integer and Double values and
+// call const functions, so an interpreter of that subset of the IR can run it. Every evaluation has a budget
+// of steps, calls that exceed it or fail (e.g. divide by zero) stay calls and behave the same at run time.
+// Since const functions have no side effects, results of calls are kept and reused by later evaluations.
+class ConstantEvaluation {
+private:
+    struct Frame;
+
+    CodeGenerationContext* context;
+    std::set<llvm::Function*> constFunctions;
+    std::set<llvm::Function*> checkedFunctions; // complete and only using what the interpreter supports
+    std::map<std::pair<llvm::Function*, std::vector<uint64_t>>, uint64_t> results;
+    uint64_t stepsLeft = 0;
+
+    bool isSupportedType(llvm::Type* type) const;
+    bool call(llvm::Function* function, const std::vector<uint64_t>& arguments, unsigned depth, uint64_t& result, std::string& problem);
+    bool execute(llvm::Instruction& instruction, Frame& frame, unsigned depth, std::string& problem);
+    bool evaluateArgument(llvm::Value* value, uint64_t& bits);
+    llvm::Constant* toConstant(uint64_t bits, llvm::Type* type);
+
+public:
+    ConstantEvaluation(CodeGenerationContext* context) : context(context) {}
+
+    void declare(llvm::Function* function);
+    bool isConstFunction(llvm::Function* function) const;
+    bool check(llvm::Function* function, std::string& problem);
+    llvm::Constant* fold(llvm::Function* function, const std::vector<llvm::Value*>& arguments, std::string& problem);
+};
+
+#endif
@@ -0,0 +1,334 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "coroutines.h"
+#include "code-generation.h"
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+static const unsigned PROMISE_ALIGNMENT = 8;
+static const unsigned HANDLE_MEMBER = 1; // of the async frame, after the Future
+
+void Coroutines::declare() {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    for (const string valueTypeName : { "Boolean", "Integer", "Double", "String" }) {
+        // the coroutine handle, the frame layout is only known after the coroutine passes ran
+        Type* generatorType = typeConverter.createOpaqueType("Generator<" + valueTypeName + ">")->getPointerTo();
+        valueTypes[generatorType] = typeConverter.getType(valueTypeName);
+    }
+}
+
+bool Coroutines::isGenerator(Type* type) const {
+    return valueTypes.count(type) > 0;
+}
+
+/* Generator<T> for value type T, nullptr if there is none */
+Type* Coroutines::getGeneratorType(Type* valueType) const {
+    for (auto& generatorType : valueTypes) {
+        if (generatorType.second == valueType) {
+            return generatorType.first;
+        }
+    }
+    return nullptr;
+}
+
+Type* Coroutines::getValueType(Type* generatorType) const {
+    auto valueType = valueTypes.find(generatorType);
+    return valueType != valueTypes.end() ? valueType->second : nullptr;
+}
+
+bool Coroutines::isGeneratorFunction(Function* function) const {
+    auto coroutine = coroutines.find(function);
+    return coroutine != coroutines.end() && coroutine->second.promise != nullptr;
+}
+
+bool Coroutines::isAsyncFunction(Function* function) const {
+    auto coroutine = coroutines.find(function);
+    return coroutine != coroutines.end() && coroutine->second.future != nullptr;
+}
+
+bool Coroutines::hasCoroutines() const {
+    return !coroutines.empty();
+}
+
+Value* Coroutines::callIntrinsic(unsigned intrinsic, const vector<Value*>& arguments, BasicBlock* block, const vector<Type*>& types) {
+    Function* declaration = Intrinsic::getDeclaration(context->getModule(), (Intrinsic::ID) intrinsic, types);
+    return CallInst::Create(declaration, arguments, "", block);
+}
+
+/* Allocates the frame of the coroutine and continues after coro.begin. The final, cleanup and suspend blocks
+   are added to the function by finish. */
+Coroutines::Coroutine& Coroutines::begin(Function* function, Value* promise) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    Type* int64Type = Type::getInt64Ty(llvmContext);
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Constant* null = ConstantPointerNull::get(bytePointerType);
+    BasicBlock* block = context->currentBlock();
+    Coroutine& coroutine = coroutines[function];
+    // set by CoroEarly as well, newer LLVM versions expect it from the front end
+    function->addFnAttr("coroutine.presplit", "0");
+
+    Value* promiseArgument = null;
+    if (promise != nullptr) {
+        promiseArgument = new BitCastInst(promise, bytePointerType, "", block);
+    }
+    coroutine.id = callIntrinsic(Intrinsic::coro_id, { ConstantInt::get(int32Type, 0), promiseArgument, null, null }, block);
+
+    // frames that don't outlive the caller are put on its stack by CoroElide, coro.alloc is false then
+    BasicBlock* allocateBlock = BasicBlock::Create(llvmContext, "allocateFrame", function);
+    BasicBlock* beginBlock = BasicBlock::Create(llvmContext, "beginCoroutine", function);
+    Value* allocate = callIntrinsic(Intrinsic::coro_alloc, { coroutine.id }, block);
+    BranchInst::Create(allocateBlock, beginBlock, allocate, block);
+    Value* size = callIntrinsic(Intrinsic::coro_size, {}, allocateBlock, { int64Type });
+    Function* malloc = context->getRuntimeFunction("malloc", bytePointerType, { int64Type });
+    Value* allocation = CallInst::Create(malloc, { size }, "", allocateBlock);
+    BranchInst::Create(beginBlock, allocateBlock);
+    PHINode* memory = PHINode::Create(bytePointerType, 2, "memory", beginBlock);
+    memory->addIncoming(null, block);
+    memory->addIncoming(allocation, allocateBlock);
+    coroutine.handle = callIntrinsic(Intrinsic::coro_begin, { coroutine.id, memory }, beginBlock);
+
+    coroutine.finalBlock = BasicBlock::Create(llvmContext, "finalSuspend");
+    coroutine.cleanupBlock = BasicBlock::Create(llvmContext, "cleanup");
+    coroutine.suspendBlock = BasicBlock::Create(llvmContext, "suspend");
+    Value* frame = callIntrinsic(Intrinsic::coro_free, { coroutine.id, coroutine.handle }, coroutine.cleanupBlock);
+    Function* free = context->getRuntimeFunction("free", Type::getVoidTy(llvmContext), { bytePointerType });
+    CallInst::Create(free, { frame }, "", coroutine.cleanupBlock);
+    BranchInst::Create(coroutine.suspendBlock, coroutine.cleanupBlock);
+    callIntrinsic(Intrinsic::coro_end, { coroutine.handle, ConstantInt::getFalse(llvmContext) }, coroutine.suspendBlock);
+
+    context->replaceCurrentBlock(beginBlock);
+    return coroutine;
+}
+
+/* Suspends at the end of block: a resume continues in resumeBlock, a destroy frees the frame and the caller (or
+   resumer) continues in suspendedBlock */
+void Coroutines::suspend(Coroutine& coroutine, BasicBlock* block, BasicBlock* resumeBlock, BasicBlock* suspendedBlock) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    IntegerType* int8Type = Type::getInt8Ty(llvmContext);
+    Value* suspended = callIntrinsic(Intrinsic::coro_suspend, { ConstantTokenNone::get(llvmContext), ConstantInt::getFalse(llvmContext) }, block);
+    SwitchInst* resumption = SwitchInst::Create(suspended, suspendedBlock, 2, block);
+    resumption->addCase(ConstantInt::get(int8Type, 0), resumeBlock);
+    resumption->addCase(ConstantInt::get(int8Type, 1), coroutine.cleanupBlock);
+}
+
+/* Start of a generator function, before its arguments are stored: they have to be copied into the frame */
+void Coroutines::beginGenerator(Function* function) {
+    Type* valueType = valueTypes[function->getReturnType()];
+    // yielded values are read through the handle, so the promise lives in the frame
+    AllocaInst* promise = new AllocaInst(valueType, 0, "promise", context->currentBlock());
+    promise->setAlignment(PROMISE_ALIGNMENT);
+    Coroutine& coroutine = begin(function, promise);
+    coroutine.promise = promise;
+}
+
+/* Start of an async function, before its arguments are stored. The Future is allocated by the ramp, its task
+   resumes the coroutine. */
+void Coroutines::beginAsync(Function* function) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Type* futureType = function->getReturnType();
+    StructType* frameType = StructType::get(llvmContext, { futureType->getPointerElementType(), bytePointerType });
+    Function* body = createAsyncBody(function, frameType);
+
+    Coroutine& coroutine = begin(function, nullptr);
+    BasicBlock* block = context->currentBlock();
+    Function* newFuture = context->getRuntimeFunction("oolong_future_new", bytePointerType, { body->getType(), typeConverter.getIntegerType() });
+    Value* newFutureArguments[] = { body, ConstantExpr::getSizeOf(frameType) };
+    Value* frame = CallInst::Create(newFuture, newFutureArguments, "", block);
+    Value* typedFrame = new BitCastInst(frame, frameType->getPointerTo(), "frame", block);
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, HANDLE_MEMBER) };
+    new StoreInst(coroutine.handle, GetElementPtrInst::CreateInBounds(frameType, typedFrame, indices, "", block), block);
+    coroutine.future = new BitCastInst(frame, futureType, "future", block);
+}
+
+/* Task of an async function's Future: resumes the coroutine until it is done */
+Function* Coroutines::createAsyncBody(Function* function, Type* frameType) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    Type* voidType = Type::getVoidTy(llvmContext);
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    FunctionType* bodyType = FunctionType::get(voidType, { bytePointerType }, false);
+    Function* body = Function::Create(bodyType, GlobalValue::InternalLinkage, function->getName() + ".async", context->getModule());
+    BasicBlock* block = BasicBlock::Create(llvmContext, "entry", body);
+    Value* frame = &*body->arg_begin();
+    Value* typedFrame = new BitCastInst(frame, frameType->getPointerTo(), "frame", block);
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, HANDLE_MEMBER) };
+    Value* handle = new LoadInst(GetElementPtrInst::CreateInBounds(frameType, typedFrame, indices, "", block), "handle", block);
+    callIntrinsic(Intrinsic::coro_resume, { handle }, block);
+    Value* done = callIntrinsic(Intrinsic::coro_done, { handle }, block);
+
+    BasicBlock* destroyBlock = BasicBlock::Create(llvmContext, "destroy", body);
+    BasicBlock* suspendedBlock = BasicBlock::Create(llvmContext, "suspended", body);
+    BranchInst::Create(destroyBlock, suspendedBlock, done, block);
+    // the result is stored in the Future already
+    callIntrinsic(Intrinsic::coro_destroy, { handle }, destroyBlock);
+    ReturnInst::Create(llvmContext, destroyBlock);
+    // waiting for another Future, the runtime resumes it later
+    Function* suspended = context->getRuntimeFunction("oolong_future_suspended", voidType, { bytePointerType });
+    CallInst::Create(suspended, { frame }, "", suspendedBlock);
+    ReturnInst::Create(llvmContext, suspendedBlock);
+    return body;
+}
+
+/* Returns the Generator<T> or Future<T> to the caller, the body only runs once resumed */
+void Coroutines::startBody(Function* function) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Coroutine& coroutine = coroutines[function];
+    BasicBlock* block = context->currentBlock();
+    BasicBlock* bodyBlock = BasicBlock::Create(llvmContext, "body", function);
+    if (coroutine.future != nullptr) {
+        ReturnInst::Create(llvmContext, coroutine.future, coroutine.suspendBlock);
+        // only started once suspended, a worker must not resume it while the ramp still runs
+        BasicBlock* startBlock = BasicBlock::Create(llvmContext, "start", function);
+        Function* startFuture = context->getRuntimeFunction("oolong_future_start", Type::getVoidTy(llvmContext), { Type::getInt8PtrTy(llvmContext) });
+        CallInst::Create(startFuture, { new BitCastInst(coroutine.future, Type::getInt8PtrTy(llvmContext), "", startBlock) }, "", startBlock);
+        BranchInst::Create(coroutine.suspendBlock, startBlock);
+        suspend(coroutine, block, bodyBlock, startBlock);
+    }
+    else {
+        Value* generator = new BitCastInst(coroutine.handle, function->getReturnType(), "generator", block);
+        ReturnInst::Create(llvmContext, generator, coroutine.suspendBlock);
+        suspend(coroutine, block, bodyBlock, coroutine.suspendBlock);
+    }
+    context->replaceCurrentBlock(bodyBlock);
+}
+
+/* End of the body: the coroutine suspends a last time and is destroyed by its caller (generators) or task */
+void Coroutines::finish(Function* function) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Coroutine& coroutine = coroutines[function];
+    if (!context->currentBlockReturns()) {
+        BranchInst::Create(coroutine.finalBlock, context->currentBlock());
+    }
+    function->getBasicBlockList().push_back(coroutine.finalBlock);
+    Value* suspended = callIntrinsic(Intrinsic::coro_suspend, { ConstantTokenNone::get(llvmContext), ConstantInt::getTrue(llvmContext) }, coroutine.finalBlock);
+    // resuming a coroutine after its final suspend is undefined, so there's no resume case
+    SwitchInst* resumption = SwitchInst::Create(suspended, coroutine.suspendBlock, 1, coroutine.finalBlock);
+    resumption->addCase(ConstantInt::get(Type::getInt8Ty(llvmContext), 1), coroutine.cleanupBlock);
+    function->getBasicBlockList().push_back(coroutine.cleanupBlock);
+    function->getBasicBlockList().push_back(coroutine.suspendBlock);
+}
+
+/* Stores the value in the promise of the current generator function and suspends, false if it can't be
+   converted to the value type */
+bool Coroutines::yield(Value* value) {
+    Function* function = context->currentFunction();
+    Coroutine& coroutine = coroutines[function];
+    AllocaInst* promise = cast<AllocaInst>(coroutine.promise);
+    Value* convertedValue = context->getTypeConverter().convertType(value, promise->getAllocatedType());
+    if (convertedValue == nullptr) {
+        return false;
+    }
+    new StoreInst(convertedValue, promise, context->currentBlock());
+    BasicBlock* resumeBlock = BasicBlock::Create(context->getLLVMContext(), "resume", function);
+    suspend(coroutine, context->currentBlock(), resumeBlock, coroutine.suspendBlock);
+    context->replaceCurrentBlock(resumeBlock);
+    return true;
+}
+
+/* Stores the result of the current async function in its Future and ends the body, false if it can't be
+   converted to the result type */
+bool Coroutines::returnValue(Value* value) {
+    Coroutine& coroutine = coroutines[context->currentFunction()];
+    BasicBlock* block = context->currentBlock();
+    Value* result = context->getFutures().getResultPointer(coroutine.future, block);
+    if (result == nullptr) {
+        return false;
+    }
+    Value* convertedValue = context->getTypeConverter().convertType(value, result->getType()->getPointerElementType());
+    if (convertedValue == nullptr) {
+        return false;
+    }
+    new StoreInst(convertedValue, result, block);
+    BranchInst::Create(coroutine.finalBlock, block);
+    return true;
+}
+
+/* Suspends the current async function until future is done, its task goes back to the thread pool meanwhile */
+void Coroutines::suspendUntilDone(Value* future) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Function* function = context->currentFunction();
+    Coroutine& coroutine = coroutines[function];
+    BasicBlock* checkBlock = BasicBlock::Create(llvmContext, "checkFuture", function);
+    BasicBlock* waitBlock = BasicBlock::Create(llvmContext, "waitForFuture", function);
+    BasicBlock* doneBlock = BasicBlock::Create(llvmContext, "futureDone", function);
+    BranchInst::Create(checkBlock, context->currentBlock());
+
+    Function* isDone = context->getRuntimeFunction("oolong_future_done", Type::getInt1Ty(llvmContext), { bytePointerType });
+    Value* frame = new BitCastInst(future, bytePointerType, "", checkBlock);
+    Value* done = CallInst::Create(isDone, { frame }, "done", checkBlock);
+    BranchInst::Create(doneBlock, waitBlock, done, checkBlock);
+    // the awaited Future resumes it once done
+    Function* awaiting = context->getRuntimeFunction("oolong_future_awaiting", Type::getVoidTy(llvmContext), { bytePointerType, bytePointerType });
+    Value* awaitingArguments[] = { new BitCastInst(coroutine.future, bytePointerType, "", waitBlock), frame };
+    CallInst::Create(awaiting, awaitingArguments, "", waitBlock);
+    suspend(coroutine, waitBlock, checkBlock, coroutine.suspendBlock);
+    context->replaceCurrentBlock(doneBlock);
+}
+
+Value* Coroutines::toHandle(Value* generator, BasicBlock* block) {
+    return new BitCastInst(generator, Type::getInt8PtrTy(context->getLLVMContext()), "handle", block);
+}
+
+/* Runs the generator to its next yield, returns whether it yielded a value (false once its body ended) */
+Value* Coroutines::next(Value* generator, Value*& value) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    BasicBlock* block = context->currentBlock();
+    Value* handle = toHandle(generator, block);
+    callIntrinsic(Intrinsic::coro_resume, { handle }, block);
+    Value* done = callIntrinsic(Intrinsic::coro_done, { handle }, block);
+    Value* promise = callIntrinsic(Intrinsic::coro_promise, { handle, ConstantInt::get(Type::getInt32Ty(llvmContext), PROMISE_ALIGNMENT), ConstantInt::getFalse(llvmContext) }, block);
+    Type* valueType = valueTypes[generator->getType()];
+    value = new LoadInst(new BitCastInst(promise, valueType->getPointerTo(), "", block), "value", block);
+    return BinaryOperator::CreateNot(done, "yielded", block);
+}
+
+/* Frees the generator's frame, it must not be resumed afterwards */
+void Coroutines::destroy(Value* generator) {
+    BasicBlock* block = context->currentBlock();
+    callIntrinsic(Intrinsic::coro_destroy, { toHandle(generator, block) }, block);
+}
+
+/* Generators consumed by a loop, a return from its body has to destroy them */
+void Coroutines::beginIteration(Value* generator) {
+    iteratedGenerators.push_back(generator);
+}
+
+void Coroutines::endIteration() {
+    iteratedGenerators.pop_back();
+}
+
+/* Before a return, destroys the generators of all loops it leaves */
+void Coroutines::destroyIterated() {
+    for (auto it = iteratedGenerators.rbegin(); it != iteratedGenerators.rend(); it++) {
+        destroy(*it);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef COROUTINES_H
+#define COROUTINES_H
+
+#include <map>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Generator and async functions, lowered to LLVM's switch-resumed coroutines (llvm.coro.*). The passes
+// of the optimizer split them into ramp, resume and destroy functions and put frames that don't escape
+// on the caller's stack.
+//
+// A generator function returns a Generator<T> (the coroutine handle) without running its body, every
+// resume runs it to the next yield, which leaves the value in the coroutine's promise. An async
+// function returns a Future<T> whose task resumes the coroutine on the thread pool (package/future.c),
+// await suspends it until the awaited Future is done instead of blocking the worker.
+class Coroutines {
+private:
+    struct Coroutine {
+        llvm::Value* id = nullptr;
+        llvm::Value* handle = nullptr;
+        llvm::Value* promise = nullptr; // generators: value of the last yield
+        llvm::Value* future = nullptr; // async functions: Future<T> receiving the result
+        llvm::BasicBlock* finalBlock = nullptr; // end of the body
+        llvm::BasicBlock* cleanupBlock = nullptr; // frees the frame when destroyed
+        llvm::BasicBlock* suspendBlock = nullptr; // back to the caller or resumer
+    };
+
+    CodeGenerationContext* context;
+    std::map<llvm::Type*, llvm::Type*> valueTypes; // Generator<T> to T
+    std::map<llvm::Function*, Coroutine> coroutines;
+    std::vector<llvm::Value*> iteratedGenerators; // by the loops around the current statement, innermost last
+
+    llvm::Value* callIntrinsic(unsigned intrinsic, const std::vector<llvm::Value*>& arguments, llvm::BasicBlock* block, const std::vector<llvm::Type*>& types = {});
+    Coroutine& begin(llvm::Function* function, llvm::Value* promise);
+    void suspend(Coroutine& coroutine, llvm::BasicBlock* block, llvm::BasicBlock* resumeBlock, llvm::BasicBlock* suspendedBlock);
+    llvm::Function* createAsyncBody(llvm::Function* function, llvm::Type* frameType);
+    llvm::Value* toHandle(llvm::Value* generator, llvm::BasicBlock* block);
+
+public:
+    Coroutines(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    bool isGenerator(llvm::Type* type) const;
+    llvm::Type* getGeneratorType(llvm::Type* valueType) const;
+    llvm::Type* getValueType(llvm::Type* generatorType) const;
+    bool isGeneratorFunction(llvm::Function* function) const;
+    bool isAsyncFunction(llvm::Function* function) const;
+    bool hasCoroutines() const;
+    void beginGenerator(llvm::Function* function);
+    void beginAsync(llvm::Function* function);
+    void startBody(llvm::Function* function);
+    void finish(llvm::Function* function);
+    bool yield(llvm::Value* value);
+    bool returnValue(llvm::Value* value);
+    void suspendUntilDone(llvm::Value* future);
+    llvm::Value* next(llvm::Value* generator, llvm::Value*& value);
+    void destroy(llvm::Value* generator);
+    void beginIteration(llvm::Value* generator);
+    void endIteration();
+    void destroyIterated();
+};
+
+#endif
@@ -0,0 +1,220 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "debug-information.h"
+#include "code-generation.h"
+#include <vector>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/DebugLoc.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+using namespace std;
+using namespace llvm;
+
+static const unsigned DWARF_VERSION = 4;
+
+void DebugInformation::initialize(const string& fileName, bool optimized) {
+    this->optimized = optimized;
+    Module* module = context->getModule();
+    builder = new DIBuilder(*module);
+
+    // split the path so debuggers can find the source relative to the compilation directory
+    SmallString<128> directory(sys::path::parent_path(fileName));
+    if (directory.empty() || sys::path::is_relative(directory)) {
+        SmallString<128> workingDirectory;
+        sys::fs::current_path(workingDirectory);
+        sys::path::append(workingDirectory, directory);
+        directory = workingDirectory;
+    }
+    file = builder->createFile(sys::path::filename(fileName), directory);
+    // there is no DWARF language code for Oolong, C is the closest match for tools
+    compileUnit = builder->createCompileUnit(dwarf::DW_LANG_C, file, "oolong", optimized, "", 0);
+
+    module->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+    module->addModuleFlag(Module::Warning, "Dwarf Version", DWARF_VERSION);
+}
+
+bool DebugInformation::isEnabled() const {
+    return builder != nullptr;
+}
+
+DIType* DebugInformation::getDebugType(Type* type) {
+    if (type == nullptr || type->isVoidTy()) {
+        return nullptr;
+    }
+    auto it = types.find(type);
+    if (it != types.end()) {
+        return it->second;
+    }
+
+    TypeConverter& typeConverter = context->getTypeConverter();
+    const DataLayout& dataLayout = context->getModule()->getDataLayout();
+    const string name = typeConverter.getTypeName(type);
+    DIType* debugType = nullptr;
+    if (type->isIntegerTy(1)) {
+        debugType = builder->createBasicType(name, 8, dwarf::DW_ATE_boolean);
+    }
+    else if (type->isIntegerTy(8)) {
+        debugType = builder->createBasicType(name, 8, dwarf::DW_ATE_signed_char);
+    }
+    else if (type->isIntegerTy()) {
+        debugType = builder->createBasicType(name, type->getIntegerBitWidth(), dwarf::DW_ATE_signed);
+    }
+    else if (type->isDoubleTy()) {
+        debugType = builder->createBasicType(name, 64, dwarf::DW_ATE_float);
+    }
+    else if (type->isPointerTy()) {
+        Type* elementType = type->getPointerElementType();
+        DIType* elementDebugType = nullptr;
+        if (elementType->isStructTy() && !cast<StructType>(elementType)->isOpaque()) {
+            // describe members so debuggers can show e.g. the contents of a String
+            StructType* structType = cast<StructType>(elementType);
+            const StructLayout* layout = dataLayout.getStructLayout(structType);
+            DICompositeType* structDebugType = builder->createStructType(file, name, file, 0, layout->getSizeInBits(), 0, DINode::FlagZero, nullptr, DINodeArray());
+            // register before visiting members in case of self-references
+            types[type] = builder->createPointerType(structDebugType, dataLayout.getPointerSizeInBits());
+            vector<Metadata*> members;
+            for (unsigned i=0; i<structType->getNumElements(); i++) {
+                Type* memberType = structType->getElementType(i);
+                members.push_back(builder->createMemberType(structDebugType, "member" + to_string(i), file, 0,
+                        dataLayout.getTypeSizeInBits(memberType), 0, layout->getElementOffsetInBits(i),
+                        DINode::FlagZero, getDebugType(memberType)));
+            }
+            builder->replaceArrays(structDebugType, builder->getOrCreateArray(members));
+            return types[type];
+        }
+        else if (elementType->isSized()) {
+            elementDebugType = getDebugType(elementType);
+        }
+        debugType = builder->createPointerType(elementDebugType, dataLayout.getPointerSizeInBits());
+    }
+    else {
+        // not prepared for this, let the debugger treat it as unknown
+        debugType = builder->createUnspecifiedType(name);
+    }
+    types[type] = debugType;
+    return debugType;
+}
+
+void DebugInformation::declareFunction(Function* function, int lineNumber) {
+    if (!isEnabled()) {
+        return;
+    }
+    vector<Metadata*> signature;
+    signature.push_back(getDebugType(function->getReturnType()));
+    for (Argument& argument : function->args()) {
+        signature.push_back(getDebugType(argument.getType()));
+    }
+    DISubroutineType* functionType = builder->createSubroutineType(builder->getOrCreateTypeArray(signature));
+    DISubprogram* subprogram = builder->createFunction(file, function->getName(), function->getName(), file, lineNumber,
+            functionType, function->hasInternalLinkage(), true /* definition */, lineNumber, DINode::FlagPrototyped, optimized);
+    function->setSubprogram(subprogram);
+}
+
+void DebugInformation::declareVariable(AllocaInst* variable, const string& name, int lineNumber, unsigned argumentNumber) {
+    if (!isEnabled()) {
+        return;
+    }
+    BasicBlock* block = variable->getParent();
+    DISubprogram* subprogram = block->getParent()->getSubprogram();
+    if (subprogram == nullptr) {
+        return;
+    }
+    DIType* type = getDebugType(variable->getAllocatedType());
+    DILocalVariable* variableInformation = nullptr;
+    if (argumentNumber > 0) {
+        variableInformation = builder->createParameterVariable(subprogram, name, argumentNumber, file, lineNumber, type, true);
+    }
+    else {
+        // keep variables around at higher optimization levels, perf annotate and debuggers still want them
+        variableInformation = builder->createAutoVariable(subprogram, name, file, lineNumber, type, true);
+    }
+    builder->insertDeclare(variable, variableInformation, builder->createExpression(), DebugLoc::get(lineNumber, 0, subprogram), block);
+}
+
+// Attach the given line to all instructions of the function that do not have a location yet.
+void DebugInformation::setLocation(Function* function, int lineNumber) {
+    if (!isEnabled() || function == nullptr) {
+        return;
+    }
+    DISubprogram* subprogram = function->getSubprogram();
+    if (subprogram == nullptr) {
+        return;
+    }
+    DebugLoc location = DebugLoc::get(lineNumber, 0, subprogram);
+    for (BasicBlock& block : *function) {
+        for (Instruction& instruction : block) {
+            if (!instruction.getDebugLoc()) {
+                instruction.setDebugLoc(location);
+            }
+        }
+    }
+}
+
+// Statements append to the current block and to blocks added at the end of the function, so the
+// instructions a statement generated follow the mark, without walking the rest of the function.
+DebugInformation::StatementMark DebugInformation::markStatement(BasicBlock* block) {
+    StatementMark mark;
+    if (!isEnabled() || block == nullptr || block->getParent()->getSubprogram() == nullptr) {
+        return mark;
+    }
+    mark.block = block;
+    mark.last = block->empty() ? nullptr : &block->back();
+    mark.lastBlock = &block->getParent()->back();
+    return mark;
+}
+
+// Attach the given line to the instructions generated since the mark that do not have a location yet.
+// Statements are visited innermost first, so nested statements keep their own lines.
+void DebugInformation::setLocation(const StatementMark& mark, int lineNumber) {
+    if (mark.block == nullptr) {
+        return;
+    }
+    Function* function = mark.block->getParent();
+    DebugLoc location = DebugLoc::get(lineNumber, 0, function->getSubprogram());
+    auto tag = [&location](BasicBlock::iterator it, BasicBlock::iterator end) {
+        for (; it != end; ++it) {
+            if (!it->getDebugLoc()) {
+                it->setDebugLoc(location);
+            }
+        }
+    };
+    BasicBlock::iterator first = mark.last == nullptr ? mark.block->begin() : ++mark.last->getIterator();
+    tag(first, mark.block->end());
+    for (Function::iterator block = ++mark.lastBlock->getIterator(); block != function->end(); ++block) {
+        if (&*block != mark.block) {
+            tag(block->begin(), block->end());
+        }
+    }
+}
+
+void DebugInformation::finalize() {
+    if (!isEnabled()) {
+        return;
+    }
+    builder->finalize();
+}
@@ -0,0 +1,53 @@
+#ifndef DEBUG_INFORMATION_H
+#define DEBUG_INFORMATION_H
+
+#include <string>
+#include <map>
+
+namespace llvm {
+    class AllocaInst;
+    class BasicBlock;
+    class DIBuilder;
+    class DICompileUnit;
+    class DIFile;
+    class DIType;
+    class Function;
+    class Instruction;
+    class Type;
+}
+
+class CodeGenerationContext;
+
+class DebugInformation {
+private:
+    CodeGenerationContext* context;
+    llvm::DIBuilder* builder = nullptr;
+    llvm::DICompileUnit* compileUnit = nullptr;
+    llvm::DIFile* file = nullptr;
+    bool optimized = false;
+    std::map<llvm::Type*, llvm::DIType*> types;
+
+    llvm::DIType* getDebugType(llvm::Type* type);
+
+public:
+    // where a statement starts adding instructions, see markStatement
+    struct StatementMark {
+        llvm::BasicBlock* block = nullptr;
+        llvm::Instruction* last = nullptr; // of block before the statement, nullptr if it was empty
+        llvm::BasicBlock* lastBlock = nullptr; // of the function before the statement
+    };
+
+    DebugInformation(CodeGenerationContext* context) : context(context) {}
+
+    void initialize(const std::string& fileName, bool optimized);
+    bool isEnabled() const;
+    void declareFunction(llvm::Function* function, int lineNumber);
+    void declareVariable(llvm::AllocaInst* variable, const std::string& name, int lineNumber, unsigned argumentNumber);
+    void setLocation(llvm::Function* function, int lineNumber);
+    StatementMark markStatement(llvm::BasicBlock* block);
+    void setLocation(const StatementMark& mark, int lineNumber);
+    void finalize();
+};
+
+#endif
+
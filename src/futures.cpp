@@ -0,0 +1,159 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "futures.h"
+#include "code-generation.h"
+#include "common.h"
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+static const unsigned RESULT_MEMBER = 8; // Future<Void> has no result
+static const unsigned FIRST_ARGUMENT_MEMBER = 1; // of the frame, after the Future
+
+void Futures::declare() {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    Type* int64Type = Type::getInt64Ty(llvmContext);
+    for (const string resultTypeName : { "Boolean", "Integer", "Double", "String", "Void" }) {
+        // same layout as struct Future of the runtime (task run and needsWorker, body, state, awaited, waiters, nextWaiter), followed
+        // by the result. Types are packed, so the padding C puts after state is an explicit member.
+        vector<Type*> members = { bytePointerType, int64Type, bytePointerType, int32Type, int32Type, bytePointerType, bytePointerType, bytePointerType };
+        Type* resultType = typeConverter.getType(resultTypeName);
+        if (!resultType->isVoidTy()) {
+            members.push_back(resultType);
+        }
+        Type* futureType = typeConverter.createType(members, "Future<" + resultTypeName + ">")->getPointerTo();
+        futureTypes.insert(futureType);
+        resultFutureTypes[resultType] = futureType;
+    }
+}
+
+bool Futures::isFuture(Type* type) const {
+    return futureTypes.count(type) > 0;
+}
+
+/* Future<T> for result type T, nullptr if there is none */
+Type* Futures::getFutureType(Type* resultType) const {
+    auto futureType = resultFutureTypes.find(resultType);
+    return futureType != resultFutureTypes.end() ? futureType->second : nullptr;
+}
+
+/* Pointer to the result of the Future, nullptr for Future<Void> */
+Value* Futures::getResultPointer(Value* future, BasicBlock* block) {
+    Type* int32Type = Type::getInt32Ty(context->getLLVMContext());
+    StructType* futureStructType = cast<StructType>(future->getType()->getPointerElementType());
+    if (futureStructType->getNumElements() <= RESULT_MEMBER) {
+        return nullptr;
+    }
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, RESULT_MEMBER) };
+    return GetElementPtrInst::CreateInBounds(futureStructType, future, indices, "result", block);
+}
+
+/* Task running a spawned function: unpacks the arguments from the frame and stores the result */
+Function* Futures::getBody(Function* function, Type* frameType) {
+    auto existingBody = bodies.find(function);
+    if (existingBody != bodies.end()) {
+        return existingBody->second;
+    }
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    FunctionType* bodyType = FunctionType::get(Type::getVoidTy(llvmContext), { Type::getInt8PtrTy(llvmContext) }, false);
+    Function* body = Function::Create(bodyType, GlobalValue::InternalLinkage, function->getName() + ".spawn", context->getModule());
+    BasicBlock* block = BasicBlock::Create(llvmContext, "entry", body);
+    Value* frame = new BitCastInst(&*body->arg_begin(), frameType->getPointerTo(), "frame", block);
+
+    vector<Value*> arguments;
+    for (unsigned i=0; i<function->arg_size(); i++) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, FIRST_ARGUMENT_MEMBER + i) };
+        arguments.push_back(new LoadInst(GetElementPtrInst::CreateInBounds(frameType, frame, indices, "", block), "", block));
+    }
+    CallInst* call = CallInst::Create(function, arguments, "", block);
+    if (!function->getReturnType()->isVoidTy()) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, RESULT_MEMBER) };
+        new StoreInst(call, GetElementPtrInst::CreateInBounds(frameType, frame, indices, "", block), block);
+    }
+    ReturnInst::Create(llvmContext, block);
+
+    bodies[function] = body;
+    return body;
+}
+
+/* Start running the function on the thread pool, the arguments have to be converted to the declared types already */
+Value* Futures::spawn(Function* function, const vector<Value*>& arguments) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    Type* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    BasicBlock* block = context->currentBlock();
+
+    auto futureType = resultFutureTypes.find(function->getReturnType());
+    if (futureType == resultFutureTypes.end()) {
+        return error(*context, "Unable to spawn " + function->getName().str() + ", there is no Future<" + typeConverter.getTypeName(function->getReturnType()) + ">");
+    }
+    vector<Type*> frameMembers = { futureType->second->getPointerElementType() };
+    for (Value* argument : arguments) {
+        frameMembers.push_back(argument->getType());
+    }
+    StructType* frameType = StructType::get(llvmContext, frameMembers);
+    Function* body = getBody(function, frameType);
+
+    // small frames come from the runtime's task pool
+    Function* newFuture = context->getRuntimeFunction("oolong_future_new", bytePointerType, { body->getType(), typeConverter.getIntegerType() });
+    Value* newFutureArguments[] = { body, ConstantExpr::getSizeOf(frameType) };
+    Value* frame = CallInst::Create(newFuture, newFutureArguments, "", block);
+    Value* typedFrame = new BitCastInst(frame, frameType->getPointerTo(), "frame", block);
+    for (unsigned i=0; i<arguments.size(); i++) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, FIRST_ARGUMENT_MEMBER + i) };
+        new StoreInst(arguments[i], GetElementPtrInst::CreateInBounds(frameType, typedFrame, indices, "", block), block);
+    }
+    Function* startFuture = context->getRuntimeFunction("oolong_future_start", Type::getVoidTy(llvmContext), { bytePointerType });
+    CallInst::Create(startFuture, { frame }, "", block);
+    return new BitCastInst(frame, futureType->second, "future", block);
+}
+
+/* Wait for the Future stored in variable and return its result (nullptr for Future<Void>). The frame keeps
+   the result, so the Future, or any copy of it, can be awaited again. */
+Value* Futures::await(Value* variable) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+    Type* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    PointerType* futureType = cast<PointerType>(variable->getType()->getPointerElementType());
+    StructType* futureStructType = cast<StructType>(futureType->getElementType());
+    BasicBlock* block = context->currentBlock();
+
+    Value* future = new LoadInst(variable, "future", block);
+    Value* frame = new BitCastInst(future, bytePointerType, "", block);
+    // runs other tasks while waiting, including the awaited one if nobody started it yet
+    Function* waitFuture = context->getRuntimeFunction("oolong_future_wait", Type::getVoidTy(llvmContext), { bytePointerType });
+    CallInst::Create(waitFuture, { frame }, "", block);
+    Value* result = nullptr;
+    if (futureStructType->getNumElements() > RESULT_MEMBER) {
+        Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, RESULT_MEMBER) };
+        result = new LoadInst(GetElementPtrInst::CreateInBounds(futureStructType, future, indices, "", block), "result", block);
+    }
+    return result;
+}
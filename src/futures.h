@@ -0,0 +1,40 @@
+#ifndef FUTURES_H
+#define FUTURES_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Future<T> and the code for spawn and await. A Future is the task frame the runtime (package/future.c)
+// runs on its thread pool: a header known to the runtime, the result, then the arguments of the call.
+// The spawned function is called through a generated body that unpacks the arguments.
+class Futures {
+private:
+    CodeGenerationContext* context;
+    std::set<llvm::Type*> futureTypes;
+    std::map<llvm::Type*, llvm::Type*> resultFutureTypes; // result type to the Future<T> holding it
+    std::map<llvm::Function*, llvm::Function*> bodies; // spawned function to the body running it
+
+    llvm::Function* getBody(llvm::Function* function, llvm::Type* frameType);
+
+public:
+    Futures(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    bool isFuture(llvm::Type* type) const;
+    llvm::Type* getFutureType(llvm::Type* resultType) const;
+    llvm::Value* getResultPointer(llvm::Value* future, llvm::BasicBlock* block);
+    llvm::Value* spawn(llvm::Function* function, const std::vector<llvm::Value*>& arguments);
+    llvm::Value* await(llvm::Value* variable);
+};
+
+#endif
@@ -39,6 +39,7 @@ static const string OOLONG_PACKAGE_SEPARATOR = ".";
 static const string EXTERNAL_FUNCTION_RETURN_TYPE_SEPARATOR = "_0_";
 static const string EXTERNAL_FUNCTION_PACKAGE_SEPARATOR = "_1_";
 static const string EXTERNAL_FUNCTION_ARGUMENT_SEPARATOR = "_2_";
+static const string RUNTIME_SYMBOL_PREFIX = "oolong_";
 
 // OolongFunction
 Type* OolongFunction::getReturnType() const {
@@ -180,11 +181,22 @@ void Importer::loadStandardLibrary(const string& archiveLocation) {
 
     // create String type
     LLVMContext& llvmContext = context->getLLVMContext();
+    // String refers to itself (owner of a view), so the body is set once the type exists
+    StructType* stringType = typeConverter.createOpaqueType("String");
     vector<Type*> stringMembers;
     stringMembers.push_back(Type::getInt8PtrTy(llvmContext)); // char*
     stringMembers.push_back(typeConverter.getIntegerType()); // allocated size
     stringMembers.push_back(typeConverter.getIntegerType()); // used size
-    typeConverter.createType(stringMembers, "String");
+    stringMembers.push_back(stringType->getPointerTo()); // owner
+    stringType->setBody(stringMembers, true);
+    // growable buffer for building Strings piece by piece
+    typeConverter.createOpaqueType("StringBuilder");
+    // bounded lock-free queue of Integers shared between threads
+    typeConverter.createOpaqueType("Queue");
+    // memory mapped file of the io.File package
+    typeConverter.createOpaqueType("File");
+    // submission and completion rings of the aio package
+    typeConverter.createOpaqueType("IoRing");
 
     // load package archive
     auto packageArchiveOrError = MemoryBuffer::getFile(archiveLocation);
@@ -198,12 +210,25 @@ void Importer::loadStandardLibrary(const string& archiveLocation) {
         if (functionName[0] == '_') {
             functionName.erase(0, 1);
         }
+        // runtime internals are called by generated code directly, they don't belong to a package
+        if (functionName.compare(0, RUNTIME_SYMBOL_PREFIX.length(), RUNTIME_SYMBOL_PREFIX) == 0) {
+            continue;
+        }
         OolongFunction function = convertExternalFunctionToOolongFunction(functionName, context);
         packages[function.getPackageName()].push_back(function);
     }
 }
 
+void Importer::declareBuiltinPackage(const string& package, const function<void()>& declare) {
+    builtinPackages[package] = declare;
+}
+
 bool Importer::importPackage(const string& package) {
+    auto builtinPackage = builtinPackages.find(package);
+    if (builtinPackage != builtinPackages.end()) {
+        builtinPackage->second();
+        return true;
+    }
     if (packages.find(package) != packages.end()) {
         for (OolongFunction function : packages[package]) {
             declareExternalFunction(function);
@@ -4,6 +4,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/LLVMContext.h"
+#include <functional>
 #include <string>
 #include <map>
 #include <vector>
@@ -42,6 +43,8 @@ private:
     CodeGenerationContext* context;
     std::map<std::string, std::vector<OolongFunction>> packages;
     std::map<OolongFunction, llvm::Function*> importedFunctions;
+    // packages generated by the compiler itself instead of living in the standard library archive
+    std::map<std::string, std::function<void()>> builtinPackages;
 
 public:
     Importer(CodeGenerationContext* context) : context(context) {}
@@ -50,6 +53,7 @@ public:
     void declareExternalFunction(const OolongFunction& function);
     void declareExternalFunction(const OolongFunction& function, const std::string& externalName);
     void loadStandardLibrary(const std::string& archiveLocation);
+    void declareBuiltinPackage(const std::string& package, const std::function<void()>& declare);
     bool importPackage(const std::string& package);
     llvm::Function* findFunction(const OolongFunction& function) const;
     llvm::Function* findFunction(const OolongFunction& function, bool exactMatch) const;
@@ -0,0 +1,215 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "maps.h"
+#include "code-generation.h"
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+static const unsigned VALUES_MEMBER = 2;
+static const unsigned SIZE_MEMBER = 3;
+
+// weights for branches to error handling and other rarely taken paths
+static const uint32_t LIKELY_WEIGHT = 1 << 20;
+static const uint32_t UNLIKELY_WEIGHT = 1;
+
+void Maps::declare() {
+    for (const string keyTypeName : { "Integer", "String" }) {
+        for (const string valueTypeName : { "Boolean", "Integer", "Double", "String" }) {
+            declareMap(keyTypeName, valueTypeName);
+        }
+    }
+}
+
+void Maps::declareMap(const string& keyTypeName, const string& valueTypeName) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* keyType = typeConverter.getType(keyTypeName);
+    Type* valueType = typeConverter.getType(valueTypeName);
+    Type* integerType = typeConverter.getIntegerType();
+    Type* booleanType = typeConverter.getBooleanType();
+    Type* voidType = typeConverter.getVoidType();
+    Constant* valueSize = ConstantExpr::getSizeOf(valueType);
+
+    // same layout as struct Map of the runtime: control bytes, keys, values, size, capacity and growth left
+    Type* mapType = typeConverter.createType({ Type::getInt8PtrTy(llvmContext), keyType->getPointerTo(), valueType->getPointerTo(), integerType, integerType, integerType },
+            "Map<" + keyTypeName + ", " + valueTypeName + ">")->getPointerTo();
+    keyTypes[mapType] = keyType;
+
+    // size(Map<K, V>) : Integer
+    Function* size = context->createBuiltinFunction(integerType, "size", { mapType });
+    BasicBlock* block = &size->getEntryBlock();
+    ReturnInst::Create(llvmContext, loadHeader(&*size->arg_begin(), SIZE_MEMBER, "size", block), block);
+
+    // contains(Map<K, V>, K) : Boolean
+    Function* contains = context->createBuiltinFunction(booleanType, "contains", { mapType, keyType });
+    block = &contains->getEntryBlock();
+    Value* slot = find(&*contains->arg_begin(), &*(contains->arg_begin() + 1), block);
+    ReturnInst::Create(llvmContext, new ICmpInst(*block, CmpInst::ICMP_SGE, slot, ConstantInt::get(integerType, 0), "found"), block);
+
+    // get(Map<K, V>, K, V) : V, the value of the key or the given default if the Map doesn't contain it
+    Function* get = context->createBuiltinFunction(valueType, "get", { mapType, keyType, valueType });
+    Value* map = &*get->arg_begin();
+    block = &get->getEntryBlock();
+    BasicBlock* foundBlock = BasicBlock::Create(llvmContext, "found", get);
+    BasicBlock* missingBlock = BasicBlock::Create(llvmContext, "missing", get);
+    slot = find(map, &*(get->arg_begin() + 1), block);
+    Value* found = new ICmpInst(*block, CmpInst::ICMP_SGE, slot, ConstantInt::get(integerType, 0), "found");
+    BranchInst::Create(foundBlock, missingBlock, found, block);
+    Value* values = loadHeader(map, VALUES_MEMBER, "values", foundBlock);
+    Value* element = GetElementPtrInst::CreateInBounds(valueType, values, slot, "value", foundBlock);
+    LoadInst* value = new LoadInst(element, "", false, foundBlock);
+    context->getCollections().setElementAccess(value, valueType);
+    ReturnInst::Create(llvmContext, value, foundBlock);
+    ReturnInst::Create(llvmContext, &*(get->arg_begin() + 2), missingBlock);
+
+    // remove(Map<K, V>, K) : Boolean, false if the Map didn't contain the key
+    Function* remove = context->createBuiltinFunction(booleanType, "remove", { mapType, keyType });
+    block = &remove->getEntryBlock();
+    Function* runtimeRemove = context->getRuntimeFunction(getRuntimeName("remove", mapType), booleanType, { Type::getInt8PtrTy(llvmContext), keyType });
+    Value* removeArguments[] = { toRuntimeMap(&*remove->arg_begin(), block), &*(remove->arg_begin() + 1) };
+    ReturnInst::Create(llvmContext, CallInst::Create(runtimeRemove, removeArguments, "removed", block), block);
+
+    // reserve(Map<K, V>, Integer), room for at least the given number of entries before the table is rebuilt
+    Function* reserve = context->createBuiltinFunction(voidType, "reserve", { mapType, integerType });
+    block = &reserve->getEntryBlock();
+    Function* runtimeReserve = context->getRuntimeFunction(getRuntimeName("reserve", mapType), voidType, { Type::getInt8PtrTy(llvmContext), integerType, integerType });
+    Value* reserveArguments[] = { toRuntimeMap(&*reserve->arg_begin(), block), &*(reserve->arg_begin() + 1), valueSize };
+    CallInst::Create(runtimeReserve, reserveArguments, "", block);
+    ReturnInst::Create(llvmContext, block);
+
+    // clear(Map<K, V>), keeps the capacity
+    Function* clear = context->createBuiltinFunction(voidType, "clear", { mapType });
+    block = &clear->getEntryBlock();
+    Function* runtimeClear = context->getRuntimeFunction(getRuntimeName("clear", mapType), voidType, { Type::getInt8PtrTy(llvmContext) });
+    CallInst::Create(runtimeClear, { toRuntimeMap(&*clear->arg_begin(), block) }, "", block);
+    ReturnInst::Create(llvmContext, block);
+
+    if (keyTypeName != "Integer" || valueTypeName == "String") {
+        // there are no Arrays of Strings to insert from
+        return;
+    }
+    // put(Map<Integer, V>, Array<Integer>, Array<V>), inserts keys[i] with values[i] after reserving room for all of them
+    Type* keyArrayType = typeConverter.getType("Array<Integer>");
+    Type* valueArrayType = typeConverter.getType("Array<" + valueTypeName + ">");
+    Function* put = context->createBuiltinFunction(voidType, "put", { mapType, keyArrayType, valueArrayType });
+    block = &put->getEntryBlock();
+    Type* bytePointerType = Type::getInt8PtrTy(llvmContext);
+    Function* insertAll = context->getRuntimeFunction("oolong_map_insert_all_integer", voidType, { bytePointerType, bytePointerType, bytePointerType, integerType });
+    Value* putArguments[] = { toRuntimeMap(&*put->arg_begin(), block), new BitCastInst(&*(put->arg_begin() + 1), bytePointerType, "", block),
+                              new BitCastInst(&*(put->arg_begin() + 2), bytePointerType, "", block), valueSize };
+    CallInst::Create(insertAll, putArguments, "", block);
+    ReturnInst::Create(llvmContext, block);
+}
+
+/* The runtime has the functions of every key type, e.g. oolong_map_find_integer and oolong_map_find_string */
+string Maps::getRuntimeName(const string& operation, Type* mapType) const {
+    return "oolong_map_" + operation + (getKeyType(mapType)->isPointerTy() ? "_string" : "_integer");
+}
+
+Value* Maps::loadHeader(Value* map, unsigned member, const string& name, BasicBlock* block) {
+    Type* int32Type = Type::getInt32Ty(context->getLLVMContext());
+    Value* indices[] = { ConstantInt::get(int32Type, 0), ConstantInt::get(int32Type, member) };
+    Value* pointer = GetElementPtrInst::CreateInBounds(map->getType()->getPointerElementType(), map, indices, "", block);
+    return new LoadInst(pointer, name, false, block);
+}
+
+Value* Maps::toRuntimeMap(Value* map, BasicBlock* block) {
+    return new BitCastInst(map, Type::getInt8PtrTy(context->getLLVMContext()), "", block);
+}
+
+/* Slot of the key or -1. Lookups only read memory, so the optimizer can merge repeated ones and hoist them out of loops. */
+Value* Maps::find(Value* map, Value* key, BasicBlock* block) {
+    Type* keyType = getKeyType(map->getType());
+    Function* runtimeFind = context->getRuntimeFunction(getRuntimeName("find", map->getType()), context->getTypeConverter().getIntegerType(),
+            { Type::getInt8PtrTy(context->getLLVMContext()), keyType });
+    runtimeFind->setOnlyReadsMemory();
+    runtimeFind->setDoesNotThrow();
+    Value* arguments[] = { toRuntimeMap(map, block), key };
+    return CallInst::Create(runtimeFind, arguments, "slot", block);
+}
+
+bool Maps::isMap(Type* type) const {
+    return keyTypes.count(type) > 0;
+}
+
+Type* Maps::getKeyType(Type* mapType) const {
+    auto keyType = keyTypes.find(mapType);
+    return keyType != keyTypes.end() ? keyType->second : nullptr;
+}
+
+Type* Maps::getValueType(Type* mapType) const {
+    return mapType->getPointerElementType()->getStructElementType(VALUES_MEMBER)->getPointerElementType();
+}
+
+/* Empty Map with room for capacity entries */
+Value* Maps::create(Type* mapType, Value* capacity) {
+    BasicBlock* block = context->currentBlock();
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    Function* allocate = context->getRuntimeFunction("oolong_map_new", Type::getInt8PtrTy(context->getLLVMContext()), { integerType, integerType });
+    Value* arguments[] = { capacity, ConstantExpr::getSizeOf(getValueType(mapType)) };
+    return new BitCastInst(CallInst::Create(allocate, arguments, "", block), mapType, "", block);
+}
+
+/* Pointer to the value of the key, e.g. map[key]. Assignments insert the key if the Map doesn't contain it yet,
+   reading the value of a missing key is an error like an index out of bounds. The pointer is only valid until
+   the next insertion, which might move the values. */
+Value* Maps::getValuePointer(Value* map, Value* key, bool insert) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    Type* keyType = getKeyType(map->getType());
+    Type* valueType = getValueType(map->getType());
+    BasicBlock* block = context->currentBlock();
+
+    Value* slot;
+    if (insert) {
+        Function* runtimeInsert = context->getRuntimeFunction(getRuntimeName("insert", map->getType()), integerType,
+                { Type::getInt8PtrTy(llvmContext), keyType, integerType });
+        Value* arguments[] = { toRuntimeMap(map, block), key, ConstantExpr::getSizeOf(valueType) };
+        slot = CallInst::Create(runtimeInsert, arguments, "slot", block);
+    }
+    else {
+        slot = find(map, key, block);
+        Function* function = block->getParent();
+        Value* found = new ICmpInst(*block, CmpInst::ICMP_SGE, slot, ConstantInt::get(integerType, 0), "found");
+        BasicBlock* keyNotFoundBlock = BasicBlock::Create(llvmContext, "keyNotFound", function);
+        BasicBlock* foundBlock = BasicBlock::Create(llvmContext, "found", function);
+        BranchInst* branch = BranchInst::Create(foundBlock, keyNotFoundBlock, found, block);
+        branch->setMetadata(LLVMContext::MD_prof, MDBuilder(llvmContext).createBranchWeights(LIKELY_WEIGHT, UNLIKELY_WEIGHT));
+
+        Function* keyNotFound = context->getRuntimeFunction(getRuntimeName("key_not_found", map->getType()), Type::getVoidTy(llvmContext), { keyType });
+        keyNotFound->setDoesNotReturn();
+        keyNotFound->addFnAttr(Attribute::Cold);
+        CallInst::Create(keyNotFound, { key }, "", keyNotFoundBlock)->setDoesNotReturn();
+        new UnreachableInst(llvmContext, keyNotFoundBlock);
+
+        context->replaceCurrentBlock(foundBlock);
+        block = foundBlock;
+    }
+    // after the insertion, which might have rebuilt the table
+    Value* values = loadHeader(map, VALUES_MEMBER, "values", block);
+    return GetElementPtrInst::CreateInBounds(valueType, values, slot, "value", block);
+}
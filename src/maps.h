@@ -0,0 +1,43 @@
+#ifndef MAPS_H
+#define MAPS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Map<K, V> with Integer or String keys and values of the primitive types, hash tables of the runtime
+// (package/map.c). Every key and value type combination gets a header type of its own: the runtime
+// finds or inserts the slot of a key, values are loaded and stored inline through the typed pointer
+// in the header. contains, get, remove, size, reserve, clear and put are small internal functions.
+class Maps {
+private:
+    CodeGenerationContext* context;
+    std::map<llvm::Type*, llvm::Type*> keyTypes; // Map<K, V> to K
+
+    void declareMap(const std::string& keyTypeName, const std::string& valueTypeName);
+    std::string getRuntimeName(const std::string& operation, llvm::Type* mapType) const;
+    llvm::Value* loadHeader(llvm::Value* map, unsigned member, const std::string& name, llvm::BasicBlock* block);
+    llvm::Value* toRuntimeMap(llvm::Value* map, llvm::BasicBlock* block);
+    llvm::Value* find(llvm::Value* map, llvm::Value* key, llvm::BasicBlock* block);
+
+public:
+    Maps(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    bool isMap(llvm::Type* type) const;
+    llvm::Type* getKeyType(llvm::Type* mapType) const;
+    llvm::Type* getValueType(llvm::Type* mapType) const;
+    llvm::Value* create(llvm::Type* mapType, llvm::Value* capacity);
+    llvm::Value* getValuePointer(llvm::Value* map, llvm::Value* key, bool insert);
+};
+
+#endif
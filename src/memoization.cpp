@@ -0,0 +1,207 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "memoization.h"
+#include "code-generation.h"
+#include <vector>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+// Integer arguments from 0 up to this index the dense table, 256 KB of zero initialized memory per function
+static const uint64_t DENSE_ENTRIES = 1 << 14;
+static const unsigned FILLED_MEMBER = 0;
+static const unsigned RESULT_MEMBER = 1;
+static const unsigned ALIGNMENT = 8;
+
+bool Memoization::canMemoize(Function* function) const {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    auto isPrimitive = [&typeConverter](Type* type) {
+        return type == typeConverter.getBooleanType() || type == typeConverter.getIntegerType() || type == typeConverter.getDoubleType();
+    };
+    for (Argument& argument : function->args()) {
+        if (!isPrimitive(argument.getType())) {
+            return false;
+        }
+    }
+    // callers may change a returned String, or collection, and every later hit would see the change
+    return isPrimitive(function->getReturnType());
+}
+
+/* Fills the empty function with the cache lookups, implementation has the same signature and computes the result */
+void Memoization::createWrapper(Function* function, Function* implementation, int64_t limit) {
+    BasicBlock* block = BasicBlock::Create(context->getLLVMContext(), "entry", function);
+    // evicting results from a dense table would need the same bookkeeping as the hash table
+    if (limit == 0) {
+        block = createDenseLookup(function, implementation, block);
+    }
+    if (block != nullptr) {
+        createHashedLookup(function, implementation, limit, block);
+    }
+}
+
+/* Results are cached as 64 bits */
+Value* Memoization::toBits(Value* value, BasicBlock* block) {
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    Type* type = value->getType();
+    if (type->isDoubleTy()) {
+        return new BitCastInst(value, integerType, "", block);
+    }
+    if (type != integerType) {
+        return new ZExtInst(value, integerType, "", block);
+    }
+    return value;
+}
+
+Value* Memoization::fromBits(Value* bits, Type* type, BasicBlock* block) {
+    if (type->isDoubleTy()) {
+        return new BitCastInst(bits, type, "", block);
+    }
+    if (type != bits->getType()) {
+        return new TruncInst(bits, type, "", block);
+    }
+    return bits;
+}
+
+Value* Memoization::callImplementation(Function* function, Function* implementation, BasicBlock* block) {
+    vector<Value*> arguments;
+    for (Argument& argument : function->args()) {
+        arguments.push_back(&argument);
+    }
+    return CallInst::Create(implementation, arguments, "result", block);
+}
+
+/* Results of functions without arguments, of a Boolean or of an Integer argument in [0, DENSE_ENTRIES) go into a
+   table of the module. A result is stored before its entry is marked as filled, so readers don't need a lock.
+   Returns the block handling the other arguments, nullptr if there are none. */
+BasicBlock* Memoization::createDenseLookup(Function* function, Function* implementation, BasicBlock* block) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* integerType = typeConverter.getIntegerType();
+    Type* int32Type = Type::getInt32Ty(llvmContext);
+
+    Value* index = ConstantInt::get(integerType, 0);
+    uint64_t entries = 1;
+    if (function->arg_size() == 1) {
+        Argument* argument = &*function->arg_begin();
+        if (argument->getType() == typeConverter.getBooleanType()) {
+            index = new ZExtInst(argument, integerType, "index", block);
+            entries = 2;
+        }
+        else if (argument->getType() == integerType) {
+            index = argument;
+            entries = DENSE_ENTRIES;
+        }
+        else {
+            return block;
+        }
+    }
+    else if (function->arg_size() > 1) {
+        return block;
+    }
+
+    StructType* entryType = StructType::get(llvmContext, { integerType, integerType });
+    ArrayType* tableType = ArrayType::get(entryType, entries);
+    GlobalVariable* table = new GlobalVariable(*context->getModule(), tableType, false, GlobalValue::InternalLinkage,
+            ConstantAggregateZero::get(tableType), function->getName() + ".cache");
+
+    BasicBlock* denseBlock = block;
+    BasicBlock* outsideBlock = nullptr;
+    if (entries == DENSE_ENTRIES) {
+        // unsigned, so negative arguments are outside as well
+        Value* inDomain = new ICmpInst(*block, CmpInst::ICMP_ULT, index, ConstantInt::get(integerType, entries), "inDomain");
+        denseBlock = BasicBlock::Create(llvmContext, "dense", function);
+        outsideBlock = BasicBlock::Create(llvmContext, "outside", function);
+        BranchInst::Create(denseBlock, outsideBlock, inDomain, block);
+    }
+    Value* filledIndices[] = { ConstantInt::get(integerType, 0), index, ConstantInt::get(int32Type, FILLED_MEMBER) };
+    Value* filledPointer = GetElementPtrInst::CreateInBounds(tableType, table, filledIndices, "filled", denseBlock);
+    Value* resultIndices[] = { ConstantInt::get(integerType, 0), index, ConstantInt::get(int32Type, RESULT_MEMBER) };
+    Value* resultPointer = GetElementPtrInst::CreateInBounds(tableType, table, resultIndices, "cachedResult", denseBlock);
+    LoadInst* filled = new LoadInst(filledPointer, "", false, denseBlock);
+    filled->setAlignment(ALIGNMENT);
+    filled->setAtomic(AtomicOrdering::Acquire);
+    BasicBlock* cachedBlock = BasicBlock::Create(llvmContext, "cached", function);
+    BasicBlock* callBlock = BasicBlock::Create(llvmContext, "call", function);
+    Value* isFilled = new ICmpInst(*denseBlock, CmpInst::ICMP_NE, filled, ConstantInt::get(integerType, 0), "isFilled");
+    BranchInst::Create(cachedBlock, callBlock, isFilled, denseBlock);
+
+    // threads computing the same result at the same time store the same bits
+    LoadInst* cached = new LoadInst(resultPointer, "", false, cachedBlock);
+    cached->setAlignment(ALIGNMENT);
+    cached->setAtomic(AtomicOrdering::Monotonic);
+    ReturnInst::Create(llvmContext, fromBits(cached, function->getReturnType(), cachedBlock), cachedBlock);
+
+    Value* result = callImplementation(function, implementation, callBlock);
+    StoreInst* storeResult = new StoreInst(toBits(result, callBlock), resultPointer, callBlock);
+    storeResult->setAlignment(ALIGNMENT);
+    storeResult->setAtomic(AtomicOrdering::Monotonic);
+    StoreInst* storeFilled = new StoreInst(ConstantInt::get(integerType, 1), filledPointer, callBlock);
+    storeFilled->setAlignment(ALIGNMENT);
+    storeFilled->setAtomic(AtomicOrdering::Release);
+    ReturnInst::Create(llvmContext, result, callBlock);
+    return outsideBlock;
+}
+
+/* Arguments and result go through the runtime's cache of the function, created by the first call */
+void Memoization::createHashedLookup(Function* function, Function* implementation, int64_t limit, BasicBlock* block) {
+    LLVMContext& llvmContext = context->getLLVMContext();
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* integerType = typeConverter.getIntegerType();
+    PointerType* bytePointerType = Type::getInt8PtrTy(llvmContext);
+
+    GlobalVariable* handle = new GlobalVariable(*context->getModule(), bytePointerType, false, GlobalValue::InternalLinkage,
+            ConstantPointerNull::get(bytePointerType), function->getName() + ".memo");
+    ArrayType* argumentsType = ArrayType::get(integerType, function->arg_size() > 0 ? function->arg_size() : 1);
+    AllocaInst* arguments = context->createEntryBlockAlloca(function, argumentsType, "arguments");
+    AllocaInst* cached = context->createEntryBlockAlloca(function, integerType, "cachedResult");
+    for (Argument& argument : function->args()) {
+        Value* indices[] = { ConstantInt::get(integerType, 0), ConstantInt::get(integerType, argument.getArgNo()) };
+        Value* element = GetElementPtrInst::CreateInBounds(argumentsType, arguments, indices, "", block);
+        new StoreInst(toBits(&argument, block), element, block);
+    }
+    Value* indices[] = { ConstantInt::get(integerType, 0), ConstantInt::get(integerType, 0) };
+    Value* firstArgument = GetElementPtrInst::CreateInBounds(argumentsType, arguments, indices, "", block);
+    Value* argumentCount = ConstantInt::get(integerType, function->arg_size());
+    Value* limitValue = ConstantInt::get(integerType, limit);
+
+    Function* find = context->getRuntimeFunction("oolong_memo_find", typeConverter.getBooleanType(),
+            { bytePointerType->getPointerTo(), integerType, integerType, integerType->getPointerTo(), integerType->getPointerTo() });
+    Value* findArguments[] = { handle, argumentCount, limitValue, firstArgument, cached };
+    Value* found = CallInst::Create(find, findArguments, "found", block);
+    BasicBlock* cachedBlock = BasicBlock::Create(llvmContext, "cached", function);
+    BasicBlock* callBlock = BasicBlock::Create(llvmContext, "call", function);
+    BranchInst::Create(cachedBlock, callBlock, found, block);
+
+    Value* bits = new LoadInst(cached, "", false, cachedBlock);
+    ReturnInst::Create(llvmContext, fromBits(bits, function->getReturnType(), cachedBlock), cachedBlock);
+
+    Value* result = callImplementation(function, implementation, callBlock);
+    Function* store = context->getRuntimeFunction("oolong_memo_store", Type::getVoidTy(llvmContext),
+            { bytePointerType->getPointerTo(), integerType, integerType, integerType->getPointerTo(), integerType });
+    Value* storeArguments[] = { handle, argumentCount, limitValue, firstArgument, toBits(result, callBlock) };
+    CallInst::Create(store, storeArguments, "", callBlock);
+    ReturnInst::Create(llvmContext, result, callBlock);
+}
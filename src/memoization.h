@@ -0,0 +1,37 @@
+#ifndef MEMOIZATION_H
+#define MEMOIZATION_H
+
+#include <cstdint>
+
+namespace llvm {
+    class BasicBlock;
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// @memoize functions: the declared function becomes a wrapper that returns the cached result of earlier
+// calls with the same arguments and otherwise calls the implementation, so recursive calls are cached
+// as well. A single Integer or Boolean argument in a small domain indexes a dense table of the module,
+// read without locking. Other arguments, and every call of a function with a cache limit, go through a
+// hash table of the runtime (package/memoize.c), which passes arguments and results as 64 bits.
+class Memoization {
+private:
+    CodeGenerationContext* context;
+
+    llvm::Value* toBits(llvm::Value* value, llvm::BasicBlock* block);
+    llvm::Value* fromBits(llvm::Value* bits, llvm::Type* type, llvm::BasicBlock* block);
+    llvm::Value* callImplementation(llvm::Function* function, llvm::Function* implementation, llvm::BasicBlock* block);
+    llvm::BasicBlock* createDenseLookup(llvm::Function* function, llvm::Function* implementation, llvm::BasicBlock* block);
+    void createHashedLookup(llvm::Function* function, llvm::Function* implementation, int64_t limit, llvm::BasicBlock* block);
+
+public:
+    Memoization(CodeGenerationContext* context) : context(context) {}
+
+    bool canMemoize(llvm::Function* function) const;
+    void createWrapper(llvm::Function* function, llvm::Function* implementation, int64_t limit);
+};
+
+#endif
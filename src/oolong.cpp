@@ -19,6 +19,7 @@
 #include "code-generation.h"
 #include "oolong.h"
 #include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/Support/Regex.h>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -75,6 +76,21 @@ static void printUsage() {
          << "   -l, --emit-llvm             Do not link, output LLVM IR.\n"
          << "   -e, --execute               Do not create any artifacts, execute code directly.\n"
          << "   -c, --compile-only          Do not link, output object files.\n"
+         << "   -S, --assembly              Do not link, output assembly.\n"
+         << "   --annotate                  Write <input-file>.annotated listing every source line with the\n"
+         << "                               IR and machine instructions generated for it and per-function\n"
+         << "                               instruction and byte counts (implies -g).\n"
+         << "   -g, --debug-information     Emit DWARF debug information (source lines, functions, variables).\n"
+         << "   --instrument-functions      Count calls and time of every function, report at exit\n"
+         << "                               (to stderr or the file named by OOLONG_INSTRUMENT_OUTPUT).\n"
+         << "   --perf-map                  With --execute, make JIT compiled code visible to perf\n"
+         << "                               (/tmp/perf-<pid>.map and jitdump, implies -g).\n"
+         << "   --remarks[=<filter>]        Report passed, missed and analysis optimization remarks of the\n"
+         << "                               passes whose name matches the regular expression <filter>,\n"
+         << "                               e.g. 'inline|loop-vectorize' (default all, implies -g).\n"
+         << "   --size-report[=json]        Print IR instruction counts before and after optimization, machine\n"
+         << "                               code bytes, inlined calls and stack frame size of every function\n"
+         << "                               and the used runtime functions, as text or JSON.\n"
          << "   -o, --output-file <file>    Set output file name.\n"
          << "   -O[N]                       Optimize output. N:\n"
          << "                                   0 -> No optimization.\n"
@@ -119,7 +135,7 @@ static void linkFiles(const string& outputFile, vector<string> objectFiles) {
         command << " " << objectFile;
     }
     // add oolong packages
-    command << " lib/* -lm";
+    command << " lib/* -lm -lpthread -ldl";
     system(command.str().c_str());
 }
 
@@ -133,7 +149,14 @@ int main(int argc, char **argv) {
 
     bool debug = false;
     bool emitLlvm = false;
+    bool emitAssembly = false;
+    bool annotate = false;
+    bool emitDebugInformation = false;
     bool execute = false;
+    bool perfMap = false;
+    bool instrumentFunctions = false;
+    string remarksFilter = "";
+    string sizeReportFormat = "";
     bool link = true;
     int optimizationLevel = 2;
     string outputFile = DEFAULT_OUTPUT_FILE;
@@ -168,9 +191,46 @@ int main(int argc, char **argv) {
         else if (match(argument, "-e", "--execute")) {
             execute = true;
         }
+        else if (match(argument, nullptr, "--instrument-functions")) {
+            instrumentFunctions = true;
+        }
+        else if (match(argument, nullptr, "--perf-map")) {
+            perfMap = true;
+            // line tables let perf annotate map JIT code back to source
+            emitDebugInformation = true;
+        }
+        else if (match(argument, nullptr, "--remarks") || argument.find("--remarks=") == 0) {
+            const size_t equals = argument.find('=');
+            remarksFilter = (equals == string::npos || equals+1 == argument.length()) ? ".*" : argument.substr(equals+1);
+            string regexError;
+            if (!Regex(remarksFilter).isValid(regexError)) {
+                cerr << "Invalid remarks filter: " << regexError << endl;
+                return 1;
+            }
+            // remarks point to source lines through the line tables
+            emitDebugInformation = true;
+        }
+        else if (match(argument, nullptr, "--size-report")) {
+            sizeReportFormat = "text";
+        }
+        else if (match(argument, nullptr, "--size-report=json") || match(argument, nullptr, "--size-report=text")) {
+            sizeReportFormat = argument.substr(argument.find('=')+1);
+        }
         else if (match(argument, "-c", "--compile-only")) {
             link = false;
         }
+        else if (match(argument, "-S", "--assembly")) {
+            emitAssembly = true;
+            link = false;
+        }
+        else if (match(argument, nullptr, "--annotate")) {
+            annotate = true;
+            // source lines are taken from the line tables
+            emitDebugInformation = true;
+        }
+        else if (match(argument, "-g", "--debug-information")) {
+            emitDebugInformation = true;
+        }
         else if (match(argument, "-o", "--output-file")) {
             // next argument is output file name
             if (++i >= argc) {
@@ -195,6 +255,10 @@ int main(int argc, char **argv) {
     }
     //// collect arguments (end)
 
+    if (perfMap && !execute) {
+        cerr << "The perf map option is only valid with the execute option." << endl;
+        return 1;
+    }
     if (execute && inputFiles.size() > 1) {
         cerr << "Execute option is only valid with a single input file." << endl;
         return 1;
@@ -236,7 +300,8 @@ int main(int argc, char **argv) {
         // parse input
         int parseValue = 0;
         string moduleName = "stdin.ool";
-        string outputName = "stdin.ool.o";
+        const string outputExtension = emitAssembly ? ".s" : ".o";
+        string outputName = "stdin.ool" + outputExtension;
         if (inputFile == STDIN_INDICATOR) {
             currentParseFile = "<stdin>";
 
@@ -266,7 +331,7 @@ int main(int argc, char **argv) {
 
             // use provided name
             moduleName = inputFile;
-            outputName = inputFile + ".o";
+            outputName = inputFile + outputExtension;
         }
         if (link) {
             // no need to put output files in-place, create temp files
@@ -294,6 +359,13 @@ int main(int argc, char **argv) {
 
         CodeGenerationContext context(moduleName);
         context.setEmitLlvm(emitLlvm);
+        context.setEmitAssembly(emitAssembly);
+        context.setAnnotate(annotate);
+        context.setEmitDebugInformation(emitDebugInformation);
+        context.setPerfMap(perfMap);
+        context.setInstrumentFunctions(instrumentFunctions);
+        context.setRemarksFilter(remarksFilter);
+        context.setSizeReportFormat(sizeReportFormat);
         context.setOutputName(outputName);
         context.setOptimizationLevel(optimizationLevel);
         int returnValue = context.generateCode(*programNode);
@@ -306,10 +378,12 @@ int main(int argc, char **argv) {
             break;
         }
         if (execute) {
+            // run only once, the execution engine takes ownership of the module
+            GenericValue returnValue = context.runCode();
             if (debug) {
-                cout << "Execution failed with value " << context.runCode().IntVal.toString(10, true) << "." << endl;
+                cout << "Execution failed with value " << returnValue.IntVal.toString(10, true) << "." << endl;
             }
-            errorCode = context.runCode().IntVal.getLimitedValue(0);
+            errorCode = returnValue.IntVal.getLimitedValue(0);
             break;
         }
     }
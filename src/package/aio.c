@@ -0,0 +1,574 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// aio: asynchronous reads and writes of file descriptors through an IoRing.
+//
+// read and write only queue a request and return its id, submit hands every
+// queued request to the kernel at once and wait returns the id of a completed
+// one. Reads go into String buffers (aio.buffer), whose usedSize is set to the
+// number of bytes read, writes write usedSize bytes. Ids are slots of the ring,
+// they are reused once their completion was returned, so at most depth requests
+// are in flight.
+//
+// The ring is io_uring, driven with the raw system calls. Buffers registered
+// with the ring are pinned by the kernel once instead of on every request.
+// Where io_uring is unavailable (old kernels, seccomp filters) requests are
+// run by a few threads with pread and pwrite instead, with the same interface.
+//
+// A ring belongs to the thread that opened it. Workers of the thread pool run
+// other tasks while waiting, other threads start a helper for the pool first,
+// like Channels (scheduler.c).
+
+#include "oolong-module.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAS_IO_URING 1
+#else
+#define HAS_IO_URING 0
+#endif
+
+#define MAXIMUM_DEPTH 4096
+#define MAXIMUM_REGISTERED_BUFFERS 64
+#define FALLBACK_THREADS 4
+#define BUFFER_ALIGNMENT 4096 // page aligned, so buffers also work for O_DIRECT
+
+struct Request {
+    struct String* buffer;
+    int descriptor;
+    int64_t offset;
+    bool reading;
+    bool inUse;
+    struct iovec vector; // READV and WRITEV read it until the completion, they work on every io_uring kernel
+    int64_t result;
+};
+
+#if HAS_IO_URING
+struct Submissions {
+    _Atomic unsigned* head;
+    _Atomic unsigned* tail;
+    unsigned mask;
+    unsigned* array;
+    struct io_uring_sqe* entries;
+};
+
+struct Completions {
+    _Atomic unsigned* head;
+    _Atomic unsigned* tail;
+    unsigned mask;
+    struct io_uring_cqe* entries;
+};
+#endif
+
+// Requests of the fallback are slot indexes passed around in queues of depth entries.
+struct SlotQueue {
+    int64_t* slots;
+    int64_t start;
+    int64_t count;
+};
+
+struct IoRing {
+    struct Request* requests;
+    int64_t depth;
+    int64_t inFlight; // queued or submitted, completion not returned yet
+    int64_t queued; // not submitted yet
+    int64_t lastResult;
+    struct iovec registeredBuffers[MAXIMUM_REGISTERED_BUFFERS];
+    int registeredBufferCount;
+
+    bool usesIoUring;
+#if HAS_IO_URING
+    int descriptor;
+    struct Submissions submissions;
+    struct Completions completions;
+    void* submissionRing;
+    size_t submissionRingSize;
+    void* completionRing; // same as submissionRing with IORING_FEAT_SINGLE_MMAP
+    size_t completionRingSize;
+    struct io_uring_sqe* submissionEntries;
+    size_t submissionEntriesSize;
+#endif
+
+    // fallback
+    struct SlotQueue local; // queued by this thread, handed to the threads on submit
+    struct SlotQueue pending;
+    struct SlotQueue completed;
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;
+    pthread_cond_t finished;
+    pthread_t threads[FALLBACK_THREADS];
+    int threadCount;
+    bool closing;
+};
+
+static void fail(const char* message) {
+    fprintf(stderr, "ERROR: %s\n", message);
+    exit(1);
+}
+
+static void pushSlot(struct SlotQueue* queue, int64_t depth, int64_t slot) {
+    queue->slots[(queue->start + queue->count) % depth] = slot;
+    queue->count++;
+}
+
+static int64_t popSlot(struct SlotQueue* queue, int64_t depth) {
+    int64_t slot = queue->slots[queue->start];
+    queue->start = (queue->start + 1) % depth;
+    queue->count--;
+    return slot;
+}
+
+static int64_t perform(struct Request* request) {
+    char* data = request->buffer->value;
+    ssize_t result;
+    if (request->reading) {
+        result = pread(request->descriptor, data, request->buffer->allocatedSize - 1, request->offset);
+    }
+    else {
+        result = pwrite(request->descriptor, data, request->buffer->usedSize, request->offset);
+    }
+    return result < 0 ? -errno : result;
+}
+
+static void* fallbackMain(void* argument) {
+    struct IoRing* ring = argument;
+    pthread_mutex_lock(&ring->lock);
+    for (;;) {
+        while (ring->pending.count == 0 && !ring->closing) {
+            pthread_cond_wait(&ring->submitted, &ring->lock);
+        }
+        if (ring->pending.count == 0) {
+            break;
+        }
+        int64_t slot = popSlot(&ring->pending, ring->depth);
+        pthread_mutex_unlock(&ring->lock);
+        int64_t result = perform(&ring->requests[slot]);
+        pthread_mutex_lock(&ring->lock);
+        ring->requests[slot].result = result;
+        pushSlot(&ring->completed, ring->depth, slot);
+        pthread_cond_signal(&ring->finished);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+static void startFallback(struct IoRing* ring) {
+    ring->usesIoUring = false;
+    ring->local.slots = malloc(ring->depth * sizeof(int64_t));
+    ring->pending.slots = malloc(ring->depth * sizeof(int64_t));
+    ring->completed.slots = malloc(ring->depth * sizeof(int64_t));
+    if (ring->local.slots == NULL || ring->pending.slots == NULL || ring->completed.slots == NULL) {
+        fail("Unable to allocate an IoRing.");
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->submitted, NULL);
+    pthread_cond_init(&ring->finished, NULL);
+    int threads = ring->depth < FALLBACK_THREADS ? (int) ring->depth : FALLBACK_THREADS;
+    for (int i=0; i<threads; i++) {
+        if (pthread_create(&ring->threads[ring->threadCount], NULL, fallbackMain, ring) == 0) {
+            ring->threadCount++;
+        }
+    }
+    if (ring->threadCount == 0) {
+        fail("Unable to start the threads of an IoRing.");
+    }
+}
+
+#if HAS_IO_URING
+static int enter(struct IoRing* ring, unsigned submitted, unsigned completions, unsigned flags) {
+    return syscall(__NR_io_uring_enter, ring->descriptor, submitted, completions, flags, NULL, 0);
+}
+
+static void* mapRing(int descriptor, size_t size, off_t offset) {
+    void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, descriptor, offset);
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+static bool startIoUring(struct IoRing* ring) {
+    struct io_uring_params parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    ring->descriptor = syscall(__NR_io_uring_setup, (unsigned) ring->depth, &parameters);
+    if (ring->descriptor < 0) {
+        return false;
+    }
+    ring->submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+    ring->completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMapping = parameters.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMapping && ring->completionRingSize > ring->submissionRingSize) {
+        ring->submissionRingSize = ring->completionRingSize;
+    }
+    ring->submissionRing = mapRing(ring->descriptor, ring->submissionRingSize, IORING_OFF_SQ_RING);
+    ring->completionRing = singleMapping ? ring->submissionRing : mapRing(ring->descriptor, ring->completionRingSize, IORING_OFF_CQ_RING);
+    ring->submissionEntriesSize = parameters.sq_entries * sizeof(struct io_uring_sqe);
+    ring->submissionEntries = mapRing(ring->descriptor, ring->submissionEntriesSize, IORING_OFF_SQES);
+    if (ring->submissionRing == NULL || ring->completionRing == NULL || ring->submissionEntries == NULL) {
+        close(ring->descriptor);
+        return false;
+    }
+
+    char* submissionRing = ring->submissionRing;
+    ring->submissions.head = (_Atomic unsigned*) (submissionRing + parameters.sq_off.head);
+    ring->submissions.tail = (_Atomic unsigned*) (submissionRing + parameters.sq_off.tail);
+    ring->submissions.mask = *(unsigned*) (submissionRing + parameters.sq_off.ring_mask);
+    ring->submissions.array = (unsigned*) (submissionRing + parameters.sq_off.array);
+    ring->submissions.entries = ring->submissionEntries;
+    char* completionRing = ring->completionRing;
+    ring->completions.head = (_Atomic unsigned*) (completionRing + parameters.cq_off.head);
+    ring->completions.tail = (_Atomic unsigned*) (completionRing + parameters.cq_off.tail);
+    ring->completions.mask = *(unsigned*) (completionRing + parameters.cq_off.ring_mask);
+    ring->completions.entries = (struct io_uring_cqe*) (completionRing + parameters.cq_off.cqes);
+    ring->usesIoUring = true;
+    return true;
+}
+
+static void queueIoUring(struct IoRing* ring, int64_t slot) {
+    struct Request* request = &ring->requests[slot];
+    unsigned tail = atomic_load_explicit(ring->submissions.tail, memory_order_relaxed);
+    unsigned index = tail & ring->submissions.mask;
+    struct io_uring_sqe* entry = &ring->submissions.entries[index];
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = request->descriptor;
+    entry->off = request->offset;
+    entry->user_data = slot;
+    request->vector.iov_base = request->buffer->value;
+    request->vector.iov_len = request->reading ? request->buffer->allocatedSize - 1 : request->buffer->usedSize;
+    entry->opcode = request->reading ? IORING_OP_READV : IORING_OP_WRITEV;
+    entry->addr = (uint64_t) (uintptr_t) &request->vector;
+    entry->len = 1;
+    // registered buffers skip pinning the pages on every request
+    for (int i=0; i<ring->registeredBufferCount; i++) {
+        if (ring->registeredBuffers[i].iov_base == request->buffer->value) {
+            entry->opcode = request->reading ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            entry->addr = (uint64_t) (uintptr_t) request->vector.iov_base;
+            entry->len = request->vector.iov_len;
+            entry->buf_index = i;
+            break;
+        }
+    }
+    ring->submissions.array[index] = index;
+    // the kernel reads the entry once it sees the new tail
+    atomic_store_explicit(ring->submissions.tail, tail + 1, memory_order_release);
+}
+
+static bool reapIoUring(struct IoRing* ring, int64_t* slot) {
+    unsigned head = atomic_load_explicit(ring->completions.head, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->completions.tail, memory_order_acquire)) {
+        return false;
+    }
+    struct io_uring_cqe* entry = &ring->completions.entries[head & ring->completions.mask];
+    *slot = entry->user_data;
+    ring->requests[*slot].result = entry->res;
+    atomic_store_explicit(ring->completions.head, head + 1, memory_order_release);
+    return true;
+}
+#else
+static bool startIoUring(struct IoRing* ring) {
+    return false;
+}
+#endif
+
+static void submitQueued(struct IoRing* ring) {
+    if (ring->queued == 0) {
+        return;
+    }
+#if HAS_IO_URING
+    if (ring->usesIoUring) {
+        while (ring->queued > 0) {
+            int submitted = enter(ring, ring->queued, 0, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                fail("Unable to submit I/O requests.");
+            }
+            ring->queued -= submitted;
+        }
+        return;
+    }
+#endif
+    pthread_mutex_lock(&ring->lock);
+    while (ring->local.count > 0) {
+        pushSlot(&ring->pending, ring->depth, popSlot(&ring->local, ring->depth));
+    }
+    pthread_cond_broadcast(&ring->submitted);
+    pthread_mutex_unlock(&ring->lock);
+    ring->queued = 0;
+}
+
+static bool reap(struct IoRing* ring, int64_t* slot) {
+#if HAS_IO_URING
+    if (ring->usesIoUring) {
+        return reapIoUring(ring, slot);
+    }
+#endif
+    pthread_mutex_lock(&ring->lock);
+    bool found = ring->completed.count > 0;
+    if (found) {
+        *slot = popSlot(&ring->completed, ring->depth);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return found;
+}
+
+static void blockForCompletion(struct IoRing* ring) {
+#if HAS_IO_URING
+    if (ring->usesIoUring) {
+        // EINTR just returns to the caller's loop
+        enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&ring->lock);
+    while (ring->completed.count == 0) {
+        pthread_cond_wait(&ring->finished, &ring->lock);
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// the id of the completed request, its slot can be reused
+static int64_t complete(struct IoRing* ring, int64_t slot) {
+    struct Request* request = &ring->requests[slot];
+    if (request->reading && request->result >= 0) {
+        request->buffer->usedSize = request->result;
+        request->buffer->value[request->result] = '\0';
+    }
+    request->inUse = false;
+    ring->inFlight--;
+    ring->lastResult = request->result;
+    return slot;
+}
+
+static int64_t queue(struct IoRing* ring, int64_t descriptor, struct String* buffer, int64_t offset, bool reading) {
+    if (ring->inFlight == ring->depth) {
+        return -1;
+    }
+    // writes only read the used bytes, so views and literals are fine there
+    if (reading && buffer->allocatedSize < 1) {
+        fail("aio can only read into buffers, not into String views or literals.");
+    }
+    int64_t slot = 0;
+    while (ring->requests[slot].inUse) {
+        slot++;
+    }
+    struct Request* request = &ring->requests[slot];
+    request->buffer = buffer;
+    request->descriptor = descriptor;
+    request->offset = offset;
+    request->reading = reading;
+    request->inUse = true;
+    request->result = 0;
+    ring->inFlight++;
+    ring->queued++;
+#if HAS_IO_URING
+    if (ring->usesIoUring) {
+        queueIoUring(ring, slot);
+        return slot;
+    }
+#endif
+    pushSlot(&ring->local, ring->depth, slot);
+    return slot;
+}
+
+// A ring with up to depth requests in flight.
+struct IoRing* IoRing_0_aio_1_open_2_Integer(int64_t depth) {
+    if (depth < 1 || depth > MAXIMUM_DEPTH) {
+        fprintf(stderr, "ERROR: An IoRing can't have a depth of %lld, it has to be 1 to %d.\n", (long long) depth, MAXIMUM_DEPTH);
+        exit(1);
+    }
+    struct IoRing* ring = calloc(1, sizeof(struct IoRing));
+    struct Request* requests = calloc(depth, sizeof(struct Request));
+    if (ring == NULL || requests == NULL) {
+        fail("Unable to allocate an IoRing.");
+    }
+    ring->requests = requests;
+    ring->depth = depth;
+    if (!startIoUring(ring)) {
+        startFallback(ring);
+    }
+    return ring;
+}
+
+// false if requests are run by the fallback threads
+bool Boolean_0_aio_1_usesIoUring_2_IoRing(struct IoRing* ring) {
+    return ring->usesIoUring;
+}
+
+// Waits for the requests in flight and releases the ring, buffers stay valid.
+void Void_0_aio_1_close_2_IoRing(struct IoRing* ring) {
+    submitQueued(ring);
+    int64_t slot;
+    while (ring->inFlight > 0) {
+        while (!reap(ring, &slot)) {
+            blockForCompletion(ring);
+        }
+        complete(ring, slot);
+    }
+#if HAS_IO_URING
+    if (ring->usesIoUring) {
+        munmap(ring->submissionEntries, ring->submissionEntriesSize);
+        if (ring->completionRing != ring->submissionRing) {
+            munmap(ring->completionRing, ring->completionRingSize);
+        }
+        munmap(ring->submissionRing, ring->submissionRingSize);
+        // also unregisters the buffers
+        close(ring->descriptor);
+    }
+#endif
+    if (!ring->usesIoUring) {
+        pthread_mutex_lock(&ring->lock);
+        ring->closing = true;
+        pthread_cond_broadcast(&ring->submitted);
+        pthread_mutex_unlock(&ring->lock);
+        for (int i=0; i<ring->threadCount; i++) {
+            pthread_join(ring->threads[i], NULL);
+        }
+        free(ring->local.slots);
+        free(ring->pending.slots);
+        free(ring->completed.slots);
+    }
+    free(ring->requests);
+    free(ring);
+}
+
+// An empty String that reads of up to size bytes go into, terminated after every read.
+struct String* String_0_aio_1_buffer_2_Integer(int64_t size) {
+    if (size < 1) {
+        fprintf(stderr, "ERROR: A buffer can't have a size of %lld.\n", (long long) size);
+        exit(1);
+    }
+    struct String* buffer = malloc(sizeof(struct String));
+    size_t allocatedSize = (size + 1 + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+    char* value = aligned_alloc(BUFFER_ALIGNMENT, allocatedSize);
+    if (buffer == NULL || value == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a buffer of %lld bytes.\n", (long long) size);
+        exit(1);
+    }
+    value[0] = '\0';
+    buffer->value = value;
+    buffer->allocatedSize = size + 1;
+    buffer->usedSize = 0;
+    buffer->owner = NULL;
+    return buffer;
+}
+
+// Registers the buffer with the kernel, which then doesn't pin its pages for every request. Only
+// possible while no requests are in flight. Returns its index, -1 if it couldn't be registered
+// (e.g. over RLIMIT_MEMLOCK), requests using it work regardless.
+int64_t Integer_0_aio_1_register_2_IoRing_2_String(struct IoRing* ring, struct String* buffer) {
+    if (ring->inFlight > 0) {
+        fail("Buffers can only be registered while no requests are in flight.");
+    }
+    if (buffer->allocatedSize < 1 || ring->registeredBufferCount == MAXIMUM_REGISTERED_BUFFERS) {
+        return -1;
+    }
+    int index = ring->registeredBufferCount;
+    ring->registeredBuffers[index].iov_base = buffer->value;
+    ring->registeredBuffers[index].iov_len = buffer->allocatedSize;
+#if HAS_IO_URING
+    if (ring->usesIoUring) {
+        // the whole table is registered at once
+        if (index > 0) {
+            syscall(__NR_io_uring_register, ring->descriptor, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        }
+        if (syscall(__NR_io_uring_register, ring->descriptor, IORING_REGISTER_BUFFERS, ring->registeredBuffers, index + 1) < 0) {
+            if (index > 0) {
+                syscall(__NR_io_uring_register, ring->descriptor, IORING_REGISTER_BUFFERS, ring->registeredBuffers, index);
+            }
+            return -1;
+        }
+    }
+#endif
+    ring->registeredBufferCount++;
+    return index;
+}
+
+// Queues a read of up to the buffer's size at offset, returns the id of the request or -1 if depth
+// requests are in flight already.
+int64_t Integer_0_aio_1_read_2_IoRing_2_Integer_2_String_2_Integer(struct IoRing* ring, int64_t descriptor, struct String* buffer, int64_t offset) {
+    return queue(ring, descriptor, buffer, offset, true);
+}
+
+// Queues a write of the buffer's usedSize bytes at offset, like read.
+int64_t Integer_0_aio_1_write_2_IoRing_2_Integer_2_String_2_Integer(struct IoRing* ring, int64_t descriptor, struct String* buffer, int64_t offset) {
+    return queue(ring, descriptor, buffer, offset, false);
+}
+
+// Starts the queued requests with a single system call, returns how many there were.
+int64_t Integer_0_aio_1_submit_2_IoRing(struct IoRing* ring) {
+    int64_t queued = ring->queued;
+    submitQueued(ring);
+    return queued;
+}
+
+// Submits queued requests and returns the id of a completed one, -1 if none are in flight.
+int64_t Integer_0_aio_1_wait_2_IoRing(struct IoRing* ring) {
+    if (ring->inFlight == 0) {
+        return -1;
+    }
+    submitQueued(ring);
+    int64_t slot;
+    while (!reap(ring, &slot)) {
+        // the I/O doesn't need this thread, run the pool's tasks meanwhile
+        if (oolong_scheduler_run_task()) {
+            continue;
+        }
+        oolong_scheduler_blocking();
+        blockForCompletion(ring);
+    }
+    return complete(ring, slot);
+}
+
+// Like wait, -1 right away if no request completed yet.
+int64_t Integer_0_aio_1_poll_2_IoRing(struct IoRing* ring) {
+    submitQueued(ring);
+    int64_t slot;
+    return reap(ring, &slot) ? complete(ring, slot) : -1;
+}
+
+// Bytes read or written by the request last returned by wait or poll, -errno if it failed.
+int64_t Integer_0_aio_1_result_2_IoRing(struct IoRing* ring) {
+    return ring->lastResult;
+}
+
+// File descriptors for the requests, -1 if the file can't be opened. path must be terminated.
+int64_t Integer_0_aio_1_openFile_2_String(struct String* path) {
+    return open(path->value, O_RDONLY | O_CLOEXEC);
+}
+
+int64_t Integer_0_aio_1_createFile_2_String(struct String* path) {
+    return open(path->value, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+int64_t Integer_0_aio_1_fileSize_2_Integer(int64_t descriptor) {
+    off_t size = lseek(descriptor, 0, SEEK_END);
+    return size < 0 ? -1 : size;
+}
+
+void Void_0_aio_1_closeFile_2_Integer(int64_t descriptor) {
+    close(descriptor);
+}
@@ -0,0 +1,196 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Shared state between threads: storage for Atomic<T> (the operations are
+// generated inline by atomics.cpp) and Queue, a bounded lock-free
+// multi-producer multi-consumer queue of Integers.
+//
+// Queue is a ring (also used by Channels) after Dmitry Vyukov's bounded MPMC
+// queue: every cell carries a sequence number telling producers and consumers
+// whose turn it is, so each side only contends on its own position counter
+// and never takes a lock.
+
+#include "oolong-module.h"
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAUSE() _mm_pause()
+#else
+#define PAUSE() sched_yield()
+#endif
+
+#define CACHE_LINE_SIZE 64
+#define MINIMUM_CAPACITY 2
+#define SPINS_BEFORE_YIELD 64
+
+// an Atomic gets a cache line of its own, so unrelated atomics don't slow each other down
+void* oolong_atomic_new() {
+    void* atomic = aligned_alloc(CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+    if (atomic == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate an Atomic.\n");
+        exit(1);
+    }
+    memset(atomic, 0, CACHE_LINE_SIZE);
+    return atomic;
+}
+
+// sequence numbers start at the index of their cell: free for the producer of round 0
+void oolong_ring_initialize(struct OolongRing* ring, int64_t capacity) {
+    // with a single cell "consumed in round n" and "free in round n + 1" would be the same sequence number
+    int64_t roundedCapacity = MINIMUM_CAPACITY;
+    while (roundedCapacity < capacity) {
+        roundedCapacity *= 2;
+    }
+    ring->cells = malloc(roundedCapacity * sizeof(struct OolongRingCell));
+    if (ring->cells == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate room for %lld values.\n", (long long) capacity);
+        exit(1);
+    }
+    ring->mask = roundedCapacity - 1;
+    for (int64_t i=0; i<roundedCapacity; i++) {
+        atomic_init(&ring->cells[i].sequence, i);
+    }
+    atomic_init(&ring->enqueuePosition, 0);
+    atomic_init(&ring->dequeuePosition, 0);
+}
+
+bool oolong_ring_enqueue(struct OolongRing* ring, int64_t value, int64_t* enqueuedPosition) {
+    int64_t position = atomic_load_explicit(&ring->enqueuePosition, memory_order_relaxed);
+    struct OolongRingCell* cell;
+    for (;;) {
+        cell = &ring->cells[position & ring->mask];
+        int64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int64_t difference = sequence - position;
+        if (difference == 0) {
+            // cell is free for this position, claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueuePosition, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            // the consumer of the previous round hasn't taken the value yet: full
+            return false;
+        }
+        else {
+            position = atomic_load_explicit(&ring->enqueuePosition, memory_order_relaxed);
+        }
+    }
+    cell->value = value;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    if (enqueuedPosition != NULL) {
+        *enqueuedPosition = position;
+    }
+    return true;
+}
+
+bool oolong_ring_dequeue(struct OolongRing* ring, int64_t* value) {
+    int64_t position = atomic_load_explicit(&ring->dequeuePosition, memory_order_relaxed);
+    struct OolongRingCell* cell;
+    for (;;) {
+        cell = &ring->cells[position & ring->mask];
+        int64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int64_t difference = sequence - (position + 1);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeuePosition, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            // nothing produced for this position yet: empty
+            return false;
+        }
+        else {
+            position = atomic_load_explicit(&ring->dequeuePosition, memory_order_relaxed);
+        }
+    }
+    *value = cell->value;
+    // free for the producer of the next round
+    atomic_store_explicit(&cell->sequence, position + ring->mask + 1, memory_order_release);
+    return true;
+}
+
+// number of values, only a snapshot while other threads use the ring
+int64_t oolong_ring_size(struct OolongRing* ring) {
+    int64_t size = atomic_load_explicit(&ring->enqueuePosition, memory_order_relaxed)
+                 - atomic_load_explicit(&ring->dequeuePosition, memory_order_relaxed);
+    return size < 0 ? 0 : size;
+}
+
+// The value a put or take waits for might come from a task queued on the same worker, so waiting
+// threads run queued tasks. Once there's nothing to run, a helper looks for tasks queued meanwhile.
+static void backOff(int* spins) {
+    if (oolong_scheduler_run_task()) {
+        *spins = 0;
+        return;
+    }
+    if (++*spins < SPINS_BEFORE_YIELD) {
+        PAUSE();
+        return;
+    }
+    if (*spins == SPINS_BEFORE_YIELD) {
+        oolong_scheduler_blocking();
+    }
+    sched_yield();
+}
+
+struct Queue {
+    struct OolongRing ring;
+};
+
+// Queue with room for at least capacity values
+struct Queue* Queue_0_newQueue_2_Integer(int64_t capacity) {
+    struct Queue* queue = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct Queue));
+    if (queue == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a Queue of %lld values.\n", (long long) capacity);
+        exit(1);
+    }
+    oolong_ring_initialize(&queue->ring, capacity);
+    return queue;
+}
+
+// false if the Queue is full
+bool Boolean_0_offer_2_Queue_2_Integer(struct Queue* queue, int64_t value) {
+    return oolong_ring_enqueue(&queue->ring, value, NULL);
+}
+
+// waits while the Queue is full
+void Void_0_put_2_Queue_2_Integer(struct Queue* queue, int64_t value) {
+    int spins = 0;
+    while (!oolong_ring_enqueue(&queue->ring, value, NULL)) {
+        backOff(&spins);
+    }
+}
+
+// waits while the Queue is empty
+int64_t Integer_0_take_2_Queue(struct Queue* queue) {
+    int64_t value;
+    int spins = 0;
+    while (!oolong_ring_dequeue(&queue->ring, &value)) {
+        backOff(&spins);
+    }
+    return value;
+}
+
+// number of values, only a snapshot while other threads use the Queue
+int64_t Integer_0_size_2_Queue(struct Queue* queue) {
+    return oolong_ring_size(&queue->ring);
+}
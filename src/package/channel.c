@@ -0,0 +1,260 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Channel<T>, the compiler converts every value to 64 bits (channels.cpp).
+//
+// Values go through a lock-free ring (atomic.c), so as long as a buffered
+// channel has room and values, send and receive are a single compare and
+// swap. Threads that can't proceed spin briefly and then park on a futex:
+// every channel has one event for "a value arrived" and one for "room was
+// made", an event is a sequence number that is bumped after the change and
+// only costs a system call when somebody is parked on it.
+//
+// Senders of an unbuffered channel additionally wait until their value was
+// received, the ring itself has the minimum capacity.
+//
+// Workers of the thread pool (spawn, parallel for) that park hand their
+// queued tasks to a helper thread (scheduler.c), the other end of the
+// channel might be one of them.
+//
+// select waits on a process wide event that every send bumps while a select
+// is parked, since a futex can only wait on a single word.
+
+#include "oolong-module.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAUSE() _mm_pause()
+#else
+#define PAUSE() sched_yield()
+#endif
+
+#define CACHE_LINE_SIZE 64
+#define SPINS_BEFORE_PARKING 128
+
+struct Event {
+    _Atomic uint32_t sequence;
+    _Atomic int32_t waiters;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct Channel {
+    struct OolongRing ring;
+    struct Event received; // room was made
+    struct Event sent; // a value arrived or the channel was closed
+    bool unbuffered;
+    _Atomic bool closed;
+};
+
+static struct Event selectEvent;
+
+static void park(struct Event* event, uint32_t sequence) {
+    syscall(SYS_futex, &event->sequence, FUTEX_WAIT_PRIVATE, sequence, NULL, NULL, 0);
+}
+
+// after the change the waiters are looking for, pairs with beginWaiting
+static void notify(struct Event* event) {
+    atomic_fetch_add(&event->sequence, 1);
+    if (atomic_load(&event->waiters) > 0) {
+        syscall(SYS_futex, &event->sequence, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Waiting is beginWaiting, checking the condition once more and park(event, sequence): a change
+// after beginWaiting bumps the sequence, which makes the wait return right away.
+static uint32_t beginWaiting(struct Event* event) {
+    oolong_scheduler_blocking();
+    atomic_fetch_add(&event->waiters, 1);
+    return atomic_load(&event->sequence);
+}
+
+static void endWaiting(struct Event* event) {
+    atomic_fetch_sub(&event->waiters, 1);
+}
+
+// threads spin for a while before they park
+static bool keepSpinning(int* spins) {
+    if (*spins < SPINS_BEFORE_PARKING) {
+        PAUSE();
+        return true;
+    }
+    return false;
+}
+
+static void signalSent(struct Channel* channel) {
+    notify(&channel->sent);
+    if (atomic_load(&selectEvent.waiters) > 0) {
+        notify(&selectEvent);
+    }
+}
+
+struct Channel* oolong_channel_new(int64_t capacity) {
+    if (capacity < 0) {
+        fprintf(stderr, "ERROR: A Channel can't have a capacity of %lld.\n", (long long) capacity);
+        exit(1);
+    }
+    struct Channel* channel = aligned_alloc(CACHE_LINE_SIZE, sizeof(struct Channel));
+    if (channel == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a Channel of %lld values.\n", (long long) capacity);
+        exit(1);
+    }
+    memset(channel, 0, sizeof(struct Channel));
+    oolong_ring_initialize(&channel->ring, capacity);
+    channel->unbuffered = capacity == 0;
+    return channel;
+}
+
+static bool trySend(struct Channel* channel, int64_t value, int64_t* position) {
+    if (atomic_load_explicit(&channel->closed, memory_order_relaxed)) {
+        fprintf(stderr, "ERROR: Sending to a closed Channel.\n");
+        exit(1);
+    }
+    if (!oolong_ring_enqueue(&channel->ring, value, position)) {
+        return false;
+    }
+    signalSent(channel);
+    return true;
+}
+
+static bool tryReceive(struct Channel* channel, int64_t* value) {
+    if (!oolong_ring_dequeue(&channel->ring, value)) {
+        return false;
+    }
+    notify(&channel->received);
+    return true;
+}
+
+static bool isReceived(struct Channel* channel, int64_t position) {
+    return atomic_load(&channel->ring.dequeuePosition) > position;
+}
+
+static bool isClosedAndEmpty(struct Channel* channel) {
+    return atomic_load(&channel->closed) && oolong_ring_size(&channel->ring) == 0;
+}
+
+void oolong_channel_send(struct Channel* channel, int64_t value) {
+    int64_t position;
+    for (int spins = 0; !trySend(channel, value, &position); spins++) {
+        if (keepSpinning(&spins)) {
+            continue;
+        }
+        uint32_t sequence = beginWaiting(&channel->received);
+        if (!trySend(channel, value, &position)) {
+            park(&channel->received, sequence);
+            endWaiting(&channel->received);
+            continue;
+        }
+        endWaiting(&channel->received);
+        break;
+    }
+    if (!channel->unbuffered) {
+        return;
+    }
+    // rendezvous, the receiver bumps received after taking the value
+    for (int spins = 0; !isReceived(channel, position); spins++) {
+        if (keepSpinning(&spins)) {
+            continue;
+        }
+        uint32_t sequence = beginWaiting(&channel->received);
+        if (!isReceived(channel, position)) {
+            park(&channel->received, sequence);
+        }
+        endWaiting(&channel->received);
+    }
+}
+
+// false once the channel is closed and every value was received
+bool oolong_channel_receive(struct Channel* channel, int64_t* value) {
+    for (int spins = 0; ; spins++) {
+        if (tryReceive(channel, value)) {
+            return true;
+        }
+        if (isClosedAndEmpty(channel)) {
+            // a value sent just before closing might still be in flight
+            return tryReceive(channel, value);
+        }
+        if (keepSpinning(&spins)) {
+            continue;
+        }
+        uint32_t sequence = beginWaiting(&channel->sent);
+        if (tryReceive(channel, value)) {
+            endWaiting(&channel->sent);
+            return true;
+        }
+        if (!isClosedAndEmpty(channel)) {
+            park(&channel->sent, sequence);
+        }
+        endWaiting(&channel->sent);
+    }
+}
+
+// index of the first channel something was received from, -1 if none, open is false if all are closed and empty
+static int64_t trySelect(struct Channel** channels, int64_t count, int64_t first, int64_t* value, bool* open) {
+    *open = false;
+    for (int64_t i=0; i<count; i++) {
+        int64_t index = (first + i) % count;
+        if (tryReceive(channels[index], value)) {
+            return index;
+        }
+        *open = *open || !isClosedAndEmpty(channels[index]);
+    }
+    return -1;
+}
+
+// Receives from the first of count channels that has a value, starting at a different channel
+// every time so a busy channel can't starve the others. Returns the index of the channel, or -1
+// once all of them are closed and empty.
+int64_t oolong_channel_select(struct Channel** channels, int64_t count, int64_t* value) {
+    static _Atomic uint32_t rotation = 0;
+    int64_t first = count > 0 ? atomic_fetch_add_explicit(&rotation, 1, memory_order_relaxed) % count : 0;
+    bool open;
+    for (int spins = 0; ; spins++) {
+        int64_t index = trySelect(channels, count, first, value, &open);
+        if (index >= 0) {
+            return index;
+        }
+        if (!open) {
+            // values sent just before closing might still have been in flight
+            return trySelect(channels, count, first, value, &open);
+        }
+        if (keepSpinning(&spins)) {
+            continue;
+        }
+        uint32_t sequence = beginWaiting(&selectEvent);
+        index = trySelect(channels, count, first, value, &open);
+        if (index < 0 && open) {
+            park(&selectEvent, sequence);
+        }
+        endWaiting(&selectEvent);
+        if (index >= 0) {
+            return index;
+        }
+    }
+}
+
+void oolong_channel_close(struct Channel* channel) {
+    atomic_store(&channel->closed, true);
+    signalSent(channel);
+}
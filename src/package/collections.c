@@ -0,0 +1,98 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runtime side of Array<T> and List<T>: allocation and growth. Element access,
+// length and size are generated inline by the compiler (collections.cpp), which
+// relies on the layout of the headers below.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINIMUM_CAPACITY 8
+
+struct Array {
+    void* data;
+    int64_t size;
+};
+
+struct List {
+    void* data;
+    int64_t size;
+    int64_t capacity;
+};
+
+static void outOfMemory(int64_t size, int64_t elementSize) {
+    fprintf(stderr, "ERROR: Unable to allocate %lld elements of %lld bytes.\n", (long long) size, (long long) elementSize);
+    exit(1);
+}
+
+// Header and zeroed elements in one allocation, the elements directly follow the header.
+void* oolong_array_new(int64_t size, int64_t elementSize) {
+    if (size < 0) {
+        fprintf(stderr, "ERROR: Invalid Array size %lld.\n", (long long) size);
+        exit(1);
+    }
+    if (size > (INT64_MAX - (int64_t) sizeof(struct Array)) / elementSize) {
+        outOfMemory(size, elementSize);
+    }
+    struct Array* array = calloc(1, sizeof(struct Array) + size * elementSize);
+    if (array == NULL) {
+        outOfMemory(size, elementSize);
+    }
+    array->data = array + 1;
+    array->size = size;
+    return array;
+}
+
+void oolong_list_reserve(struct List* list, int64_t capacity, int64_t elementSize) {
+    if (capacity <= list->capacity) {
+        return;
+    }
+    // grow geometrically, so adding n elements one by one copies O(n) elements in total
+    int64_t newCapacity = list->capacity < MINIMUM_CAPACITY ? MINIMUM_CAPACITY : list->capacity;
+    while (newCapacity < capacity) {
+        newCapacity *= 2;
+    }
+    if (newCapacity > INT64_MAX / elementSize) {
+        outOfMemory(newCapacity, elementSize);
+    }
+    void* data = realloc(list->data, newCapacity * elementSize);
+    if (data == NULL) {
+        outOfMemory(newCapacity, elementSize);
+    }
+    list->data = data;
+    list->capacity = newCapacity;
+}
+
+void* oolong_list_new(int64_t capacity, int64_t elementSize) {
+    struct List* list = calloc(1, sizeof(struct List));
+    if (list == NULL) {
+        outOfMemory(1, sizeof(struct List));
+    }
+    if (capacity > 0) {
+        oolong_list_reserve(list, capacity, elementSize);
+    }
+    return list;
+}
+
+// Called by the bounds check of generated code, indices are never negative or beyond the size.
+void oolong_index_out_of_bounds(int64_t index, int64_t size) {
+    fprintf(stderr, "ERROR: Index %lld is out of bounds for size %lld.\n", (long long) index, (long long) size);
+    exit(1);
+}
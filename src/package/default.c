@@ -19,56 +19,35 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
-#include <stdio.h>
-#include <math.h>
 
-static struct String* auto_lltoa(const long long value) {
-    int size = (int) ceil(log10(value)); // size in decimal
-    size++; // account for null terminator
-
-    struct String* string = malloc(sizeof(struct String));
+// header and characters in a single allocation
+static struct String* newString(const char* characters, int length) {
+    struct String* string = malloc(sizeof(struct String) + length + 1);
     if (string == NULL) {
         // TODO: print error?
         return NULL;
     }
-
-    char* str = malloc(size);
-    if (str == NULL) {
-        // TODO: print error?
-        return NULL;
-    }
-
-    snprintf(str, size, "%lld", value);
-
-    string->value = str;
-    string->allocatedSize = size;
-    string->usedSize = size-1;
+    string->value = (char*) (string + 1);
+    memcpy(string->value, characters, length + 1);
+    string->allocatedSize = length + 1;
+    string->usedSize = length;
+    string->owner = NULL;
     return string;
 }
 
-static struct String* auto_ftoa(const double value) {
-    // using snprintf to determine size, could probably be more efficient
-    int size = snprintf(NULL, 0, "%f", value);
-    size++; // account for null terminator
-
-    struct String* string = malloc(sizeof(struct String));
-    if (string == NULL) {
-        // TODO: print error?
-        return NULL;
+// storage of the destination that any number can be formatted into, only allocated if it is too small or not owned
+static char* numberStorage(struct String* destination) {
+    if (destination->allocatedSize < OOLONG_NUMBER_BUFFER_SIZE) {
+        char* storage = malloc(OOLONG_NUMBER_BUFFER_SIZE);
+        if (storage == NULL) {
+            // TODO: print error?
+            return NULL;
+        }
+        destination->value = storage;
+        destination->allocatedSize = OOLONG_NUMBER_BUFFER_SIZE;
+        destination->owner = NULL;
     }
-
-    char* str = malloc(size);
-    if (str == NULL) {
-        // TODO: print error?
-        return NULL;
-    }
-
-    snprintf(str, size, "%f", value);
-
-    string->value = str;
-    string->allocatedSize = size;
-    string->usedSize = size-1;
-    return string;
+    return destination->value;
 }
 
 // Boolean
@@ -85,7 +64,8 @@ bool Boolean_0_toBoolean_2_Double(double value) {
 }
 
 bool Boolean_0_toBoolean_2_String(struct String* value) {
-    return (strcmp(value->value, "true") == 0);
+    // String views are not terminated, compare by size
+    return value->usedSize == 4 && memcmp(value->value, "true", 4) == 0;
 }
 
 // Integer
@@ -101,8 +81,21 @@ long long Integer_0_toInteger_2_Double(double value) {
     return (long long) value;
 }
 
+// 0 if value is not an Integer, see isInteger and toInteger(value, fallback)
 long long Integer_0_toInteger_2_String(struct String* value) {
-    return atoll(value->value);
+    int64_t result = 0;
+    oolong_parse_integer(value->value, value->usedSize, &result);
+    return result;
+}
+
+long long Integer_0_toInteger_2_String_2_Integer(struct String* value, long long fallback) {
+    int64_t result;
+    return oolong_parse_integer(value->value, value->usedSize, &result) ? result : fallback;
+}
+
+bool Boolean_0_isInteger_2_String(struct String* value) {
+    int64_t result;
+    return oolong_parse_integer(value->value, value->usedSize, &result);
 }
 
 // Double
@@ -118,8 +111,21 @@ double Double_0_toDouble_2_Integer(long long value) {
     return (double) value;
 }
 
+// 0.0 if value is not a Double, see isDouble and toDouble(value, fallback)
 double Double_0_toDouble_2_String(struct String* value) {
-    return atof(value->value);
+    double result = 0.0;
+    oolong_parse_double(value->value, value->usedSize, &result);
+    return result;
+}
+
+double Double_0_toDouble_2_String_2_Double(struct String* value, double fallback) {
+    double result;
+    return oolong_parse_double(value->value, value->usedSize, &result) ? result : fallback;
+}
+
+bool Boolean_0_isDouble_2_String(struct String* value) {
+    double result;
+    return oolong_parse_double(value->value, value->usedSize, &result);
 }
 
 // String
@@ -133,23 +139,46 @@ struct String* String_0_toString_2_Boolean(bool value) {
         // TODO: print error?
         return NULL;
     }
+    // constant storage, not owned by the String
+    string->owner = NULL;
     if (value) {
         string->value = "true";
-        string->allocatedSize = 5;
+        string->allocatedSize = 0;
         string->usedSize = 4;
     } else {
         string->value = "false";
-        string->allocatedSize = 6;
+        string->allocatedSize = 0;
         string->usedSize = 5;
     }
     return string;
 }
 
 struct String* String_0_toString_2_Integer(long long value) {
-    return auto_lltoa(value);
+    char buffer[OOLONG_NUMBER_BUFFER_SIZE];
+    return newString(buffer, oolong_format_integer(buffer, value));
 }
 
 struct String* String_0_toString_2_Double(double value) {
-    return auto_ftoa(value);
+    char buffer[OOLONG_NUMBER_BUFFER_SIZE];
+    return newString(buffer, oolong_format_double(buffer, value));
+}
+
+// Conversions into an existing String, e.g. toString(value, buffer) in a loop, reuse its storage instead of allocating.
+struct String* String_0_toString_2_Integer_2_String(long long value, struct String* destination) {
+    char* storage = numberStorage(destination);
+    if (storage == NULL) {
+        return NULL;
+    }
+    destination->usedSize = oolong_format_integer(storage, value);
+    return destination;
+}
+
+struct String* String_0_toString_2_Double_2_String(double value, struct String* destination) {
+    char* storage = numberStorage(destination);
+    if (storage == NULL) {
+        return NULL;
+    }
+    destination->usedSize = oolong_format_double(storage, value);
+    return destination;
 }
 
@@ -0,0 +1,131 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// io.File: read-only memory mapped files. Lines and fields are returned as
+// String views into the mapping (allocatedSize 0), so scanning a file does not
+// copy or allocate. Views stay valid until the file is closed.
+
+#include "oolong-module.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct File {
+    char* data;
+    int64_t size; // -1 if the file could not be opened
+    int64_t position; // start of the next line
+};
+
+struct File* File_0_io_1_File_1_open_2_String(struct String* path) {
+    struct File* file = malloc(sizeof(struct File));
+    if (file == NULL) {
+        return NULL;
+    }
+    file->data = NULL;
+    file->size = -1;
+    file->position = 0;
+
+    // open needs a terminated path, views aren't
+    char* terminatedPath = malloc(path->usedSize + 1);
+    if (terminatedPath == NULL) {
+        return file;
+    }
+    memcpy(terminatedPath, path->value, path->usedSize);
+    terminatedPath[path->usedSize] = '\0';
+    int descriptor = open(terminatedPath, O_RDONLY);
+    free(terminatedPath);
+    if (descriptor < 0) {
+        return file;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        return file;
+    }
+    if (status.st_size > 0) {
+        void* data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (data == MAP_FAILED) {
+            close(descriptor);
+            return file;
+        }
+        // read ahead aggressively and drop pages behind the reader
+        madvise(data, status.st_size, MADV_SEQUENTIAL);
+        madvise(data, status.st_size, MADV_WILLNEED);
+        file->data = data;
+    }
+    // the mapping keeps the file contents available
+    close(descriptor);
+    file->size = status.st_size;
+    return file;
+}
+
+bool Boolean_0_io_1_File_1_isOpen_2_File(struct File* file) {
+    return file != NULL && file->size >= 0;
+}
+
+int64_t Integer_0_io_1_File_1_size_2_File(struct File* file) {
+    return file->size;
+}
+
+// The file can't be used afterwards, like the views of its lines.
+void Void_0_io_1_File_1_close_2_File(struct File* file) {
+    if (file->data != NULL) {
+        munmap(file->data, file->size);
+    }
+    free(file);
+}
+
+bool Boolean_0_io_1_File_1_hasNextLine_2_File(struct File* file) {
+    return file->position < file->size;
+}
+
+// Sets line to a view of the next line without its line break, false at the end of the file.
+bool Boolean_0_io_1_File_1_readLine_2_File_2_String(struct File* file, struct String* line) {
+    if (file->position >= file->size) {
+        oolong_set_view(line, NULL, "", 0);
+        return false;
+    }
+    char* start = file->data + file->position;
+    int64_t remaining = file->size - file->position;
+    char* newline = memchr(start, '\n', remaining);
+    int64_t length = newline == NULL ? remaining : newline - start;
+    file->position += newline == NULL ? length : length + 1;
+    if (length > 0 && start[length - 1] == '\r') {
+        length--;
+    }
+    oolong_set_view(line, NULL, start, length);
+    return true;
+}
+
+// Like readLine, with a new String header for the view (the characters are not copied).
+struct String* String_0_io_1_File_1_nextLine_2_File(struct File* file) {
+    struct String* line = malloc(sizeof(struct String));
+    if (line == NULL) {
+        return NULL;
+    }
+    Boolean_0_io_1_File_1_readLine_2_File_2_String(file, line);
+    return line;
+}
+
+// Same as split(line, field, separator), kept next to readLine for discoverability.
+bool Boolean_0_io_1_File_1_readField_2_String_2_String_2_String(struct String* line, struct String* field, struct String* separator) {
+    return oolong_split(line, field, separator);
+}
@@ -0,0 +1,328 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Number formatting kernels shared by the packages. They write into a caller
+// supplied buffer of at least OOLONG_NUMBER_BUFFER_SIZE bytes and never allocate.
+
+#include "oolong-module.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Doubles are converted to the shortest digit string that reads back as the
+// same value with Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers", PLDI 2010). Grisu2 always round
+// trips and is shortest for almost all values.
+
+// a floating point number significand * 2^exponent with a 64 bit significand
+struct DiyFp {
+    uint64_t significand;
+    int exponent;
+};
+
+#define DOUBLE_SIGNIFICAND_SIZE 52
+#define DOUBLE_EXPONENT_BIAS (0x3FF + DOUBLE_SIGNIFICAND_SIZE)
+#define DOUBLE_HIDDEN_BIT UINT64_C(0x0010000000000000)
+#define DOUBLE_SIGNIFICAND_MASK UINT64_C(0x000FFFFFFFFFFFFF)
+#define DOUBLE_EXPONENT_MASK UINT64_C(0x7FF0000000000000)
+#define DIY_SIGNIFICAND_SIZE 64
+// outside [10^-5, 10^16) doubles are written in scientific notation
+#define MINIMUM_FIXED_EXPONENT -4
+#define MAXIMUM_FIXED_EXPONENT 16
+
+// normalized 10^k for k = -348, -340, ..., 340
+static const uint64_t CACHED_POWER_SIGNIFICANDS[] = {
+    UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76), UINT64_C(0x8b16fb203055ac76),
+    UINT64_C(0xcf42894a5dce35ea), UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+    UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f), UINT64_C(0xbe5691ef416bd60c),
+    UINT64_C(0x8dd01fad907ffc3c), UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+    UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d), UINT64_C(0x823c12795db6ce57),
+    UINT64_C(0xc21094364dfb5637), UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+    UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5), UINT64_C(0xb23867fb2a35b28e),
+    UINT64_C(0x84c8d4dfd2c63f3b), UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+    UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6), UINT64_C(0xf3e2f893dec3f126),
+    UINT64_C(0xb5b5ada8aaff80b8), UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+    UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd), UINT64_C(0xa6dfbd9fb8e5b88f),
+    UINT64_C(0xf8a95fcf88747d94), UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+    UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac), UINT64_C(0xe45c10c42a2b3b06),
+    UINT64_C(0xaa242499697392d3), UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+    UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c), UINT64_C(0x9c40000000000000),
+    UINT64_C(0xe8d4a51000000000), UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+    UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70), UINT64_C(0xd5d238a4abe98068),
+    UINT64_C(0x9f4f2726179a2245), UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+    UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a), UINT64_C(0x924d692ca61be758),
+    UINT64_C(0xda01ee641a708dea), UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+    UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2), UINT64_C(0xc83553c5c8965d3d),
+    UINT64_C(0x952ab45cfa97a0b3), UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+    UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece), UINT64_C(0x88fcf317f22241e2),
+    UINT64_C(0xcc20ce9bd35c78a5), UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+    UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c), UINT64_C(0xbb764c4ca7a44410),
+    UINT64_C(0x8bab8eefb6409c1a), UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+    UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429), UINT64_C(0x80444b5e7aa7cf85),
+    UINT64_C(0xbf21e44003acdd2d), UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+    UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9), UINT64_C(0xaf87023b9bf0ee6b)
+};
+
+static const int16_t CACHED_POWER_EXPONENTS[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint32_t POWERS_OF_TEN[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+static struct DiyFp diyFp(uint64_t significand, int exponent) {
+    struct DiyFp value = { significand, exponent };
+    return value;
+}
+
+static struct DiyFp fromDouble(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biasedExponent = (int) ((bits & DOUBLE_EXPONENT_MASK) >> DOUBLE_SIGNIFICAND_SIZE);
+    uint64_t significand = bits & DOUBLE_SIGNIFICAND_MASK;
+    if (biasedExponent != 0) {
+        return diyFp(significand + DOUBLE_HIDDEN_BIT, biasedExponent - DOUBLE_EXPONENT_BIAS);
+    }
+    // subnormal
+    return diyFp(significand, 1 - DOUBLE_EXPONENT_BIAS);
+}
+
+static struct DiyFp normalize(struct DiyFp value) {
+    while (!(value.significand & (UINT64_C(1) << 63))) {
+        value.significand <<= 1;
+        value.exponent--;
+    }
+    return value;
+}
+
+// product rounded to 64 bits
+static struct DiyFp multiply(struct DiyFp left, struct DiyFp right) {
+    unsigned __int128 product = (unsigned __int128) left.significand * right.significand;
+    uint64_t high = (uint64_t) (product >> 64);
+    uint64_t low = (uint64_t) product;
+    if (low & (UINT64_C(1) << 63)) {
+        high++;
+    }
+    return diyFp(high, left.exponent + right.exponent + DIY_SIGNIFICAND_SIZE);
+}
+
+// the boundaries of the interval of reals that round to value, with the exponent of the upper boundary
+static void normalizedBoundaries(struct DiyFp value, struct DiyFp* minus, struct DiyFp* plus) {
+    *plus = normalize(diyFp((value.significand << 1) + 1, value.exponent - 1));
+    if (value.significand == DOUBLE_HIDDEN_BIT) {
+        // the lower neighbour is closer at powers of two
+        *minus = diyFp((value.significand << 2) - 1, value.exponent - 2);
+    }
+    else {
+        *minus = diyFp((value.significand << 1) - 1, value.exponent - 1);
+    }
+    minus->significand <<= minus->exponent - plus->exponent;
+    minus->exponent = plus->exponent;
+}
+
+// a cached 10^-k so that the product with a value of the given binary exponent has an exponent in [-60, -32]
+static struct DiyFp cachedPower(int exponent, int* k) {
+    double approximateK = (-61 - exponent) * 0.30102999566398114 + 347; // 1/log2(10)
+    int roundedK = (int) approximateK;
+    if (roundedK != approximateK) {
+        roundedK++;
+    }
+    unsigned index = (unsigned) ((roundedK >> 3) + 1);
+    *k = -(-348 + (int) (index << 3));
+    return diyFp(CACHED_POWER_SIGNIFICANDS[index], CACHED_POWER_EXPONENTS[index]);
+}
+
+static unsigned countDecimalDigits(uint32_t value) {
+    unsigned digits = 1;
+    while (digits < 10 && value >= POWERS_OF_TEN[digits]) {
+        digits++;
+    }
+    return digits;
+}
+
+// move the last digit towards the exact value while it stays inside the rounding interval
+static void roundWeed(char* digits, int length, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance) {
+    while (rest < distance && delta - rest >= tenKappa &&
+            (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+        digits[length - 1]--;
+        rest += tenKappa;
+    }
+}
+
+static int generateDigits(struct DiyFp value, struct DiyFp upper, uint64_t delta, char* digits, int* k) {
+    const struct DiyFp one = diyFp(UINT64_C(1) << -upper.exponent, upper.exponent);
+    const uint64_t distance = upper.significand - value.significand;
+    uint32_t integral = (uint32_t) (upper.significand >> -one.exponent);
+    uint64_t fractional = upper.significand & (one.significand - 1);
+    int kappa = (int) countDecimalDigits(integral);
+    int length = 0;
+
+    while (kappa > 0) {
+        uint32_t digit = integral / POWERS_OF_TEN[kappa - 1];
+        integral %= POWERS_OF_TEN[kappa - 1];
+        if (digit != 0 || length != 0) {
+            digits[length++] = (char) ('0' + digit);
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t) integral << -one.exponent) + fractional;
+        if (rest <= delta) {
+            *k += kappa;
+            roundWeed(digits, length, delta, rest, (uint64_t) POWERS_OF_TEN[kappa] << -one.exponent, distance);
+            return length;
+        }
+    }
+
+    for (;;) {
+        fractional *= 10;
+        delta *= 10;
+        char digit = (char) (fractional >> -one.exponent);
+        if (digit != 0 || length != 0) {
+            digits[length++] = (char) ('0' + digit);
+        }
+        fractional &= one.significand - 1;
+        kappa--;
+        if (fractional < delta) {
+            *k += kappa;
+            roundWeed(digits, length, delta, fractional, one.significand, distance * POWERS_OF_TEN[-kappa]);
+            return length;
+        }
+    }
+}
+
+// shortest digits of a positive finite value, value = digits * 10^k
+static int grisu2(double value, char* digits, int* k) {
+    const struct DiyFp exact = fromDouble(value);
+    struct DiyFp minus, plus;
+    normalizedBoundaries(exact, &minus, &plus);
+
+    const struct DiyFp power = cachedPower(plus.exponent, k);
+    const struct DiyFp scaled = multiply(normalize(exact), power);
+    struct DiyFp scaledPlus = multiply(plus, power);
+    struct DiyFp scaledMinus = multiply(minus, power);
+    // stay inside the interval despite the rounding of the products
+    scaledMinus.significand++;
+    scaledPlus.significand--;
+    return generateDigits(scaled, scaledPlus, scaledPlus.significand - scaledMinus.significand, digits, k);
+}
+
+// Writes the decimal digits of value so they end at end, returns the first digit.
+static char* formatDigitsBackwards(char* end, uint64_t value) {
+    char* digits = end;
+    do {
+        *--digits = (char) ('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+    return digits;
+}
+
+int oolong_format_integer(char* destination, int64_t value) {
+    char buffer[OOLONG_NUMBER_BUFFER_SIZE];
+    char* end = buffer + sizeof(buffer);
+    // negate as unsigned, so the minimum value doesn't overflow
+    char* digits = formatDigitsBackwards(end, value < 0 ? -(uint64_t) value : (uint64_t) value);
+    if (value < 0) {
+        *--digits = '-';
+    }
+    int length = (int) (end - digits);
+    memcpy(destination, digits, length);
+    destination[length] = '\0';
+    return length;
+}
+
+// Shortest representation that reads back as the same value: 0.1, 4.0, 1e+16, 1.5e-07, like Python's repr.
+int oolong_format_double(char* destination, double value) {
+    char* output = destination;
+    if (isnan(value)) {
+        memcpy(destination, "nan", 4);
+        return 3;
+    }
+    if (signbit(value)) {
+        *output++ = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(output, "inf", 4);
+        return (int) (output - destination) + 3;
+    }
+    if (value == 0.0) {
+        memcpy(output, "0.0", 4);
+        return (int) (output - destination) + 3;
+    }
+
+    char digits[OOLONG_NUMBER_BUFFER_SIZE];
+    int k = 0;
+    const int length = grisu2(value, digits, &k);
+    // value = 0.digits * 10^decimalPoint
+    const int decimalPoint = length + k;
+    const int exponent = decimalPoint - 1;
+
+    if (exponent < MINIMUM_FIXED_EXPONENT || exponent >= MAXIMUM_FIXED_EXPONENT) {
+        *output++ = digits[0];
+        if (length > 1) {
+            *output++ = '.';
+            memcpy(output, digits + 1, length - 1);
+            output += length - 1;
+        }
+        *output++ = 'e';
+        *output++ = exponent < 0 ? '-' : '+';
+        const int magnitude = exponent < 0 ? -exponent : exponent;
+        if (magnitude < 10) {
+            *output++ = '0';
+        }
+        char exponentDigits[4];
+        char* exponentEnd = exponentDigits + sizeof(exponentDigits);
+        char* exponentStart = formatDigitsBackwards(exponentEnd, (uint64_t) magnitude);
+        memcpy(output, exponentStart, exponentEnd - exponentStart);
+        output += exponentEnd - exponentStart;
+    }
+    else if (decimalPoint <= 0) {
+        // 0.000ddd
+        *output++ = '0';
+        *output++ = '.';
+        memset(output, '0', -decimalPoint);
+        output += -decimalPoint;
+        memcpy(output, digits, length);
+        output += length;
+    }
+    else if (decimalPoint < length) {
+        // ddd.ddd
+        memcpy(output, digits, decimalPoint);
+        output += decimalPoint;
+        *output++ = '.';
+        memcpy(output, digits + decimalPoint, length - decimalPoint);
+        output += length - decimalPoint;
+    }
+    else {
+        // ddd000.0
+        memcpy(output, digits, length);
+        output += length;
+        memset(output, '0', decimalPoint - length);
+        output += decimalPoint - length;
+        *output++ = '.';
+        *output++ = '0';
+    }
+    *output = '\0';
+    return (int) (output - destination);
+}
@@ -0,0 +1,140 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runtime side of spawn and await. The compiler (futures.cpp) lays out a frame
+// of struct Future, the result and the arguments of the spawned call, and
+// generates the body that runs the call from the frame.
+//
+// Spawning pushes the frame onto the spawning worker's deque and returns right
+// away (help-first), so the spawning function keeps running and idle workers
+// steal the task. A worker waiting for a Future runs other tasks meanwhile,
+// starting with its own most recently spawned ones, which usually includes the
+// awaited task itself.
+//
+// The body of an async function (coroutines.cpp) resumes its coroutine and
+// calls oolong_future_suspended when it suspended before finishing, awaiting
+// the Future passed to oolong_future_awaiting. Instead of being marked as done
+// the task joins the waiters of that Future, which submits it again once done.
+//
+// Awaiting doesn't consume a Future, copies of it may be awaited as well and
+// get the same result, so frames stay allocated like Arrays and Strings.
+
+#include "oolong-module.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum FutureState {
+    PENDING,
+    SUSPENDED, // only set while the body runs, see oolong_future_suspended
+    DONE
+};
+
+struct Future {
+    struct OolongTask task;
+    void (*body)(struct Future* future);
+    _Atomic int32_t state;
+    struct Future* awaited; // by the suspended body
+    _Atomic(struct Future*) waiters; // suspended until this one is done, linked by nextWaiter
+    struct Future* nextWaiter;
+    // result and arguments follow
+};
+
+// waiters of a Future that is done, nothing can join them anymore
+static struct Future noWaiters;
+
+// false if awaited is done already, future has to be resumed right away then
+static bool addWaiter(struct Future* awaited, struct Future* future) {
+    struct Future* head = atomic_load_explicit(&awaited->waiters, memory_order_acquire);
+    do {
+        if (head == &noWaiters) {
+            return false;
+        }
+        future->nextWaiter = head;
+    } while (!atomic_compare_exchange_weak_explicit(&awaited->waiters, &head, future, memory_order_release, memory_order_acquire));
+    return true;
+}
+
+static void runFuture(struct OolongTask* task) {
+    struct Future* future = (struct Future*) task;
+    future->body(future);
+    while (atomic_load_explicit(&future->state, memory_order_relaxed) == SUSPENDED) {
+        atomic_store_explicit(&future->state, PENDING, memory_order_relaxed);
+        if (addWaiter(future->awaited, future)) {
+            // the coroutine is suspended already, so it's fine if another thread resumes it right away
+            return;
+        }
+        future->body(future);
+    }
+    // publishes the result to the waiting thread
+    atomic_store_explicit(&future->state, DONE, memory_order_release);
+    struct Future* waiter = atomic_exchange_explicit(&future->waiters, &noWaiters, memory_order_acq_rel);
+    while (waiter != NULL) {
+        // read before it runs again and maybe waits for another Future
+        struct Future* next = waiter->nextWaiter;
+        oolong_scheduler_submit(&waiter->task);
+        waiter = next;
+    }
+}
+
+struct Future* oolong_future_new(void (*body)(struct Future* future), int64_t size) {
+    // the spawning thread becomes a worker, so its frames are pooled too
+    oolong_scheduler_start();
+    struct Future* future = NULL;
+    if (size <= OOLONG_TASK_FRAME_SIZE) {
+        future = oolong_task_allocate();
+    }
+    else {
+        future = malloc(size);
+        if (future == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate a task of %lld bytes.\n", (long long) size);
+            exit(1);
+        }
+    }
+    future->task.run = runFuture;
+    future->task.needsWorker = false;
+    future->body = body;
+    atomic_init(&future->state, PENDING);
+    future->awaited = NULL;
+    atomic_init(&future->waiters, NULL);
+    future->nextWaiter = NULL;
+    return future;
+}
+
+void oolong_future_start(struct Future* future) {
+    oolong_scheduler_submit(&future->task);
+}
+
+void oolong_future_wait(struct Future* future) {
+    while (atomic_load_explicit(&future->state, memory_order_acquire) != DONE) {
+        oolong_scheduler_run_task();
+    }
+}
+
+// called by an async function before it suspends until awaited is done
+void oolong_future_awaiting(struct Future* future, struct Future* awaited) {
+    future->awaited = awaited;
+}
+
+// called by the body of an async function that has to be resumed later
+void oolong_future_suspended(struct Future* future) {
+    atomic_store_explicit(&future->state, SUSPENDED, memory_order_relaxed);
+}
+
+bool oolong_future_done(struct Future* future) {
+    return atomic_load_explicit(&future->state, memory_order_acquire) == DONE;
+}
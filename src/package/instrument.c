@@ -0,0 +1,333 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runtime side of --instrument-functions: generated code calls
+// oolong_instrument_enter/oolong_instrument_exit around every function body
+// and a report is written when the process exits.
+//
+// Functions run on several threads (spawn, parallel for), so every thread
+// has its own shadow stack and counters. Only registering a function and a
+// thread takes a lock, the report adds up the counters of all threads.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIME_UNIT "cycles"
+#else
+#define TIME_UNIT "ns"
+#endif
+
+#define MAXIMUM_DEPTH 4096
+#define MAXIMUM_CALLERS 8
+#define REPORTED_CALLERS 3
+
+struct InstrumentedFunction;
+
+struct Caller {
+    struct InstrumentedFunction* function; // NULL for the process entry
+    uint64_t calls;
+    uint64_t time;
+};
+
+struct Counters {
+    uint64_t calls;
+    uint64_t inclusiveTime;
+    uint64_t exclusiveTime;
+    uint64_t activeCalls; // recursion depth, inclusive time is only counted for the outermost call
+    struct Caller callers[MAXIMUM_CALLERS];
+    uint64_t otherCallerCalls;
+};
+
+struct InstrumentedFunction {
+    const char* name;
+    size_t index; // of its counters in every thread
+    struct Counters total; // of all threads, added up for the report
+    struct InstrumentedFunction* next;
+};
+
+struct Frame {
+    struct InstrumentedFunction* function;
+    uint64_t start;
+    uint64_t childTime;
+};
+
+struct ThreadProfile {
+    struct Counters* counters; // by function index
+    size_t counterCount;
+    uint64_t totalTime;
+    size_t depth;
+    struct Frame stack[MAXIMUM_DEPTH];
+    struct ThreadProfile* next;
+};
+
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static struct InstrumentedFunction* functions = NULL;
+static size_t functionCount = 0;
+static struct ThreadProfile* profiles = NULL; // kept after their threads exit
+static _Thread_local struct ThreadProfile* currentProfile = NULL;
+
+static inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+static int compareInclusiveTime(const void* left, const void* right) {
+    const struct Counters* leftTotal = &(*(const struct InstrumentedFunction**) left)->total;
+    const struct Counters* rightTotal = &(*(const struct InstrumentedFunction**) right)->total;
+    if (leftTotal->inclusiveTime != rightTotal->inclusiveTime) {
+        return leftTotal->inclusiveTime < rightTotal->inclusiveTime ? 1 : -1;
+    }
+    if (leftTotal->calls != rightTotal->calls) {
+        return leftTotal->calls < rightTotal->calls ? 1 : -1;
+    }
+    return 0;
+}
+
+static int compareCallerTime(const void* left, const void* right) {
+    const struct Caller* leftCaller = left;
+    const struct Caller* rightCaller = right;
+    if (leftCaller->time == rightCaller->time) {
+        return 0;
+    }
+    return leftCaller->time < rightCaller->time ? 1 : -1;
+}
+
+static double percentage(uint64_t time, uint64_t totalTime) {
+    return totalTime == 0 ? 0.0 : (100.0 * time) / totalTime;
+}
+
+static void recordCaller(struct Counters* counters, struct InstrumentedFunction* callerFunction, uint64_t calls, uint64_t time) {
+    for (size_t i=0; i<MAXIMUM_CALLERS; i++) {
+        struct Caller* caller = &counters->callers[i];
+        if (caller->calls == 0) {
+            // first free entry
+            caller->function = callerFunction;
+        }
+        if (caller->function == callerFunction) {
+            caller->calls += calls;
+            caller->time += time;
+            return;
+        }
+    }
+    counters->otherCallerCalls += calls;
+}
+
+static void addCounters(struct Counters* total, const struct Counters* counters) {
+    total->calls += counters->calls;
+    total->inclusiveTime += counters->inclusiveTime;
+    total->exclusiveTime += counters->exclusiveTime;
+    total->otherCallerCalls += counters->otherCallerCalls;
+    for (size_t i=0; i<MAXIMUM_CALLERS && counters->callers[i].calls > 0; i++) {
+        const struct Caller* caller = &counters->callers[i];
+        recordCaller(total, caller->function, caller->calls, caller->time);
+    }
+}
+
+static void writeReport() {
+    FILE* output = stderr;
+    const char* outputPath = getenv("OOLONG_INSTRUMENT_OUTPUT");
+    if (outputPath != NULL && outputPath[0] != '\0') {
+        output = fopen(outputPath, "w");
+        if (output == NULL) {
+            fprintf(stderr, "warning: Unable to open %s, writing function report to stderr.\n", outputPath);
+            output = stderr;
+        }
+    }
+
+    pthread_mutex_lock(&registryLock);
+    struct InstrumentedFunction** sorted = malloc(functionCount * sizeof(struct InstrumentedFunction*));
+    if (sorted == NULL) {
+        pthread_mutex_unlock(&registryLock);
+        return;
+    }
+    for (struct InstrumentedFunction* function = functions; function != NULL; function = function->next) {
+        memset(&function->total, 0, sizeof(struct Counters));
+        sorted[function->index] = function;
+    }
+    // threads still running at exit are reported up to their last finished call
+    uint64_t totalTime = 0;
+    for (struct ThreadProfile* profile = profiles; profile != NULL; profile = profile->next) {
+        totalTime += profile->totalTime;
+        for (size_t i=0; i<profile->counterCount && i<functionCount; i++) {
+            addCounters(&sorted[i]->total, &profile->counters[i]);
+        }
+    }
+    qsort(sorted, functionCount, sizeof(struct InstrumentedFunction*), compareInclusiveTime);
+
+    fprintf(output, "Oolong function report (times in " TIME_UNIT ", total %llu)\n", (unsigned long long) totalTime);
+    fprintf(output, "%12s %18s %7s %18s %7s  %s\n", "calls", "inclusive", "%", "exclusive", "%", "function");
+    for (size_t i=0; i<functionCount; i++) {
+        struct InstrumentedFunction* function = sorted[i];
+        struct Counters* total = &function->total;
+        fprintf(output, "%12llu %18llu %6.2f%% %18llu %6.2f%%  %s\n",
+                (unsigned long long) total->calls,
+                (unsigned long long) total->inclusiveTime, percentage(total->inclusiveTime, totalTime),
+                (unsigned long long) total->exclusiveTime, percentage(total->exclusiveTime, totalTime),
+                function->name);
+
+        qsort(total->callers, MAXIMUM_CALLERS, sizeof(struct Caller), compareCallerTime);
+        for (size_t c=0; c<REPORTED_CALLERS && total->callers[c].calls > 0; c++) {
+            struct Caller* caller = &total->callers[c];
+            fprintf(output, "%12s   called from %s (%llu calls, %llu " TIME_UNIT ")\n", "",
+                    caller->function == NULL ? "<process>" : caller->function->name,
+                    (unsigned long long) caller->calls, (unsigned long long) caller->time);
+        }
+        if (total->otherCallerCalls > 0) {
+            fprintf(output, "%12s   called from other functions (%llu calls)\n", "", (unsigned long long) total->otherCallerCalls);
+        }
+    }
+    pthread_mutex_unlock(&registryLock);
+    if (output != stderr) {
+        fclose(output);
+    }
+    free(sorted);
+}
+
+static struct InstrumentedFunction* registerFunction(struct InstrumentedFunction* _Atomic* slot, const char* name) {
+    pthread_mutex_lock(&registryLock);
+    // another thread might have registered it meanwhile
+    struct InstrumentedFunction* function = atomic_load_explicit(slot, memory_order_relaxed);
+    if (function == NULL) {
+        function = calloc(1, sizeof(struct InstrumentedFunction));
+        if (function != NULL) {
+            if (functions == NULL) {
+                atexit(writeReport);
+            }
+            function->name = name;
+            function->index = functionCount++;
+            function->next = functions;
+            functions = function;
+            atomic_store_explicit(slot, function, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&registryLock);
+    return function;
+}
+
+static struct ThreadProfile* getProfile() {
+    if (currentProfile == NULL) {
+        struct ThreadProfile* profile = calloc(1, sizeof(struct ThreadProfile));
+        if (profile == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&registryLock);
+        profile->next = profiles;
+        profiles = profile;
+        pthread_mutex_unlock(&registryLock);
+        currentProfile = profile;
+    }
+    return currentProfile;
+}
+
+// The counters of the function on this thread, NULL if there's no memory for them
+static struct Counters* getCounters(struct ThreadProfile* profile, struct InstrumentedFunction* function) {
+    if (function->index >= profile->counterCount) {
+        size_t count = 2 * function->index + 16;
+        // the report reads the counters, so they only move under the lock
+        pthread_mutex_lock(&registryLock);
+        struct Counters* counters = realloc(profile->counters, count * sizeof(struct Counters));
+        if (counters != NULL) {
+            memset(counters + profile->counterCount, 0, (count - profile->counterCount) * sizeof(struct Counters));
+            profile->counters = counters;
+            profile->counterCount = count;
+        }
+        pthread_mutex_unlock(&registryLock);
+        if (counters == NULL) {
+            return NULL;
+        }
+    }
+    return &profile->counters[function->index];
+}
+
+void oolong_instrument_enter(struct InstrumentedFunction* _Atomic* slot, const char* name) {
+    struct ThreadProfile* profile = getProfile();
+    if (profile == NULL) {
+        return;
+    }
+    struct InstrumentedFunction* function = atomic_load_explicit(slot, memory_order_acquire);
+    if (function == NULL) {
+        // first call of this function, register it
+        function = registerFunction(slot, name);
+    }
+    struct Counters* counters = function != NULL ? getCounters(profile, function) : NULL;
+
+    if (profile->depth < MAXIMUM_DEPTH) {
+        struct Frame* frame = &profile->stack[profile->depth];
+        // keep the stack balanced if there's no memory, the call just isn't recorded
+        frame->function = counters != NULL ? function : NULL;
+        frame->childTime = 0;
+        if (counters != NULL) {
+            counters->calls++;
+            counters->activeCalls++;
+        }
+        // take the time last, so registration isn't attributed to the function
+        frame->start = now();
+    }
+    profile->depth++;
+}
+
+void oolong_instrument_exit() {
+    uint64_t end = now();
+    struct ThreadProfile* profile = currentProfile;
+    if (profile == NULL || profile->depth == 0) {
+        return;
+    }
+    size_t depth = --profile->depth;
+    if (depth >= MAXIMUM_DEPTH) {
+        // call was too deep to be recorded
+        return;
+    }
+
+    struct Frame* frame = &profile->stack[depth];
+    struct InstrumentedFunction* function = frame->function;
+    if (function == NULL) {
+        return;
+    }
+    struct Counters* counters = &profile->counters[function->index];
+    uint64_t elapsed = end - frame->start;
+
+    counters->exclusiveTime += elapsed - frame->childTime;
+    counters->activeCalls--;
+    if (counters->activeCalls == 0) {
+        counters->inclusiveTime += elapsed;
+    }
+
+    if (depth > 0) {
+        struct Frame* parent = &profile->stack[depth-1];
+        parent->childTime += elapsed;
+        if (parent->function != NULL) {
+            recordCaller(counters, parent->function, 1, elapsed);
+        }
+    }
+    else {
+        profile->totalTime += elapsed;
+        recordCaller(counters, NULL, 1, elapsed);
+    }
+}
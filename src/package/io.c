@@ -16,47 +16,214 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "oolong-module.h"
-#ifndef __STDC_FORMAT_MACROS
-#define __STDC_FORMAT_MACROS
-#endif
-#include <inttypes.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+// Output of the print functions is collected in a buffer and written with a
+// single write() when the buffer is full, on io.flush(), before reading input
+// and at exit (oolong -e flushes right after main). When stdout is a terminal
+// every printLine is flushed, so interactive programs behave as before.
+//
+// Spawned functions and parallel loops print concurrently, so the buffer has
+// a lock, held for a whole call: the parts of one print stay together.
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+static char outputBuffer[OUTPUT_BUFFER_SIZE];
+static size_t outputLength = 0;
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t outputInitialized = PTHREAD_ONCE_INIT;
+static bool outputInteractive = false;
+
+static void writeAll(const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // nowhere to report this, drop the output like printf would
+            return;
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+// the lock is held
+static void flush() {
+    if (outputLength > 0) {
+        writeAll(outputBuffer, outputLength);
+        outputLength = 0;
+    }
+}
+
+void oolong_io_flush() {
+    pthread_mutex_lock(&outputLock);
+    flush();
+    pthread_mutex_unlock(&outputLock);
+}
+
+static void initializeOutput() {
+    outputInteractive = isatty(STDOUT_FILENO);
+    atexit(oolong_io_flush);
+}
+
+static void lockOutput() {
+    pthread_once(&outputInitialized, initializeOutput);
+    pthread_mutex_lock(&outputLock);
+}
+
+static void unlockOutput() {
+    pthread_mutex_unlock(&outputLock);
+}
+
+// the lock is held
+static void append(const char* data, size_t length) {
+    if (outputLength + length > OUTPUT_BUFFER_SIZE) {
+        flush();
+        if (length > OUTPUT_BUFFER_SIZE) {
+            // too large to buffer, no need to copy it
+            writeAll(data, length);
+            return;
+        }
+    }
+    memcpy(outputBuffer + outputLength, data, length);
+    outputLength += length;
+}
+
+static void endLine() {
+    append("\n", 1);
+    if (outputInteractive) {
+        flush();
+    }
+}
+
+static void appendString(struct String* value) {
+    append(value->value, value->usedSize);
+}
+
+static void appendInteger(int64_t value) {
+    char buffer[OOLONG_NUMBER_BUFFER_SIZE];
+    append(buffer, oolong_format_integer(buffer, value));
+}
+
+// Shortest form that reads back as the same value, like toString.
+static void appendDouble(double value) {
+    char buffer[OOLONG_NUMBER_BUFFER_SIZE];
+    append(buffer, oolong_format_double(buffer, value));
+}
+
+static void appendBoolean(bool value) {
+    if (value) {
+        append("true", 4);
+    }
+    else {
+        append("false", 5);
+    }
+}
+
+void Void_0_io_1_flush() {
+    oolong_io_flush();
+}
 
 void Void_0_io_1_print_2_String(struct String* value) {
-    printf("%s", value->value);
+    lockOutput();
+    appendString(value);
+    unlockOutput();
 }
 
 void Void_0_io_1_print_2_Integer(int64_t value) {
-    printf("%" PRId64, value);
+    lockOutput();
+    appendInteger(value);
+    unlockOutput();
 }
 
 void Void_0_io_1_print_2_Double(double value) {
-    printf("%f", value);
+    lockOutput();
+    appendDouble(value);
+    unlockOutput();
 }
 
 void Void_0_io_1_print_2_Boolean(bool value) {
-    printf(value ? "true" : "false");
+    lockOutput();
+    appendBoolean(value);
+    unlockOutput();
 }
 
 void Void_0_io_1_printLine_2_String(struct String* value) {
-    printf("%s\n", value->value);
+    lockOutput();
+    appendString(value);
+    endLine();
+    unlockOutput();
 }
 
 void Void_0_io_1_printLine_2_Integer(int64_t value) {
-    printf("%" PRId64 "\n", value);
+    lockOutput();
+    appendInteger(value);
+    endLine();
+    unlockOutput();
 }
 
 void Void_0_io_1_printLine_2_Double(double value) {
-    printf("%f\n", value);
+    lockOutput();
+    appendDouble(value);
+    endLine();
+    unlockOutput();
 }
 
 void Void_0_io_1_printLine_2_Boolean(bool value) {
-    printf(value ? "true\n" : "false\n");
+    lockOutput();
+    appendBoolean(value);
+    endLine();
+    unlockOutput();
 }
 
+// print and printLine with two and three arguments of any type, e.g. io.printLine("F(10): ", x)
+#define ARGUMENT_TYPE_String struct String*
+#define ARGUMENT_TYPE_Integer int64_t
+#define ARGUMENT_TYPE_Double double
+#define ARGUMENT_TYPE_Boolean bool
+
+#define PRINT_2(A, B) \
+    void Void_0_io_1_print_2_##A##_2_##B(ARGUMENT_TYPE_##A a, ARGUMENT_TYPE_##B b) { \
+        lockOutput(); append##A(a); append##B(b); unlockOutput(); \
+    } \
+    void Void_0_io_1_printLine_2_##A##_2_##B(ARGUMENT_TYPE_##A a, ARGUMENT_TYPE_##B b) { \
+        lockOutput(); append##A(a); append##B(b); endLine(); unlockOutput(); \
+    }
+
+#define PRINT_3(A, B, C) \
+    void Void_0_io_1_print_2_##A##_2_##B##_2_##C(ARGUMENT_TYPE_##A a, ARGUMENT_TYPE_##B b, ARGUMENT_TYPE_##C c) { \
+        lockOutput(); append##A(a); append##B(b); append##C(c); unlockOutput(); \
+    } \
+    void Void_0_io_1_printLine_2_##A##_2_##B##_2_##C(ARGUMENT_TYPE_##A a, ARGUMENT_TYPE_##B b, ARGUMENT_TYPE_##C c) { \
+        lockOutput(); append##A(a); append##B(b); append##C(c); endLine(); unlockOutput(); \
+    }
+
+#define PRINT_2_ALL(A) PRINT_2(A, String) PRINT_2(A, Integer) PRINT_2(A, Double) PRINT_2(A, Boolean)
+#define PRINT_3_ALL(A, B) PRINT_3(A, B, String) PRINT_3(A, B, Integer) PRINT_3(A, B, Double) PRINT_3(A, B, Boolean)
+#define PRINT_3_ALL_ALL(A) PRINT_3_ALL(A, String) PRINT_3_ALL(A, Integer) PRINT_3_ALL(A, Double) PRINT_3_ALL(A, Boolean)
+
+PRINT_2_ALL(String)
+PRINT_2_ALL(Integer)
+PRINT_2_ALL(Double)
+PRINT_2_ALL(Boolean)
+
+PRINT_3_ALL_ALL(String)
+PRINT_3_ALL_ALL(Integer)
+PRINT_3_ALL_ALL(Double)
+PRINT_3_ALL_ALL(Boolean)
+
 struct String* String_0_io_1_readLine() {
+    // prompts printed before must be visible
+    oolong_io_flush();
+
     char* line = NULL;
     size_t length = 0;
 
@@ -69,7 +236,7 @@ struct String* String_0_io_1_readLine() {
     lineString->value = line;
     lineString->allocatedSize = read+1; // account for null terminator
     lineString->usedSize = read;
+    lineString->owner = NULL;
 
     return lineString;
 }
-
@@ -0,0 +1,385 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runtime side of Map<K, V> with Integer or String keys: lookup, insertion
+// and growth. The compiler (maps.cpp) calls the functions of the key type and
+// accesses the values through the header below, the runtime only knows their
+// size.
+//
+// The table is open addressing after Google's Swiss tables: every slot has a
+// control byte that is either empty, deleted or the lowest 7 bits of the
+// hash of its key. Slots are probed in groups of 16, with SSE2 a single
+// comparison finds the candidates of a group whose control byte matches, the
+// keys of the other slots are never touched. The remaining bits of the hash
+// pick the first group, further groups follow quadratically. A lookup stops
+// at the first group with an empty slot.
+//
+// String keys are copied on insertion, so keys that are views of a buffer
+// that gets reused (e.g. the fields of split) stay intact.
+
+#include "oolong-module.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GROUP_SIZE 16
+#define MINIMUM_CAPACITY GROUP_SIZE
+#define EMPTY ((int8_t) -128)
+#define DELETED ((int8_t) -2)
+
+struct Map {
+    int8_t* control;
+    void* keys; // int64_t or struct String*
+    char* values;
+    int64_t size;
+    int64_t capacity; // a power of two, at least a group
+    int64_t growthLeft; // insertions into empty slots until the table is rebuilt
+};
+
+struct Array {
+    void* data;
+    int64_t size;
+};
+
+static void outOfMemory(int64_t capacity) {
+    fprintf(stderr, "ERROR: Unable to allocate a Map of %lld entries.\n", (long long) capacity);
+    exit(1);
+}
+
+// at most 7/8 of the slots are used, so probe sequences stay short
+static int64_t getMaximumLoad(int64_t capacity) {
+    return capacity - capacity / 8;
+}
+
+static uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static const uint64_t SEED = 0xa0761d6478bd642full;
+static const uint64_t MULTIPLIER = 0xe7037ed1a0b428dbull;
+
+static uint64_t hashInteger(int64_t key) {
+    return mix((uint64_t) key ^ SEED, MULTIPLIER);
+}
+
+// eight characters at a time, views aren't terminated so only usedSize characters are read
+static uint64_t hashString(struct String* key) {
+    const char* characters = key->value;
+    int64_t length = key->usedSize;
+    uint64_t hash = SEED ^ (uint64_t) length;
+    for (; length >= 8; length -= 8, characters += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, characters, 8);
+        hash = mix(hash ^ chunk, MULTIPLIER);
+    }
+    if (length > 0) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, characters, length);
+        hash = mix(hash ^ chunk, MULTIPLIER);
+    }
+    return mix(hash, SEED);
+}
+
+// bit i is set if control byte i of the group equals value
+static uint32_t matchByte(const int8_t* group, int8_t value) {
+#if defined(__SSE2__)
+    __m128i control = _mm_load_si128((const __m128i*) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(value)));
+#else
+    uint32_t matches = 0;
+    for (int i=0; i<GROUP_SIZE; i++) {
+        matches |= (uint32_t) (group[i] == value) << i;
+    }
+    return matches;
+#endif
+}
+
+// empty and deleted are the only negative control bytes
+static uint32_t matchFree(const int8_t* group) {
+#if defined(__SSE2__)
+    return (uint32_t) _mm_movemask_epi8(_mm_load_si128((const __m128i*) group));
+#else
+    uint32_t matches = 0;
+    for (int i=0; i<GROUP_SIZE; i++) {
+        matches |= (uint32_t) (group[i] < 0) << i;
+    }
+    return matches;
+#endif
+}
+
+static int8_t getHashBits(uint64_t hash) {
+    return (int8_t) (hash & 0x7f);
+}
+
+static uint64_t getHash(int64_t key, bool strings) {
+    return strings ? hashString((struct String*) key) : hashInteger(key);
+}
+
+static bool isKey(struct Map* map, int64_t slot, int64_t key, bool strings) {
+    if (!strings) {
+        return ((int64_t*) map->keys)[slot] == key;
+    }
+    struct String* stored = ((struct String**) map->keys)[slot];
+    struct String* other = (struct String*) key;
+    return stored->usedSize == other->usedSize && memcmp(stored->value, other->value, other->usedSize) == 0;
+}
+
+// The functions below take keys as 64 bits, strings selects what they are. They are always inlined
+// into the functions of a key type, which compiles them once for Integer and once for String keys.
+
+static inline __attribute__((always_inline)) int64_t find(struct Map* map, int64_t key, uint64_t hash, bool strings) {
+    int64_t groupMask = map->capacity / GROUP_SIZE - 1;
+    int8_t hashBits = getHashBits(hash);
+    for (int64_t group = (hash >> 7) & groupMask, step = 1; ; group = (group + step++) & groupMask) {
+        const int8_t* control = map->control + group * GROUP_SIZE;
+        for (uint32_t matches = matchByte(control, hashBits); matches != 0; matches &= matches - 1) {
+            int64_t slot = group * GROUP_SIZE + __builtin_ctz(matches);
+            if (isKey(map, slot, key, strings)) {
+                return slot;
+            }
+        }
+        if (matchByte(control, EMPTY) != 0) {
+            return -1;
+        }
+    }
+}
+
+// first empty or deleted slot of the probe sequence, there always is one since the load is limited
+static int64_t findFree(struct Map* map, uint64_t hash) {
+    int64_t groupMask = map->capacity / GROUP_SIZE - 1;
+    for (int64_t group = (hash >> 7) & groupMask, step = 1; ; group = (group + step++) & groupMask) {
+        uint32_t matches = matchFree(map->control + group * GROUP_SIZE);
+        if (matches != 0) {
+            return group * GROUP_SIZE + __builtin_ctz(matches);
+        }
+    }
+}
+
+static void allocateTable(struct Map* map, int64_t capacity, int64_t valueSize) {
+    if (capacity > INT64_MAX / 8 / (valueSize > 8 ? valueSize : 8)) {
+        outOfMemory(capacity);
+    }
+    map->control = aligned_alloc(GROUP_SIZE, capacity);
+    map->keys = malloc(capacity * sizeof(int64_t));
+    map->values = malloc(capacity * valueSize);
+    if (map->control == NULL || map->keys == NULL || map->values == NULL) {
+        outOfMemory(capacity);
+    }
+    memset(map->control, EMPTY, capacity);
+    map->capacity = capacity;
+    map->growthLeft = getMaximumLoad(capacity) - map->size;
+}
+
+// Moves every entry into a table with room for at least count of them, which also drops deleted slots.
+static inline __attribute__((always_inline)) void rebuild(struct Map* map, int64_t count, int64_t valueSize, bool strings) {
+    int64_t capacity = MINIMUM_CAPACITY;
+    while (getMaximumLoad(capacity) < count) {
+        capacity *= 2;
+    }
+    struct Map old = *map;
+    allocateTable(map, capacity, valueSize);
+    for (int64_t slot=0; slot<old.capacity; slot++) {
+        if (old.control[slot] < 0) {
+            continue;
+        }
+        int64_t key = ((int64_t*) old.keys)[slot];
+        uint64_t hash = getHash(key, strings);
+        int64_t newSlot = findFree(map, hash);
+        map->control[newSlot] = getHashBits(hash);
+        ((int64_t*) map->keys)[newSlot] = key;
+        memcpy(map->values + newSlot * valueSize, old.values + slot * valueSize, valueSize);
+    }
+    free(old.control);
+    free(old.keys);
+    free(old.values);
+}
+
+static struct String* copyString(struct String* source) {
+    struct String* copy = malloc(sizeof(struct String));
+    char* characters = malloc(source->usedSize + 1);
+    if (copy == NULL || characters == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a String of %lld characters.\n", (long long) source->usedSize);
+        exit(1);
+    }
+    memcpy(characters, source->value, source->usedSize);
+    characters[source->usedSize] = '\0';
+    copy->value = characters;
+    copy->allocatedSize = source->usedSize + 1;
+    copy->usedSize = source->usedSize;
+    copy->owner = NULL;
+    return copy;
+}
+
+static void freeString(struct String* string) {
+    free(string->value);
+    free(string);
+}
+
+// slot of the key, inserted with a zeroed value if it wasn't there yet
+static inline __attribute__((always_inline)) int64_t insert(struct Map* map, int64_t key, int64_t valueSize, bool strings) {
+    uint64_t hash = getHash(key, strings);
+    int64_t slot = find(map, key, hash, strings);
+    if (slot >= 0) {
+        return slot;
+    }
+    slot = findFree(map, hash);
+    if (map->growthLeft == 0 && map->control[slot] == EMPTY) {
+        // doubles the capacity, unless most of the used slots were deleted entries
+        rebuild(map, map->size + 1 > getMaximumLoad(map->capacity) / 2 ? 2 * map->size + 1 : map->size + 1, valueSize, strings);
+        slot = findFree(map, hash);
+    }
+    if (map->control[slot] == EMPTY) {
+        map->growthLeft--;
+    }
+    map->control[slot] = getHashBits(hash);
+    ((int64_t*) map->keys)[slot] = strings ? (int64_t) copyString((struct String*) key) : key;
+    memset(map->values + slot * valueSize, 0, valueSize);
+    map->size++;
+    return slot;
+}
+
+static inline __attribute__((always_inline)) bool removeKey(struct Map* map, int64_t key, bool strings) {
+    int64_t slot = find(map, key, getHash(key, strings), strings);
+    if (slot < 0) {
+        return false;
+    }
+    if (strings) {
+        freeString(((struct String**) map->keys)[slot]);
+    }
+    // A group that has an empty slot never had a free one before, so no probe sequence continued past
+    // it and the slot can be empty again. Otherwise lookups have to keep going.
+    const int8_t* group = map->control + slot / GROUP_SIZE * GROUP_SIZE;
+    if (matchByte(group, EMPTY) != 0) {
+        map->control[slot] = EMPTY;
+        map->growthLeft++;
+    }
+    else {
+        map->control[slot] = DELETED;
+    }
+    map->size--;
+    return true;
+}
+
+static void clear(struct Map* map, bool strings) {
+    if (strings) {
+        for (int64_t slot=0; slot<map->capacity; slot++) {
+            if (map->control[slot] >= 0) {
+                freeString(((struct String**) map->keys)[slot]);
+            }
+        }
+    }
+    memset(map->control, EMPTY, map->capacity);
+    map->size = 0;
+    map->growthLeft = getMaximumLoad(map->capacity);
+}
+
+// Empty Map with room for capacity entries before it grows.
+void* oolong_map_new(int64_t capacity, int64_t valueSize) {
+    if (capacity < 0) {
+        fprintf(stderr, "ERROR: A Map can't have a capacity of %lld.\n", (long long) capacity);
+        exit(1);
+    }
+    struct Map* map = calloc(1, sizeof(struct Map));
+    if (map == NULL) {
+        outOfMemory(capacity);
+    }
+    int64_t tableCapacity = MINIMUM_CAPACITY;
+    while (getMaximumLoad(tableCapacity) < capacity) {
+        tableCapacity *= 2;
+    }
+    allocateTable(map, tableCapacity, valueSize);
+    return map;
+}
+
+// Slot of the key, -1 if the Map doesn't contain it.
+int64_t oolong_map_find_integer(struct Map* map, int64_t key) {
+    return find(map, key, hashInteger(key), false);
+}
+
+int64_t oolong_map_find_string(struct Map* map, struct String* key) {
+    return find(map, (int64_t) key, hashString(key), true);
+}
+
+// Slot of the key, added with a zeroed value if the Map didn't contain it. Slots of other keys may move.
+int64_t oolong_map_insert_integer(struct Map* map, int64_t key, int64_t valueSize) {
+    return insert(map, key, valueSize, false);
+}
+
+int64_t oolong_map_insert_string(struct Map* map, struct String* key, int64_t valueSize) {
+    return insert(map, (int64_t) key, valueSize, true);
+}
+
+bool oolong_map_remove_integer(struct Map* map, int64_t key) {
+    return removeKey(map, key, false);
+}
+
+bool oolong_map_remove_string(struct Map* map, struct String* key) {
+    return removeKey(map, (int64_t) key, true);
+}
+
+// Room for at least count entries, so inserting up to count keys doesn't rebuild the table.
+void oolong_map_reserve_integer(struct Map* map, int64_t count, int64_t valueSize) {
+    if (count > map->size + map->growthLeft) {
+        rebuild(map, count, valueSize, false);
+    }
+}
+
+void oolong_map_reserve_string(struct Map* map, int64_t count, int64_t valueSize) {
+    if (count > map->size + map->growthLeft) {
+        rebuild(map, count, valueSize, true);
+    }
+}
+
+void oolong_map_clear_integer(struct Map* map) {
+    clear(map, false);
+}
+
+void oolong_map_clear_string(struct Map* map) {
+    clear(map, true);
+}
+
+// Inserts keys[i] with values[i], with a single reservation for all of them. Values of keys
+// that were already there are replaced, as are those of keys repeated in keys.
+void oolong_map_insert_all_integer(struct Map* map, struct Array* keys, struct Array* values, int64_t valueSize) {
+    if (keys->size != values->size) {
+        fprintf(stderr, "ERROR: Unable to insert %lld keys with %lld values.\n", (long long) keys->size, (long long) values->size);
+        exit(1);
+    }
+    oolong_map_reserve_integer(map, map->size + keys->size, valueSize);
+    const int64_t* keyData = keys->data;
+    const char* valueData = values->data;
+    for (int64_t i=0; i<keys->size; i++) {
+        int64_t slot = insert(map, keyData[i], valueSize, false);
+        memcpy(map->values + slot * valueSize, valueData + i * valueSize, valueSize);
+    }
+}
+
+// Called by generated code reading the value of a key the Map doesn't contain.
+void oolong_map_key_not_found_integer(int64_t key) {
+    fprintf(stderr, "ERROR: Key %lld not found.\n", (long long) key);
+    exit(1);
+}
+
+void oolong_map_key_not_found_string(struct String* key) {
+    fprintf(stderr, "ERROR: Key \"%.*s\" not found.\n", (int) key->usedSize, key->value);
+    exit(1);
+}
@@ -0,0 +1,248 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Result caches of @memoize functions whose arguments don't index a dense
+// table (memoization.cpp). The compiler passes the arguments and the result
+// as 64 bits each, a cache is a hash table with chained entries keyed by all
+// argument words.
+//
+// With a limit the entries also form a list from the most to the least
+// recently used one, once the cache is full the least recently used entry
+// makes room for the new result.
+//
+// Memoized functions might be called from several threads (spawn, parallel
+// for), so every cache has a lock. It is never held while the function
+// runs, recursive calls look up their own results.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINIMUM_CAPACITY 16
+#define NONE -1
+
+struct Entry {
+    int64_t next; // in the same bucket
+    int64_t newer;
+    int64_t older;
+    uint64_t hash;
+    int64_t result;
+    int64_t arguments[];
+};
+
+struct Memo {
+    pthread_mutex_t lock;
+    int64_t argumentCount;
+    int64_t limit; // 0 if unbounded
+    int64_t entrySize;
+    char* entries;
+    int64_t count;
+    int64_t capacity;
+    int64_t* buckets; // first entry of the bucket
+    int64_t bucketMask;
+    int64_t newest;
+    int64_t oldest;
+};
+
+static void outOfMemory(int64_t count) {
+    fprintf(stderr, "ERROR: Unable to allocate a cache of %lld results.\n", (long long) count);
+    exit(1);
+}
+
+static struct Entry* getEntry(struct Memo* memo, int64_t index) {
+    return (struct Entry*) (memo->entries + index * memo->entrySize);
+}
+
+static uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t) a * b;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static uint64_t hashArguments(const int64_t* arguments, int64_t count) {
+    uint64_t hash = 0xa0761d6478bd642full;
+    for (int64_t i=0; i<count; i++) {
+        hash = mix(hash ^ (uint64_t) arguments[i], 0xe7037ed1a0b428dbull);
+    }
+    return hash;
+}
+
+// room for capacity entries and a bucket for each of them
+static void resize(struct Memo* memo, int64_t capacity) {
+    if (capacity > INT64_MAX / 2 / memo->entrySize) {
+        outOfMemory(capacity);
+    }
+    char* entries = realloc(memo->entries, capacity * memo->entrySize);
+    int64_t bucketCount = MINIMUM_CAPACITY;
+    while (bucketCount < capacity) {
+        bucketCount *= 2;
+    }
+    int64_t* buckets = malloc(bucketCount * sizeof(int64_t));
+    if (entries == NULL || buckets == NULL) {
+        outOfMemory(capacity);
+    }
+    memo->entries = entries;
+    memo->capacity = capacity;
+    free(memo->buckets);
+    memo->buckets = buckets;
+    memo->bucketMask = bucketCount - 1;
+    for (int64_t i=0; i<bucketCount; i++) {
+        buckets[i] = NONE;
+    }
+    for (int64_t i=0; i<memo->count; i++) {
+        struct Entry* entry = getEntry(memo, i);
+        int64_t* bucket = &buckets[entry->hash & memo->bucketMask];
+        entry->next = *bucket;
+        *bucket = i;
+    }
+}
+
+static struct Memo* createMemo(int64_t argumentCount, int64_t limit) {
+    struct Memo* memo = calloc(1, sizeof(struct Memo));
+    if (memo == NULL) {
+        outOfMemory(1);
+    }
+    pthread_mutex_init(&memo->lock, NULL);
+    memo->argumentCount = argumentCount;
+    memo->limit = limit;
+    memo->entrySize = sizeof(struct Entry) + argumentCount * sizeof(int64_t);
+    memo->newest = NONE;
+    memo->oldest = NONE;
+    resize(memo, limit > 0 && limit < MINIMUM_CAPACITY ? limit : MINIMUM_CAPACITY);
+    return memo;
+}
+
+// The compiler emits a null pointer for every memoized function, the first call creates the cache.
+static struct Memo* getMemo(struct Memo* _Atomic* handle, int64_t argumentCount, int64_t limit) {
+    struct Memo* memo = atomic_load_explicit(handle, memory_order_acquire);
+    if (memo != NULL) {
+        return memo;
+    }
+    struct Memo* created = createMemo(argumentCount, limit);
+    if (atomic_compare_exchange_strong(handle, &memo, created)) {
+        return created;
+    }
+    // another thread was faster
+    free(created->entries);
+    free(created->buckets);
+    free(created);
+    return memo;
+}
+
+static int64_t find(struct Memo* memo, const int64_t* arguments, uint64_t hash) {
+    for (int64_t index = memo->buckets[hash & memo->bucketMask]; index != NONE; index = getEntry(memo, index)->next) {
+        struct Entry* entry = getEntry(memo, index);
+        if (entry->hash == hash && memcmp(entry->arguments, arguments, memo->argumentCount * sizeof(int64_t)) == 0) {
+            return index;
+        }
+    }
+    return NONE;
+}
+
+static void unlinkUse(struct Memo* memo, int64_t index) {
+    struct Entry* entry = getEntry(memo, index);
+    if (entry->newer != NONE) {
+        getEntry(memo, entry->newer)->older = entry->older;
+    }
+    else {
+        memo->newest = entry->older;
+    }
+    if (entry->older != NONE) {
+        getEntry(memo, entry->older)->newer = entry->newer;
+    }
+    else {
+        memo->oldest = entry->newer;
+    }
+}
+
+static void markUsed(struct Memo* memo, int64_t index) {
+    struct Entry* entry = getEntry(memo, index);
+    entry->newer = NONE;
+    entry->older = memo->newest;
+    if (memo->newest != NONE) {
+        getEntry(memo, memo->newest)->newer = index;
+    }
+    else {
+        memo->oldest = index;
+    }
+    memo->newest = index;
+}
+
+// takes the least recently used entry out of its bucket and the list, returns its index
+static int64_t evict(struct Memo* memo) {
+    int64_t index = memo->oldest;
+    int64_t* link = &memo->buckets[getEntry(memo, index)->hash & memo->bucketMask];
+    while (*link != index) {
+        link = &getEntry(memo, *link)->next;
+    }
+    *link = getEntry(memo, index)->next;
+    unlinkUse(memo, index);
+    return index;
+}
+
+// True and the cached result if the function was called with the arguments before.
+bool oolong_memo_find(struct Memo* _Atomic* handle, int64_t argumentCount, int64_t limit, const int64_t* arguments, int64_t* result) {
+    struct Memo* memo = getMemo(handle, argumentCount, limit);
+    uint64_t hash = hashArguments(arguments, argumentCount);
+    pthread_mutex_lock(&memo->lock);
+    int64_t index = find(memo, arguments, hash);
+    if (index != NONE) {
+        *result = getEntry(memo, index)->result;
+        if (memo->limit > 0) {
+            unlinkUse(memo, index);
+            markUsed(memo, index);
+        }
+    }
+    pthread_mutex_unlock(&memo->lock);
+    return index != NONE;
+}
+
+void oolong_memo_store(struct Memo* _Atomic* handle, int64_t argumentCount, int64_t limit, const int64_t* arguments, int64_t result) {
+    struct Memo* memo = getMemo(handle, argumentCount, limit);
+    uint64_t hash = hashArguments(arguments, argumentCount);
+    pthread_mutex_lock(&memo->lock);
+    // another thread might have stored the same result meanwhile
+    if (find(memo, arguments, hash) != NONE) {
+        pthread_mutex_unlock(&memo->lock);
+        return;
+    }
+    int64_t index;
+    if (memo->limit > 0 && memo->count == memo->limit) {
+        index = evict(memo);
+    }
+    else {
+        if (memo->count == memo->capacity) {
+            int64_t capacity = 2 * memo->capacity;
+            resize(memo, memo->limit > 0 && capacity > memo->limit ? memo->limit : capacity);
+        }
+        index = memo->count++;
+    }
+    struct Entry* entry = getEntry(memo, index);
+    entry->hash = hash;
+    entry->result = result;
+    memcpy(entry->arguments, arguments, argumentCount * sizeof(int64_t));
+    int64_t* bucket = &memo->buckets[hash & memo->bucketMask];
+    entry->next = *bucket;
+    *bucket = index;
+    if (memo->limit > 0) {
+        markUsed(memo, index);
+    }
+    pthread_mutex_unlock(&memo->lock);
+}
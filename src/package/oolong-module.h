@@ -1,13 +1,69 @@
 #ifndef OOLONG_MODULE_H
 #define OOLONG_MODULE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+// A String either owns its characters or is a view (slice) of characters owned by something else.
+// Views have allocatedSize 0 and are not terminated, always use usedSize.
 struct String {
     char* value;
-    int64_t allocatedSize;
+    int64_t allocatedSize; // bytes of value that may be written, 0 if value is not owned (views, literals)
     int64_t usedSize;
+    struct String* owner; // String owning the characters of a view, NULL if they are constant or mapped
 };
 
+// Runtime internals shared between packages, not visible to Oolong code.
+
+// large enough for any formatted Integer or Double, including the terminator
+#define OOLONG_NUMBER_BUFFER_SIZE 32
+
+int oolong_format_integer(char* destination, int64_t value);
+int oolong_format_double(char* destination, double value);
+bool oolong_parse_integer(const char* characters, int64_t length, int64_t* result);
+bool oolong_parse_double(const char* characters, int64_t length, double* result);
+void oolong_set_view(struct String* view, struct String* source, char* characters, int64_t length);
+bool oolong_split(struct String* rest, struct String* field, struct String* separator);
+
+// Work-stealing thread pool (scheduler.c). Tasks are run by whichever worker pops or steals them,
+// their frames should come from oolong_task_allocate and be at most OOLONG_TASK_FRAME_SIZE bytes.
+#define OOLONG_TASK_FRAME_SIZE 128
+
+struct OolongTask {
+    void (*run)(struct OolongTask* task);
+    bool needsWorker; // uses the index of the worker running it, so helper threads leave it alone
+};
+
+int oolong_scheduler_start(); // returns the number of workers
+int oolong_scheduler_worker_index(); // -1 if the calling thread is not a worker
+void oolong_scheduler_submit(struct OolongTask* task);
+bool oolong_scheduler_run_task(); // runs one pending task, false if none was found
+bool oolong_scheduler_has_local_tasks();
+void oolong_scheduler_blocking(); // the calling thread is about to block, e.g. on a Channel
+void* oolong_task_allocate();
+void oolong_task_free(void* frame);
+
+// Bounded lock-free multi-producer multi-consumer ring of 64 bit values (atomic.c), the capacity
+// is rounded up to a power of two of at least 2. Used by Queue and Channel.
+struct OolongRingCell {
+    _Atomic int64_t sequence;
+    int64_t value;
+};
+
+struct OolongRing {
+    struct OolongRingCell* cells;
+    int64_t mask;
+    char padding[64 - sizeof(struct OolongRingCell*) - sizeof(int64_t)];
+    _Atomic int64_t enqueuePosition;
+    char enqueuePadding[64 - sizeof(int64_t)];
+    _Atomic int64_t dequeuePosition;
+    char dequeuePadding[64 - sizeof(int64_t)];
+};
+
+void oolong_ring_initialize(struct OolongRing* ring, int64_t capacity);
+bool oolong_ring_enqueue(struct OolongRing* ring, int64_t value, int64_t* position); // position may be NULL
+bool oolong_ring_dequeue(struct OolongRing* ring, int64_t* value);
+int64_t oolong_ring_size(struct OolongRing* ring);
+
 #endif
 
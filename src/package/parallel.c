@@ -0,0 +1,148 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runtime side of `parallel for`. The compiler outlines the loop body into
+//
+//   void body(void* environment, int64_t start, int64_t end, int64_t* partials)
+//
+// which runs the iterations start to end - 1 and adds its share of every
+// reduction to partials. Ranges are split lazily: a worker only hands out the
+// upper half of its remaining range when its own deque is empty, i.e. when the
+// previously handed out work has been stolen. Chunk sizes therefore adapt to
+// how busy the other workers are instead of being fixed up front.
+
+#include "oolong-module.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXIMUM_REDUCTIONS 8
+// smallest chunk relative to the whole loop, per worker, so the body call overhead stays small
+#define CHUNKS_PER_WORKER 64
+
+typedef void (*LoopBody)(void* environment, int64_t start, int64_t end, int64_t* partials);
+
+// one cache line per worker, so reductions don't share lines between workers
+struct Partials {
+    int64_t values[MAXIMUM_REDUCTIONS];
+} __attribute__((aligned(64)));
+
+struct Loop {
+    LoopBody body;
+    void* environment;
+    int64_t grain;
+    _Atomic int64_t remaining; // iterations not completed yet
+    struct Partials* partials;
+};
+
+struct RangeTask {
+    struct OolongTask task;
+    struct Loop* loop;
+    int64_t start;
+    int64_t end;
+};
+
+static void runRange(struct Loop* loop, int64_t start, int64_t end);
+
+static void runRangeTask(struct OolongTask* task) {
+    struct RangeTask* rangeTask = (struct RangeTask*) task;
+    struct Loop* loop = rangeTask->loop;
+    int64_t start = rangeTask->start;
+    int64_t end = rangeTask->end;
+    oolong_task_free(rangeTask);
+    runRange(loop, start, end);
+}
+
+static void runRange(struct Loop* loop, int64_t start, int64_t end) {
+    int64_t* partials = loop->partials[oolong_scheduler_worker_index()].values;
+    while (start < end) {
+        if (end - start >= 2 * loop->grain && !oolong_scheduler_has_local_tasks()) {
+            // whatever we handed out before has been taken, offer half of the rest
+            int64_t middle = start + (end - start) / 2;
+            struct RangeTask* rangeTask = oolong_task_allocate();
+            rangeTask->task.run = runRangeTask;
+            rangeTask->task.needsWorker = true;
+            rangeTask->loop = loop;
+            rangeTask->start = middle;
+            rangeTask->end = end;
+            end = middle;
+            oolong_scheduler_submit(&rangeTask->task);
+        }
+        int64_t chunkEnd = end - start > loop->grain ? start + loop->grain : end;
+        loop->body(loop->environment, start, chunkEnd, partials);
+        // last access to the loop, which lives on the stack of the thread waiting for it
+        atomic_fetch_sub_explicit(&loop->remaining, chunkEnd - start, memory_order_release);
+        start = chunkEnd;
+    }
+}
+
+// doubleReductions has bit i set if reduction i is a Double, the sums are written to results.
+void oolong_parallel_for(LoopBody body, void* environment, int64_t start, int64_t end,
+                         int64_t reductionCount, int64_t doubleReductions, int64_t* results) {
+    memset(results, 0, MAXIMUM_REDUCTIONS * sizeof(int64_t));
+    if (start >= end) {
+        return;
+    }
+    int workerCount = oolong_scheduler_start();
+    if (workerCount == 1 || oolong_scheduler_worker_index() < 0 || end - start == 1) {
+        body(environment, start, end, results);
+        return;
+    }
+
+    struct Loop loop;
+    loop.body = body;
+    loop.environment = environment;
+    loop.grain = (end - start) / (workerCount * CHUNKS_PER_WORKER);
+    if (loop.grain < 1) {
+        loop.grain = 1;
+    }
+    atomic_init(&loop.remaining, end - start);
+    loop.partials = aligned_alloc(sizeof(struct Partials), workerCount * sizeof(struct Partials));
+    if (loop.partials == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a parallel loop.\n");
+        exit(1);
+    }
+    memset(loop.partials, 0, workerCount * sizeof(struct Partials));
+
+    runRange(&loop, start, end);
+    // help with the rest, this also runs nested loops' tasks
+    while (atomic_load_explicit(&loop.remaining, memory_order_acquire) > 0) {
+        oolong_scheduler_run_task();
+    }
+
+    // combined in worker order
+    for (int64_t i=0; i<reductionCount && i<MAXIMUM_REDUCTIONS; i++) {
+        if (doubleReductions & (1 << i)) {
+            double sum = 0.0;
+            for (int worker=0; worker<workerCount; worker++) {
+                double partial;
+                memcpy(&partial, &loop.partials[worker].values[i], sizeof(double));
+                sum += partial;
+            }
+            memcpy(&results[i], &sum, sizeof(double));
+        }
+        else {
+            int64_t sum = 0;
+            for (int worker=0; worker<workerCount; worker++) {
+                sum += loop.partials[worker].values[i];
+            }
+            results[i] = sum;
+        }
+    }
+    free(loop.partials);
+}
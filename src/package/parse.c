@@ -0,0 +1,280 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Number parsing kernels shared by the packages. They read exactly length
+// bytes (no terminator needed), accept surrounding whitespace, don't depend
+// on the locale and report whether the whole input was a valid number.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // strtod_l
+#endif
+#include "oolong-module.h"
+#include <locale.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+#define SWAR_DIGITS 8
+#define MAXIMUM_INTEGER_DIGITS 19
+// up to 10^22 powers of ten are exact doubles
+#define MAXIMUM_EXACT_POWER 22
+#define MAXIMUM_EXACT_MANTISSA (UINT64_C(1) << 53)
+// beyond this the exponent only decides between zero and infinity
+#define MAXIMUM_EXPONENT 100000
+#define FALLBACK_BUFFER_SIZE 128
+
+static const double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static uint64_t loadEightBytes(const char* characters) {
+    uint64_t value;
+    memcpy(&value, characters, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+// true if all eight bytes are ASCII digits
+static bool areEightDigits(uint64_t value) {
+    return ((value & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+            (((value + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) == UINT64_C(0x3333333333333333);
+}
+
+// value of eight ASCII digits, the first digit in the lowest byte
+static uint32_t parseEightDigits(uint64_t value) {
+    const uint64_t mask = UINT64_C(0x000000FF000000FF);
+    const uint64_t multiplier1 = UINT64_C(0x000F424000000064); // 100 + (1000000 << 32)
+    const uint64_t multiplier2 = UINT64_C(0x0000271000000001); // 1 + (10000 << 32)
+    value -= UINT64_C(0x3030303030303030);
+    value = (value * 10) + (value >> 8); // pairs of digits
+    value = (((value & mask) * multiplier1) + (((value >> 16) & mask) * multiplier2)) >> 32;
+    return (uint32_t) value;
+}
+
+// Accumulates digits at position into value, 8 at a time while possible. Returns the number of digits.
+static int64_t parseDigits(const char* characters, int64_t position, int64_t end, uint64_t* value, int64_t maximumDigits) {
+    const int64_t start = position;
+    uint64_t accumulated = *value;
+    while (end - position >= SWAR_DIGITS && (position - start) + SWAR_DIGITS <= maximumDigits) {
+        uint64_t eightCharacters = loadEightBytes(characters + position);
+        if (!areEightDigits(eightCharacters)) {
+            break;
+        }
+        accumulated = accumulated * 100000000 + parseEightDigits(eightCharacters);
+        position += SWAR_DIGITS;
+    }
+    while (position < end && (position - start) < maximumDigits && isDigit(characters[position])) {
+        accumulated = accumulated * 10 + (characters[position] - '0');
+        position++;
+    }
+    *value = accumulated;
+    return position - start;
+}
+
+static void trimWhitespace(const char* characters, int64_t* start, int64_t* end) {
+    while (*start < *end && isWhitespace(characters[*start])) {
+        (*start)++;
+    }
+    while (*end > *start && isWhitespace(characters[*end - 1])) {
+        (*end)--;
+    }
+}
+
+bool oolong_parse_integer(const char* characters, int64_t length, int64_t* result) {
+    int64_t position = 0;
+    int64_t end = length;
+    trimWhitespace(characters, &position, &end);
+
+    bool negative = false;
+    if (position < end && (characters[position] == '-' || characters[position] == '+')) {
+        negative = characters[position] == '-';
+        position++;
+    }
+    if (position == end) {
+        return false;
+    }
+    // leading zeros don't count towards the digit limit
+    while (end - position > 1 && characters[position] == '0') {
+        position++;
+    }
+
+    uint64_t value = 0;
+    position += parseDigits(characters, position, end, &value, MAXIMUM_INTEGER_DIGITS);
+    if (position != end) {
+        // not a digit or too many digits
+        return false;
+    }
+    const uint64_t limit = negative ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX;
+    if (value > limit) {
+        return false;
+    }
+    *result = negative ? (int64_t) (0 - value) : (int64_t) value;
+    return true;
+}
+
+static bool matchesIgnoringCase(const char* characters, int64_t length, const char* word) {
+    const int64_t wordLength = (int64_t) strlen(word);
+    if (length != wordLength) {
+        return false;
+    }
+    for (int64_t i=0; i<length; i++) {
+        if ((characters[i] | 0x20) != word[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// rare inputs (more than 19 significant digits, huge exponents) are left to the C library, in the C locale
+static double parseDoubleFallback(const char* characters, int64_t length) {
+    static locale_t cLocale = (locale_t) 0;
+    if (cLocale == (locale_t) 0) {
+        cLocale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+    }
+    char buffer[FALLBACK_BUFFER_SIZE];
+    char* copy = length < FALLBACK_BUFFER_SIZE ? buffer : malloc(length + 1);
+    if (copy == NULL) {
+        return 0.0;
+    }
+    memcpy(copy, characters, length);
+    copy[length] = '\0';
+    double value = strtod_l(copy, NULL, cLocale);
+    if (copy != buffer) {
+        free(copy);
+    }
+    return value;
+}
+
+bool oolong_parse_double(const char* characters, int64_t length, double* result) {
+    int64_t position = 0;
+    int64_t end = length;
+    trimWhitespace(characters, &position, &end);
+    const int64_t start = position;
+
+    bool negative = false;
+    if (position < end && (characters[position] == '-' || characters[position] == '+')) {
+        negative = characters[position] == '-';
+        position++;
+    }
+    if (matchesIgnoringCase(characters + position, end - position, "inf") ||
+            matchesIgnoringCase(characters + position, end - position, "infinity")) {
+        *result = negative ? -__builtin_inf() : __builtin_inf();
+        return true;
+    }
+    if (matchesIgnoringCase(characters + position, end - position, "nan")) {
+        *result = __builtin_nan("");
+        return true;
+    }
+
+    // mantissa, the first 19 significant digits are exact in 64 bits
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+    while (position < end && characters[position] == '0') {
+        position++;
+    }
+    int64_t integerDigits = parseDigits(characters, position, end, &mantissa, MAXIMUM_INTEGER_DIGITS);
+    position += integerDigits;
+    while (position < end && isDigit(characters[position])) {
+        // beyond the exact digits
+        truncated |= characters[position] != '0';
+        exponent++;
+        position++;
+    }
+    bool hasDigits = integerDigits > 0 || (position > start && characters[position-1] == '0');
+    if (position < end && characters[position] == '.') {
+        position++;
+        const int64_t fractionStart = position;
+        if (mantissa == 0) {
+            // leading zeros of the fraction only move the decimal point
+            while (position < end && characters[position] == '0') {
+                position++;
+            }
+            exponent -= position - fractionStart;
+        }
+        const int64_t significantDigits = integerDigits;
+        int64_t fractionDigits = parseDigits(characters, position, end, &mantissa, MAXIMUM_INTEGER_DIGITS - significantDigits);
+        position += fractionDigits;
+        exponent -= fractionDigits;
+        while (position < end && isDigit(characters[position])) {
+            truncated |= characters[position] != '0';
+            position++;
+        }
+        hasDigits |= position > fractionStart;
+    }
+    if (!hasDigits) {
+        return false;
+    }
+    if (position < end && (characters[position] == 'e' || characters[position] == 'E')) {
+        position++;
+        bool negativeExponent = false;
+        if (position < end && (characters[position] == '-' || characters[position] == '+')) {
+            negativeExponent = characters[position] == '-';
+            position++;
+        }
+        if (position == end || !isDigit(characters[position])) {
+            return false;
+        }
+        int64_t explicitExponent = 0;
+        while (position < end && isDigit(characters[position])) {
+            if (explicitExponent < MAXIMUM_EXPONENT) {
+                explicitExponent = explicitExponent * 10 + (characters[position] - '0');
+            }
+            position++;
+        }
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+    if (position != end) {
+        return false;
+    }
+
+    double value;
+    if (mantissa == 0) {
+        value = 0.0;
+    }
+    else if (!truncated && mantissa <= MAXIMUM_EXACT_MANTISSA && exponent >= -MAXIMUM_EXACT_POWER && exponent <= MAXIMUM_EXACT_POWER) {
+        // both operands are exact, so the single rounding of the operation gives the correct result (Clinger's fast path)
+        value = (double) mantissa;
+        if (exponent < 0) {
+            value /= EXACT_POWERS_OF_TEN[-exponent];
+        }
+        else {
+            value *= EXACT_POWERS_OF_TEN[exponent];
+        }
+    }
+    else {
+        *result = parseDoubleFallback(characters + start, end - start);
+        return true;
+    }
+    *result = negative ? -value : value;
+    return true;
+}
@@ -0,0 +1,699 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Statistical CPU profiler.  Every Oolong program calls
+// oolong_profiler_initialize at start-up; when OOLONG_PROFILE=<file> is set
+// the process is sampled on SIGPROF and a pprof profile (gzipped if the file
+// name ends in .gz) is written at exit and whenever SIGUSR2 is received.
+//
+//   OOLONG_PROFILE=cpu.pb.gz ./a.out && pprof -top a.out cpu.pb.gz
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define DEFAULT_FREQUENCY 100 // samples per second
+#define MAXIMUM_FREQUENCY 1000000 // the timer counts microseconds
+#define MAXIMUM_FRAMES 64
+#define SKIPPED_FRAMES 2 // signal handler and signal trampoline
+#define MAXIMUM_STACKS 8192 // distinct stacks, must be a power of two
+
+struct StackSample {
+    uint64_t count;
+    uint32_t depth;
+    uintptr_t frames[MAXIMUM_FRAMES];
+};
+
+struct Symbol {
+    uintptr_t start;
+    uintptr_t end;
+    const char* name;
+};
+
+struct Mapping {
+    uintptr_t start;
+    uintptr_t end;
+    uint64_t offset;
+    char* path;
+    bool symbolized;
+};
+
+struct Buffer {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+};
+
+static const char* profilePath = NULL;
+static struct StackSample* stacks = NULL;
+static volatile int sampling = 0; // set while a sample is recorded or the table is copied
+static _Atomic uint64_t droppedSamples = 0; // by every thread taking SIGPROF
+static int64_t period = 0; // nanoseconds between samples
+static int64_t startTime = 0;
+
+//// sampling
+
+static uint64_t hashFrames(uintptr_t* frames, int depth) {
+    // FNV-1a over the addresses
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i=0; i<depth; i++) {
+        hash ^= (uint64_t) frames[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uintptr_t interruptedAddress(void* context) {
+    ucontext_t* userContext = context;
+#if defined(__x86_64__)
+    return (uintptr_t) userContext->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return (uintptr_t) userContext->uc_mcontext.pc;
+#else
+    (void) userContext;
+    return 0;
+#endif
+}
+
+static void recordSample(int signal, siginfo_t* information, void* context) {
+    int savedErrno = errno;
+    if (__atomic_exchange_n(&sampling, 1, __ATOMIC_ACQUIRE)) {
+        // table is being copied (or another thread is sampling)
+        atomic_fetch_add_explicit(&droppedSamples, 1, memory_order_relaxed);
+        errno = savedErrno;
+        return;
+    }
+
+    void* addresses[MAXIMUM_FRAMES + SKIPPED_FRAMES];
+    int count = backtrace(addresses, MAXIMUM_FRAMES + SKIPPED_FRAMES);
+    // start at the interrupted instruction, fall back to skipping the handler frames
+    int first = count < SKIPPED_FRAMES ? count : SKIPPED_FRAMES;
+    uintptr_t leaf = interruptedAddress(context);
+    for (int i=0; i<count && i<=SKIPPED_FRAMES+1; i++) {
+        if ((uintptr_t) addresses[i] == leaf) {
+            first = i;
+            break;
+        }
+    }
+    uintptr_t frames[MAXIMUM_FRAMES];
+    int depth = 0;
+    for (int i=first; i<count && depth<MAXIMUM_FRAMES; i++) {
+        frames[depth++] = (uintptr_t) addresses[i];
+    }
+
+    uint64_t hash = hashFrames(frames, depth);
+    bool recorded = false;
+    for (uint64_t probe=0; probe<MAXIMUM_STACKS; probe++) {
+        struct StackSample* stack = &stacks[(hash + probe) & (MAXIMUM_STACKS - 1)];
+        if (stack->count == 0) {
+            stack->depth = depth;
+            memcpy(stack->frames, frames, depth * sizeof(uintptr_t));
+        }
+        else if (stack->depth != (uint32_t) depth || memcmp(stack->frames, frames, depth * sizeof(uintptr_t)) != 0) {
+            continue;
+        }
+        stack->count++;
+        recorded = true;
+        break;
+    }
+    if (!recorded) {
+        atomic_fetch_add_explicit(&droppedSamples, 1, memory_order_relaxed);
+    }
+
+    __atomic_store_n(&sampling, 0, __ATOMIC_RELEASE);
+    errno = savedErrno;
+}
+
+static struct StackSample* copyStacks() {
+    struct StackSample* copy = malloc(MAXIMUM_STACKS * sizeof(struct StackSample));
+    if (copy == NULL) {
+        return NULL;
+    }
+    while (__atomic_exchange_n(&sampling, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    memcpy(copy, stacks, MAXIMUM_STACKS * sizeof(struct StackSample));
+    __atomic_store_n(&sampling, 0, __ATOMIC_RELEASE);
+    return copy;
+}
+
+//// symbolization
+
+static uintptr_t executableLoadBias = 0;
+
+static int findExecutable(struct dl_phdr_info* information, size_t size, void* data) {
+    // the first object reported is the executable itself
+    executableLoadBias = information->dlpi_addr;
+    return 1;
+}
+
+static int compareSymbols(const void* left, const void* right) {
+    const struct Symbol* leftSymbol = left;
+    const struct Symbol* rightSymbol = right;
+    if (leftSymbol->start == rightSymbol->start) {
+        return 0;
+    }
+    return leftSymbol->start < rightSymbol->start ? -1 : 1;
+}
+
+// Read the function symbols of our own executable, internal Oolong functions
+// are only listed in .symtab, which dladdr doesn't look at.
+static size_t loadExecutableSymbols(struct Symbol** symbols, void** image, size_t* imageSize) {
+    *symbols = NULL;
+    *image = NULL;
+    int file = open("/proc/self/exe", O_RDONLY);
+    if (file < 0) {
+        return 0;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || (size_t) status.st_size < sizeof(Elf64_Ehdr)) {
+        close(file);
+        return 0;
+    }
+    *imageSize = status.st_size;
+    *image = mmap(NULL, *imageSize, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (*image == MAP_FAILED) {
+        *image = NULL;
+        return 0;
+    }
+
+    const uint8_t* bytes = *image;
+    const Elf64_Ehdr* header = *image;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64
+            || header->e_shoff + (uint64_t) header->e_shnum * sizeof(Elf64_Shdr) > *imageSize) {
+        return 0;
+    }
+    dl_iterate_phdr(findExecutable, NULL);
+
+    const Elf64_Shdr* sections = (const Elf64_Shdr*) (bytes + header->e_shoff);
+    size_t count = 0;
+    for (int i=0; i<header->e_shnum; i++) {
+        if (sections[i].sh_type != SHT_SYMTAB || sections[i].sh_link >= header->e_shnum) {
+            continue;
+        }
+        const Elf64_Shdr* stringSection = &sections[sections[i].sh_link];
+        const Elf64_Sym* elfSymbols = (const Elf64_Sym*) (bytes + sections[i].sh_offset);
+        size_t elfSymbolCount = sections[i].sh_size / sizeof(Elf64_Sym);
+        *symbols = realloc(*symbols, (count + elfSymbolCount) * sizeof(struct Symbol));
+        if (*symbols == NULL) {
+            return 0;
+        }
+        for (size_t s=0; s<elfSymbolCount; s++) {
+            const Elf64_Sym* elfSymbol = &elfSymbols[s];
+            if (ELF64_ST_TYPE(elfSymbol->st_info) != STT_FUNC || elfSymbol->st_value == 0 || elfSymbol->st_name >= stringSection->sh_size) {
+                continue;
+            }
+            struct Symbol* symbol = &(*symbols)[count++];
+            symbol->start = executableLoadBias + elfSymbol->st_value;
+            symbol->end = symbol->start + (elfSymbol->st_size > 0 ? elfSymbol->st_size : 1);
+            symbol->name = (const char*) (bytes + stringSection->sh_offset + elfSymbol->st_name);
+        }
+    }
+    if (count > 0) {
+        qsort(*symbols, count, sizeof(struct Symbol), compareSymbols);
+    }
+    return count;
+}
+
+static const char* findSymbol(struct Symbol* symbols, size_t count, uintptr_t address) {
+    // binary search for the last symbol starting at or before the address
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (symbols[middle].start <= address) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if (low > 0 && address < symbols[low-1].end) {
+        return symbols[low-1].name;
+    }
+    // not in our executable, try shared libraries
+    Dl_info information;
+    if (dladdr((void*) address, &information) != 0 && information.dli_sname != NULL) {
+        return information.dli_sname;
+    }
+    return NULL;
+}
+
+static size_t loadMappings(struct Mapping** mappings) {
+    *mappings = NULL;
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps == NULL) {
+        return 0;
+    }
+    char executablePath[4096] = "";
+    ssize_t length = readlink("/proc/self/exe", executablePath, sizeof(executablePath) - 1);
+    executablePath[length > 0 ? length : 0] = '\0';
+
+    size_t count = 0;
+    char* line = NULL;
+    size_t lineLength = 0;
+    while (getline(&line, &lineLength, maps) > 0) {
+        unsigned long long start, end, offset;
+        char permissions[5];
+        int pathStart = 0;
+        if (sscanf(line, "%llx-%llx %4s %llx %*s %*s %n", &start, &end, permissions, &offset, &pathStart) < 4 || permissions[2] != 'x') {
+            continue;
+        }
+        char* path = line + pathStart;
+        path[strcspn(path, "\n")] = '\0';
+        struct Mapping* grown = realloc(*mappings, (count + 1) * sizeof(struct Mapping));
+        if (grown == NULL) {
+            break;
+        }
+        *mappings = grown;
+        struct Mapping* mapping = &(*mappings)[count++];
+        mapping->start = start;
+        mapping->end = end;
+        mapping->offset = offset;
+        mapping->path = strdup(path);
+        mapping->symbolized = (strcmp(path, executablePath) == 0);
+    }
+    free(line);
+    fclose(maps);
+    return count;
+}
+
+//// protocol buffer encoding (see pprof's profile.proto)
+
+static void append(struct Buffer* buffer, const void* data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+        uint8_t* data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void appendVarint(struct Buffer* buffer, uint64_t value) {
+    uint8_t bytes[10];
+    size_t size = 0;
+    do {
+        bytes[size] = value & 0x7f;
+        value >>= 7;
+        if (value != 0) {
+            bytes[size] |= 0x80;
+        }
+        size++;
+    } while (value != 0);
+    append(buffer, bytes, size);
+}
+
+static void appendInteger(struct Buffer* buffer, int field, uint64_t value) {
+    if (value == 0) {
+        // default value, no need to write it
+        return;
+    }
+    appendVarint(buffer, (uint64_t) field << 3); // wire type 0
+    appendVarint(buffer, value);
+}
+
+static void appendBytes(struct Buffer* buffer, int field, const void* data, size_t size) {
+    appendVarint(buffer, ((uint64_t) field << 3) | 2); // wire type 2
+    appendVarint(buffer, size);
+    append(buffer, data, size);
+}
+
+static void appendMessage(struct Buffer* buffer, int field, struct Buffer* message) {
+    appendBytes(buffer, field, message->data, message->size);
+    message->size = 0;
+}
+
+struct StringTable {
+    const char** strings;
+    size_t count;
+};
+
+static int64_t internString(struct StringTable* table, const char* string) {
+    for (size_t i=0; i<table->count; i++) {
+        if (strcmp(table->strings[i], string) == 0) {
+            return i;
+        }
+    }
+    const char** strings = realloc(table->strings, (table->count + 1) * sizeof(const char*));
+    if (strings == NULL) {
+        return 0;
+    }
+    table->strings = strings;
+    table->strings[table->count] = string;
+    return table->count++;
+}
+
+static void appendValueType(struct Buffer* buffer, int field, struct StringTable* strings, const char* type, const char* unit) {
+    struct Buffer message = { NULL, 0, 0 };
+    appendInteger(&message, 1, internString(strings, type));
+    appendInteger(&message, 2, internString(strings, unit));
+    appendMessage(buffer, field, &message);
+    free(message.data);
+}
+
+static int compareAddresses(const void* left, const void* right) {
+    uintptr_t leftAddress = *(const uintptr_t*) left;
+    uintptr_t rightAddress = *(const uintptr_t*) right;
+    if (leftAddress == rightAddress) {
+        return 0;
+    }
+    return leftAddress < rightAddress ? -1 : 1;
+}
+
+static uint64_t findLocation(uintptr_t* addresses, size_t count, uintptr_t address) {
+    uintptr_t* found = bsearch(&address, addresses, count, sizeof(uintptr_t), compareAddresses);
+    return found == NULL ? 0 : (found - addresses) + 1;
+}
+
+static void encodeProfile(struct Buffer* profile, struct StackSample* samples) {
+    struct StringTable strings = { NULL, 0 };
+    internString(&strings, ""); // index 0 must be the empty string
+    struct Buffer message = { NULL, 0, 0 };
+    struct Buffer line = { NULL, 0, 0 };
+
+    appendValueType(profile, 1, &strings, "samples", "count");
+    appendValueType(profile, 1, &strings, "cpu", "nanoseconds");
+
+    // callers are return addresses, point them into the call instruction instead
+    for (size_t s=0; s<MAXIMUM_STACKS; s++) {
+        for (uint32_t f=1; f<samples[s].depth; f++) {
+            samples[s].frames[f]--;
+        }
+    }
+
+    // unique addresses become locations (id = index + 1)
+    size_t addressCount = 0;
+    for (size_t s=0; s<MAXIMUM_STACKS; s++) {
+        addressCount += samples[s].depth;
+    }
+    uintptr_t* addresses = malloc((addressCount + 1) * sizeof(uintptr_t));
+    size_t uniqueCount = 0;
+    if (addresses != NULL) {
+        for (size_t s=0; s<MAXIMUM_STACKS; s++) {
+            memcpy(addresses + uniqueCount, samples[s].frames, samples[s].depth * sizeof(uintptr_t));
+            uniqueCount += samples[s].depth;
+        }
+        qsort(addresses, uniqueCount, sizeof(uintptr_t), compareAddresses);
+        size_t unique = 0;
+        for (size_t i=0; i<uniqueCount; i++) {
+            if (unique == 0 || addresses[unique-1] != addresses[i]) {
+                addresses[unique++] = addresses[i];
+            }
+        }
+        uniqueCount = unique;
+    }
+
+    // samples
+    for (size_t s=0; s<MAXIMUM_STACKS; s++) {
+        if (samples[s].count == 0) {
+            continue;
+        }
+        struct Buffer locationIds = { NULL, 0, 0 };
+        for (uint32_t f=0; f<samples[s].depth; f++) {
+            appendVarint(&locationIds, findLocation(addresses, uniqueCount, samples[s].frames[f]));
+        }
+        struct Buffer values = { NULL, 0, 0 };
+        appendVarint(&values, samples[s].count);
+        appendVarint(&values, samples[s].count * period);
+        appendBytes(&message, 1, locationIds.data, locationIds.size); // packed
+        appendBytes(&message, 2, values.data, values.size); // packed
+        appendMessage(profile, 2, &message);
+        free(locationIds.data);
+        free(values.data);
+    }
+
+    // mappings
+    struct Mapping* mappings = NULL;
+    size_t mappingCount = loadMappings(&mappings);
+    for (size_t m=0; m<mappingCount; m++) {
+        appendInteger(&message, 1, m + 1);
+        appendInteger(&message, 2, mappings[m].start);
+        appendInteger(&message, 3, mappings[m].end);
+        appendInteger(&message, 4, mappings[m].offset);
+        appendInteger(&message, 5, internString(&strings, mappings[m].path));
+        appendInteger(&message, 7, mappings[m].symbolized);
+        appendMessage(profile, 3, &message);
+    }
+
+    // locations and functions (function id = string index of its name)
+    struct Symbol* symbols = NULL;
+    void* image = NULL;
+    size_t imageSize = 0;
+    size_t symbolCount = loadExecutableSymbols(&symbols, &image, &imageSize);
+    struct Buffer functions = { NULL, 0, 0 };
+    bool* declared = calloc(1, sizeof(bool));
+    size_t declaredCount = 1;
+    for (size_t a=0; a<uniqueCount; a++) {
+        appendInteger(&message, 1, a + 1);
+        for (size_t m=0; m<mappingCount; m++) {
+            if (addresses[a] >= mappings[m].start && addresses[a] < mappings[m].end) {
+                appendInteger(&message, 2, m + 1);
+                break;
+            }
+        }
+        appendInteger(&message, 3, addresses[a]);
+        const char* name = findSymbol(symbols, symbolCount, addresses[a]);
+        int64_t nameIndex = name == NULL ? 0 : internString(&strings, name);
+        if (nameIndex != 0) {
+            if ((size_t) nameIndex >= declaredCount) {
+                bool* grown = realloc(declared, (nameIndex + 1) * sizeof(bool));
+                if (grown != NULL) {
+                    declared = grown;
+                    memset(declared + declaredCount, 0, (nameIndex + 1 - declaredCount) * sizeof(bool));
+                    declaredCount = nameIndex + 1;
+                }
+            }
+            if ((size_t) nameIndex < declaredCount && !declared[nameIndex]) {
+                struct Buffer function = { NULL, 0, 0 };
+                appendInteger(&function, 1, nameIndex);
+                appendInteger(&function, 2, nameIndex);
+                appendInteger(&function, 3, nameIndex);
+                appendMessage(&functions, 5, &function);
+                free(function.data);
+                declared[nameIndex] = true;
+            }
+            appendInteger(&line, 1, nameIndex);
+            appendMessage(&message, 4, &line);
+        }
+        appendMessage(profile, 4, &message);
+    }
+    append(profile, functions.data, functions.size);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t nowNanoseconds = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    appendInteger(profile, 9, startTime);
+    appendInteger(profile, 10, nowNanoseconds - startTime);
+    struct Buffer periodType = { NULL, 0, 0 };
+    appendInteger(&periodType, 1, internString(&strings, "cpu"));
+    appendInteger(&periodType, 2, internString(&strings, "nanoseconds"));
+    appendMessage(profile, 11, &periodType);
+    appendInteger(profile, 12, period);
+
+    for (size_t i=0; i<strings.count; i++) {
+        appendBytes(profile, 6, strings.strings[i], strlen(strings.strings[i]));
+    }
+
+    free(periodType.data);
+    free(functions.data);
+    free(declared);
+    free(symbols);
+    if (image != NULL) {
+        munmap(image, imageSize);
+    }
+    for (size_t m=0; m<mappingCount; m++) {
+        free(mappings[m].path);
+    }
+    free(mappings);
+    free(addresses);
+    free(message.data);
+    free(line.data);
+    free(strings.strings);
+}
+
+//// gzip container (stored deflate blocks, pprof only needs the framing)
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i=0; i<256; i++) {
+            uint32_t value = i;
+            for (int bit=0; bit<8; bit++) {
+                value = (value & 1) ? (0xEDB88320 ^ (value >> 1)) : (value >> 1);
+            }
+            table[i] = value;
+        }
+    }
+    crc = ~crc;
+    for (size_t i=0; i<size; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void writeGzip(FILE* output, const uint8_t* data, size_t size) {
+    static const uint8_t header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+    fwrite(header, 1, sizeof(header), output);
+    size_t position = 0;
+    do {
+        size_t blockSize = size - position > 65535 ? 65535 : size - position;
+        uint8_t final = (position + blockSize == size) ? 1 : 0;
+        uint8_t blockHeader[5] = { final, blockSize & 0xff, blockSize >> 8, ~blockSize & 0xff, (~blockSize >> 8) & 0xff };
+        fwrite(blockHeader, 1, sizeof(blockHeader), output);
+        fwrite(data + position, 1, blockSize, output);
+        position += blockSize;
+    } while (position < size);
+    uint32_t crc = crc32(0, data, size);
+    uint8_t trailer[8] = { crc, crc >> 8, crc >> 16, crc >> 24, size, size >> 8, size >> 16, size >> 24 };
+    fwrite(trailer, 1, sizeof(trailer), output);
+}
+
+// at exit and on SIGUSR2, possibly at the same time
+static pthread_mutex_t writeLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void writeProfile() {
+    pthread_mutex_lock(&writeLock);
+    struct StackSample* samples = copyStacks();
+    if (samples == NULL) {
+        pthread_mutex_unlock(&writeLock);
+        return;
+    }
+    struct Buffer profile = { NULL, 0, 0 };
+    encodeProfile(&profile, samples);
+
+    FILE* output = fopen(profilePath, "wb");
+    if (output == NULL) {
+        fprintf(stderr, "warning: Unable to write profile to %s\n", profilePath);
+    }
+    else {
+        size_t pathLength = strlen(profilePath);
+        if (pathLength > 3 && strcmp(profilePath + pathLength - 3, ".gz") == 0) {
+            writeGzip(output, profile.data, profile.size);
+        }
+        else {
+            fwrite(profile.data, 1, profile.size, output);
+        }
+        fclose(output);
+    }
+    uint64_t dropped = atomic_load_explicit(&droppedSamples, memory_order_relaxed);
+    if (dropped > 0) {
+        fprintf(stderr, "warning: Profiler dropped %llu samples.\n", (unsigned long long) dropped);
+    }
+    free(profile.data);
+    free(samples);
+    pthread_mutex_unlock(&writeLock);
+}
+
+static void stopProfiler() {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    writeProfile();
+}
+
+static void* waitForDumpSignal(void* argument) {
+    sigset_t* signals = argument;
+    int signal;
+    while (sigwait(signals, &signal) == 0) {
+        writeProfile();
+    }
+    return NULL;
+}
+
+void oolong_profiler_initialize() {
+    profilePath = getenv("OOLONG_PROFILE");
+    if (profilePath == NULL || profilePath[0] == '\0' || stacks != NULL) {
+        return;
+    }
+    long frequency = DEFAULT_FREQUENCY;
+    const char* frequencySetting = getenv("OOLONG_PROFILE_FREQUENCY");
+    if (frequencySetting != NULL && atol(frequencySetting) > 0) {
+        frequency = atol(frequencySetting);
+    }
+    if (frequency > MAXIMUM_FREQUENCY) {
+        // the period would round to 0, which turns the timer off
+        fprintf(stderr, "warning: Profiling frequency above %d, sampling %d times per second.\n", MAXIMUM_FREQUENCY, DEFAULT_FREQUENCY);
+        frequency = DEFAULT_FREQUENCY;
+    }
+    stacks = calloc(MAXIMUM_STACKS, sizeof(struct StackSample));
+    if (stacks == NULL) {
+        fprintf(stderr, "warning: Unable to allocate profiler memory, not profiling.\n");
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    startTime = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    period = 1000000000 / frequency;
+
+    // the first backtrace call may allocate (loading the unwinder), don't let that happen in the handler
+    void* warmUp[1];
+    backtrace(warmUp, 1);
+
+    // SIGUSR2 writes the profile collected so far, handled by a thread outside of signal context
+    static sigset_t dumpSignals;
+    sigemptyset(&dumpSignals);
+    sigaddset(&dumpSignals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &dumpSignals, NULL);
+    pthread_t dumpThread;
+    if (pthread_create(&dumpThread, NULL, waitForDumpSignal, &dumpSignals) == 0) {
+        pthread_detach(dumpThread);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = recordSample;
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = period / 1000000000;
+    timer.it_interval.tv_usec = (period % 1000000000) / 1000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    atexit(stopProfiler);
+}
@@ -0,0 +1,413 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Work-stealing thread pool shared by the parallel parts of the runtime.
+//
+// The thread that starts the pool (normally the main thread) becomes worker 0,
+// the remaining workers are threads started on first use. Every worker owns a
+// Chase-Lev deque: the owner pushes and pops at the bottom without locks,
+// idle workers steal from the top of a random victim. Workers that find
+// nothing to do for a while sleep until new tasks are submitted.
+//
+// The number of workers is OOLONG_THREADS if set, the number of online
+// processors otherwise.
+//
+// A thread that is about to block (e.g. receiving from a Channel) might wait
+// for one of the queued tasks, so unless a helper thread is already looking
+// for work it starts one that runs them meanwhile. Helpers aren't workers:
+// they only run tasks that don't need a worker index (futures) and exit
+// once there's nothing left to do. A helper can only tell what it stole
+// after it owns the task, tasks that need a worker go into a shared list
+// that workers take from before stealing.
+
+#include "oolong-module.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PAUSE() _mm_pause()
+#else
+#define PAUSE() sched_yield()
+#endif
+
+#define CACHE_LINE_SIZE 64
+#define DEQUE_CAPACITY 1024 // power of two
+#define MAXIMUM_WORKERS 256
+#define SPIN_ROUNDS 2048
+#define MAXIMUM_FREE_FRAMES 256
+#define MAXIMUM_HELPERS 256
+
+struct Deque {
+    _Atomic int64_t top; // next task to steal
+    char topPadding[CACHE_LINE_SIZE - sizeof(int64_t)];
+    _Atomic int64_t bottom; // next free slot of the owner
+    char bottomPadding[CACHE_LINE_SIZE - sizeof(int64_t)];
+    struct OolongTask* _Atomic tasks[DEQUE_CAPACITY];
+};
+
+struct FreeFrame {
+    struct FreeFrame* next;
+};
+
+struct Worker {
+    struct Deque deque;
+    int index;
+    uint64_t random;
+    struct FreeFrame* freeFrames;
+    int freeFrameCount;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct Worker* workers = NULL;
+static int workerCount = 1;
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+static __thread struct Worker* currentWorker = NULL;
+
+static pthread_mutex_t sleepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeUp = PTHREAD_COND_INITIALIZER;
+static _Atomic int sleepers = 0;
+static _Atomic int helpers = 0;
+static _Atomic int searchingHelpers = 0;
+
+static pthread_mutex_t handedBackLock = PTHREAD_MUTEX_INITIALIZER;
+static struct OolongTask** handedBack = NULL; // stolen by helpers, but needing a worker
+static int64_t handedBackCapacity = 0;
+static _Atomic int64_t handedBackCount = 0;
+
+// Deque, see "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.)
+
+static bool push(struct Deque* deque, struct OolongTask* task) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= DEQUE_CAPACITY) {
+        return false;
+    }
+    atomic_store_explicit(&deque->tasks[bottom & (DEQUE_CAPACITY - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+static struct OolongTask* pop(struct Deque* deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom) {
+        // empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    struct OolongTask* task = atomic_load_explicit(&deque->tasks[bottom & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // last task, race thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static struct OolongTask* steal(struct Deque* deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return NULL;
+    }
+    struct OolongTask* task = atomic_load_explicit(&deque->tasks[top & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        // lost against the owner or another thief, the task might not exist anymore
+        return NULL;
+    }
+    return task;
+}
+
+static void wakeSleeper() {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sleepers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&sleepLock);
+        pthread_cond_signal(&wakeUp);
+        pthread_mutex_unlock(&sleepLock);
+    }
+}
+
+static void handBack(struct OolongTask* task) {
+    pthread_mutex_lock(&handedBackLock);
+    int64_t count = atomic_load_explicit(&handedBackCount, memory_order_relaxed);
+    if (count == handedBackCapacity) {
+        int64_t capacity = handedBackCapacity > 0 ? 2 * handedBackCapacity : 16;
+        struct OolongTask** tasks = realloc(handedBack, capacity * sizeof(struct OolongTask*));
+        if (tasks == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate the thread pool.\n");
+            exit(1);
+        }
+        handedBack = tasks;
+        handedBackCapacity = capacity;
+    }
+    handedBack[count] = task;
+    atomic_store_explicit(&handedBackCount, count + 1, memory_order_release);
+    pthread_mutex_unlock(&handedBackLock);
+    wakeSleeper();
+}
+
+static struct OolongTask* takeHandedBack() {
+    if (atomic_load_explicit(&handedBackCount, memory_order_acquire) == 0) {
+        return NULL;
+    }
+    struct OolongTask* task = NULL;
+    pthread_mutex_lock(&handedBackLock);
+    int64_t count = atomic_load_explicit(&handedBackCount, memory_order_relaxed);
+    if (count > 0) {
+        task = handedBack[count - 1];
+        atomic_store_explicit(&handedBackCount, count - 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&handedBackLock);
+    return task;
+}
+
+static bool isEmpty(struct Deque* deque) {
+    return atomic_load_explicit(&deque->bottom, memory_order_relaxed) <= atomic_load_explicit(&deque->top, memory_order_relaxed);
+}
+
+static struct OolongTask* stealFromOthers(struct Worker* worker) {
+    // xorshift, victims are picked at random so thieves spread out
+    worker->random ^= worker->random << 13;
+    worker->random ^= worker->random >> 7;
+    worker->random ^= worker->random << 17;
+    int first = (int) (worker->random % workerCount);
+    for (int i=0; i<workerCount; i++) {
+        int victim = (first + i) % workerCount;
+        if (victim == worker->index) {
+            continue;
+        }
+        struct OolongTask* task = steal(&workers[victim].deque);
+        if (task != NULL) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static bool runTask(struct Worker* worker) {
+    struct OolongTask* task = pop(&worker->deque);
+    if (task == NULL) {
+        task = takeHandedBack();
+    }
+    if (task == NULL) {
+        task = stealFromOthers(worker);
+    }
+    if (task == NULL) {
+        return false;
+    }
+    task->run(task);
+    return true;
+}
+
+static bool anyTasks() {
+    if (atomic_load(&handedBackCount) > 0) {
+        return true;
+    }
+    for (int i=0; i<workerCount; i++) {
+        if (!isEmpty(&workers[i].deque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void sleepUntilWork() {
+    pthread_mutex_lock(&sleepLock);
+    atomic_fetch_add(&sleepers, 1);
+    // pairs with the fence in oolong_scheduler_submit: either the submitter sees a sleeper or we see the task
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!anyTasks()) {
+        pthread_cond_wait(&wakeUp, &sleepLock);
+    }
+    atomic_fetch_sub(&sleepers, 1);
+    pthread_mutex_unlock(&sleepLock);
+}
+
+static void* workerMain(void* argument) {
+    struct Worker* worker = argument;
+    currentWorker = worker;
+    for (;;) {
+        int idleRounds = 0;
+        while (idleRounds < SPIN_ROUNDS) {
+            if (runTask(worker)) {
+                idleRounds = 0;
+            }
+            else {
+                idleRounds++;
+                PAUSE();
+            }
+        }
+        sleepUntilWork();
+    }
+    return NULL;
+}
+
+static void* helperMain(void* argument) {
+    // counted as searching from its start, see oolong_scheduler_blocking
+    int idleRounds = 0;
+    while (idleRounds < SPIN_ROUNDS) {
+        struct OolongTask* task = NULL;
+        for (int i=0; task == NULL && i<workerCount; i++) {
+            task = steal(&workers[i].deque);
+            if (task != NULL && task->needsWorker) {
+                handBack(task);
+                task = NULL;
+            }
+        }
+        if (task != NULL) {
+            // the task might block, then somebody else has to look for work
+            atomic_fetch_sub(&searchingHelpers, 1);
+            task->run(task);
+            atomic_fetch_add(&searchingHelpers, 1);
+            idleRounds = 0;
+        }
+        else {
+            idleRounds++;
+            PAUSE();
+        }
+    }
+    atomic_fetch_sub(&searchingHelpers, 1);
+    atomic_fetch_sub(&helpers, 1);
+    return NULL;
+}
+
+static int configuredWorkerCount() {
+    const char* threads = getenv("OOLONG_THREADS");
+    long count = threads != NULL ? strtol(threads, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) {
+        return 1;
+    }
+    return count > MAXIMUM_WORKERS ? MAXIMUM_WORKERS : (int) count;
+}
+
+static void start() {
+    int count = configuredWorkerCount();
+    workers = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(struct Worker));
+    if (workers == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate the thread pool.\n");
+        exit(1);
+    }
+    memset(workers, 0, count * sizeof(struct Worker));
+    for (int i=0; i<count; i++) {
+        workers[i].index = i;
+        workers[i].random = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+    // the starting thread is worker 0, workers that fail to start just never submit tasks
+    currentWorker = &workers[0];
+    workerCount = count;
+    for (int i=1; i<count; i++) {
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        pthread_create(&thread, &attributes, workerMain, &workers[i]);
+        pthread_attr_destroy(&attributes);
+    }
+}
+
+int oolong_scheduler_start() {
+    pthread_once(&startOnce, start);
+    return workerCount;
+}
+
+int oolong_scheduler_worker_index() {
+    return currentWorker != NULL ? currentWorker->index : -1;
+}
+
+void oolong_scheduler_submit(struct OolongTask* task) {
+    if (currentWorker == NULL || !push(&currentWorker->deque, task)) {
+        // not a worker or the deque is full, run it right away
+        task->run(task);
+        return;
+    }
+    wakeSleeper();
+}
+
+bool oolong_scheduler_run_task() {
+    if (currentWorker == NULL) {
+        return false;
+    }
+    if (!runTask(currentWorker)) {
+        PAUSE();
+        return false;
+    }
+    return true;
+}
+
+bool oolong_scheduler_has_local_tasks() {
+    return currentWorker != NULL && !isEmpty(&currentWorker->deque);
+}
+
+void oolong_scheduler_blocking() {
+    if (workers == NULL || atomic_load(&searchingHelpers) > 0 || !anyTasks()) {
+        return;
+    }
+    if (atomic_fetch_add(&helpers, 1) >= MAXIMUM_HELPERS) {
+        atomic_fetch_sub(&helpers, 1);
+        return;
+    }
+    atomic_fetch_add(&searchingHelpers, 1);
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    if (pthread_create(&thread, &attributes, helperMain, NULL) != 0) {
+        atomic_fetch_sub(&searchingHelpers, 1);
+        atomic_fetch_sub(&helpers, 1);
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+// Task frames are recycled through a per-worker free list, so short tasks don't go through malloc.
+void* oolong_task_allocate() {
+    struct Worker* worker = currentWorker;
+    if (worker != NULL && worker->freeFrames != NULL) {
+        struct FreeFrame* frame = worker->freeFrames;
+        worker->freeFrames = frame->next;
+        worker->freeFrameCount--;
+        return frame;
+    }
+    void* frame = malloc(OOLONG_TASK_FRAME_SIZE);
+    if (frame == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a task.\n");
+        exit(1);
+    }
+    return frame;
+}
+
+void oolong_task_free(void* frame) {
+    struct Worker* worker = currentWorker;
+    if (worker == NULL || worker->freeFrameCount >= MAXIMUM_FREE_FRAMES) {
+        free(frame);
+        return;
+    }
+    struct FreeFrame* freeFrame = frame;
+    freeFrame->next = worker->freeFrames;
+    worker->freeFrames = freeFrame;
+    worker->freeFrameCount++;
+}
@@ -0,0 +1,131 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// StringBuilder: appends in place to a buffer that grows geometrically, for
+// Strings built from many pieces (e.g. in a loop) where + would copy every time.
+
+#include "oolong-module.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MINIMUM_CAPACITY 32
+
+struct StringBuilder {
+    char* value;
+    int64_t capacity;
+    int64_t usedSize;
+};
+
+// makes room for at least additional more characters, false if out of memory
+static bool reserve(struct StringBuilder* builder, int64_t additional) {
+    int64_t required = builder->usedSize + additional;
+    if (required <= builder->capacity) {
+        return true;
+    }
+    int64_t capacity = builder->capacity < MINIMUM_CAPACITY ? MINIMUM_CAPACITY : builder->capacity;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+    char* value = realloc(builder->value, capacity);
+    if (value == NULL) {
+        return false;
+    }
+    builder->value = value;
+    builder->capacity = capacity;
+    return true;
+}
+
+static void append(struct StringBuilder* builder, const char* characters, int64_t length) {
+    if (!reserve(builder, length)) {
+        // TODO: print error?
+        return;
+    }
+    memcpy(builder->value + builder->usedSize, characters, length);
+    builder->usedSize += length;
+}
+
+struct StringBuilder* StringBuilder_0_newStringBuilder() {
+    return calloc(1, sizeof(struct StringBuilder));
+}
+
+struct StringBuilder* StringBuilder_0_newStringBuilder_2_Integer(int64_t capacity) {
+    struct StringBuilder* builder = StringBuilder_0_newStringBuilder();
+    if (builder != NULL && capacity > 0) {
+        reserve(builder, capacity);
+    }
+    return builder;
+}
+
+void Void_0_reserve_2_StringBuilder_2_Integer(struct StringBuilder* builder, int64_t capacity) {
+    if (capacity > builder->usedSize) {
+        reserve(builder, capacity - builder->usedSize);
+    }
+}
+
+void Void_0_append_2_StringBuilder_2_String(struct StringBuilder* builder, struct String* value) {
+    append(builder, value->value, value->usedSize);
+}
+
+void Void_0_append_2_StringBuilder_2_Integer(struct StringBuilder* builder, int64_t value) {
+    // format directly into the buffer
+    if (reserve(builder, OOLONG_NUMBER_BUFFER_SIZE)) {
+        builder->usedSize += oolong_format_integer(builder->value + builder->usedSize, value);
+    }
+}
+
+void Void_0_append_2_StringBuilder_2_Double(struct StringBuilder* builder, double value) {
+    if (reserve(builder, OOLONG_NUMBER_BUFFER_SIZE)) {
+        builder->usedSize += oolong_format_double(builder->value + builder->usedSize, value);
+    }
+}
+
+void Void_0_append_2_StringBuilder_2_Boolean(struct StringBuilder* builder, bool value) {
+    if (value) {
+        append(builder, "true", 4);
+    }
+    else {
+        append(builder, "false", 5);
+    }
+}
+
+int64_t Integer_0_length_2_StringBuilder(struct StringBuilder* builder) {
+    return builder->usedSize;
+}
+
+// keeps the capacity, so the builder can be reused without allocating
+void Void_0_clear_2_StringBuilder(struct StringBuilder* builder) {
+    builder->usedSize = 0;
+}
+
+// a copy of the contents, the builder can keep appending afterwards
+struct String* String_0_toString_2_StringBuilder(struct StringBuilder* builder) {
+    struct String* string = malloc(sizeof(struct String) + builder->usedSize + 1);
+    if (string == NULL) {
+        // TODO: print error?
+        return NULL;
+    }
+    string->value = (char*) (string + 1);
+    if (builder->usedSize > 0) {
+        memcpy(string->value, builder->value, builder->usedSize);
+    }
+    string->value[builder->usedSize] = '\0';
+    string->allocatedSize = builder->usedSize + 1;
+    string->usedSize = builder->usedSize;
+    string->owner = NULL;
+    return string;
+}
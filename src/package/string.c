@@ -0,0 +1,177 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// String slicing and concatenation. substring, trim and split return views into
+// the characters of their argument instead of copies, copy makes an owning String again.
+
+#include "oolong-module.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// allocatedSize of a rest that split has used up, it's an empty view otherwise
+#define EXHAUSTED -1
+
+// always the String that owns the characters, never another view
+static struct String* getOwner(struct String* source) {
+    return source->allocatedSize > 0 ? source : source->owner;
+}
+
+static void setView(struct String* view, struct String* owner, char* characters, int64_t length) {
+    view->value = characters;
+    view->allocatedSize = 0;
+    view->usedSize = length;
+    view->owner = owner;
+}
+
+// source is the String the characters belong to, NULL for constant or mapped characters
+void oolong_set_view(struct String* view, struct String* source, char* characters, int64_t length) {
+    setView(view, source != NULL ? getOwner(source) : NULL, characters, length);
+}
+
+// Splits the first field off rest: field becomes a view of the text before the first separator and rest a
+// view of the text after it. False once rest is exhausted, so a loop over split visits every field.
+bool oolong_split(struct String* rest, struct String* field, struct String* separator) {
+    if (rest->allocatedSize == EXHAUSTED) {
+        // the previous call returned the last field
+        return false;
+    }
+    char* start = rest->value;
+    int64_t length = rest->usedSize;
+    int64_t fieldLength = length;
+    if (separator->usedSize == 1) {
+        char* found = memchr(start, separator->value[0], length);
+        if (found != NULL) {
+            fieldLength = found - start;
+        }
+    }
+    else if (separator->usedSize > 1) {
+        for (int64_t i=0; i + separator->usedSize <= length; i++) {
+            if (memcmp(start + i, separator->value, separator->usedSize) == 0) {
+                fieldLength = i;
+                break;
+            }
+        }
+    }
+    // before rest becomes a view, it might be the owner itself
+    struct String* owner = getOwner(rest);
+    setView(field, owner, start, fieldLength);
+    if (fieldLength == length) {
+        // last field, rest is empty but still points into the characters
+        setView(rest, owner, start + length, 0);
+        rest->allocatedSize = EXHAUSTED;
+    }
+    else {
+        setView(rest, owner, start + fieldLength + separator->usedSize, length - fieldLength - separator->usedSize);
+    }
+    return true;
+}
+
+static struct String* newView(struct String* source, char* characters, int64_t length) {
+    struct String* view = malloc(sizeof(struct String));
+    if (view == NULL) {
+        // TODO: print error?
+        return NULL;
+    }
+    oolong_set_view(view, source, characters, length);
+    return view;
+}
+
+static bool isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+int64_t Integer_0_length_2_String(struct String* value) {
+    return value->usedSize;
+}
+
+// start and length are clamped to the value
+struct String* String_0_substring_2_String_2_Integer_2_Integer(struct String* value, int64_t start, int64_t length) {
+    if (start < 0) {
+        start = 0;
+    }
+    if (start > value->usedSize) {
+        start = value->usedSize;
+    }
+    if (length < 0) {
+        length = 0;
+    }
+    if (length > value->usedSize - start) {
+        length = value->usedSize - start;
+    }
+    return newView(value, value->value + start, length);
+}
+
+struct String* String_0_substring_2_String_2_Integer(struct String* value, int64_t start) {
+    return String_0_substring_2_String_2_Integer_2_Integer(value, start, value->usedSize);
+}
+
+struct String* String_0_trim_2_String(struct String* value) {
+    int64_t start = 0;
+    int64_t end = value->usedSize;
+    while (start < end && isWhitespace(value->value[start])) {
+        start++;
+    }
+    while (end > start && isWhitespace(value->value[end - 1])) {
+        end--;
+    }
+    return newView(value, value->value + start, end - start);
+}
+
+bool Boolean_0_split_2_String_2_String_2_String(struct String* rest, struct String* field, struct String* separator) {
+    return oolong_split(rest, field, separator);
+}
+
+// owning, terminated copy, e.g. to keep a view beyond the lifetime of its owner
+struct String* String_0_copy_2_String(struct String* value) {
+    struct String* string = malloc(sizeof(struct String) + value->usedSize + 1);
+    if (string == NULL) {
+        // TODO: print error?
+        return NULL;
+    }
+    string->value = (char*) (string + 1);
+    memcpy(string->value, value->value, value->usedSize);
+    string->value[value->usedSize] = '\0';
+    string->allocatedSize = value->usedSize + 1;
+    string->usedSize = value->usedSize;
+    string->owner = NULL;
+    return string;
+}
+
+// Generated for a + b + c ..., one allocation for the whole chain.
+struct String* oolong_concatenate(struct String** pieces, int64_t count) {
+    int64_t length = 0;
+    for (int64_t i=0; i<count; i++) {
+        length += pieces[i]->usedSize;
+    }
+    struct String* string = malloc(sizeof(struct String) + length + 1);
+    if (string == NULL) {
+        // TODO: print error?
+        return NULL;
+    }
+    string->value = (char*) (string + 1);
+    char* end = string->value;
+    for (int64_t i=0; i<count; i++) {
+        memcpy(end, pieces[i]->value, pieces[i]->usedSize);
+        end += pieces[i]->usedSize;
+    }
+    *end = '\0';
+    string->allocatedSize = length + 1;
+    string->usedSize = length;
+    string->owner = NULL;
+    return string;
+}
@@ -1,5 +1,6 @@
 %define parse.error verbose
 %define parse.trace true
+%locations
 
 %{
     #define YYDEBUG 1
@@ -41,6 +42,8 @@
     AssignableNode *assignable;
     IdentifierNode *identifier;
     IdentifierList *identifierList;
+    SelectCaseNode *selectCase;
+    SelectCaseList *selectCaseList;
     VariableDeclarationNode *variableDeclaration;
     std::vector<VariableDeclarationNode*> *variableDeclarationList;
     std::vector<ExpressionNode*> *expressionList;
@@ -56,11 +59,13 @@
 %token <string> TOKEN_INTEGER TOKEN_DOUBLE TOKEN_STRING TOKEN_BOOLEAN
 %token <string> TOKEN_INTEGER_LITERAL TOKEN_DOUBLE_LITERAL TOKEN_STRING_LITERAL TOKEN_BOOLEAN_LITERAL
 %token <token> TOKEN_FUNCTION TOKEN_EXTERNAL TOKEN_IMPORT TOKEN_RETURN TOKEN_AND TOKEN_OR
+%token <token> TOKEN_GENERATOR TOKEN_ASYNC TOKEN_YIELD TOKEN_MEMOIZE TOKEN_CONST
 %token <token> TOKEN_EQUAL_TO TOKEN_NOT_EQUAL_TO TOKEN_LESS_THAN TOKEN_LESS_THAN_OR_EQUAL_TO TOKEN_GREATER_THAN TOKEN_GREATER_THAN_OR_EQUAL_TO
-%token <token> TOKEN_EQUALS TOKEN_SEMICOLON TOKEN_COLON TOKEN_COMMA TOKEN_PERIOD
-%token <token> TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS TOKEN_LEFT_BRACE TOKEN_RIGHT_BRACE
+%token <token> TOKEN_EQUALS TOKEN_SEMICOLON TOKEN_COLON TOKEN_COMMA TOKEN_PERIOD TOKEN_RANGE
+%token <token> TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS TOKEN_LEFT_BRACE TOKEN_RIGHT_BRACE TOKEN_LEFT_BRACKET TOKEN_RIGHT_BRACKET
 %token <token> TOKEN_PLUS TOKEN_MINUS TOKEN_MULTIPLY TOKEN_DIVIDE TOKEN_PERCENT
-%token <token> TOKEN_IF TOKEN_ELSE TOKEN_NOT TOKEN_WHILE TOKEN_FOR
+%token <token> TOKEN_IF TOKEN_ELSE TOKEN_NOT TOKEN_WHILE TOKEN_FOR TOKEN_PARALLEL TOKEN_REDUCE TOKEN_SPAWN TOKEN_AWAIT TOKEN_SELECT TOKEN_CASE
+%token <token> TOKEN_ARRAY TOKEN_LIST TOKEN_VECTOR TOKEN_FUTURE TOKEN_ATOMIC TOKEN_CHANNEL TOKEN_GENERATOR_TYPE TOKEN_MAP
 %token <token> TOKEN_ADD_ASSIGN TOKEN_SUBTRACT_ASSIGN TOKEN_MULTIPLY_ASSIGN TOKEN_DIVIDE_ASSIGN TOKEN_MODULO_ASSIGN
 %token <token> TOKEN_INCREMENT TOKEN_DECREMENT
 
@@ -76,7 +81,9 @@
 %type <statement> statement function_declaration assignment_statement
 %type <assignable> assignable
 %type <identifier> identifier type
-%type <identifierList> reference
+%type <identifierList> reference reduction_list reduction_variables
+%type <selectCase> select_case
+%type <selectCaseList> select_cases
 %type <variableDeclaration> variable_declaration
 %type <variableDeclarationList> function_declaration_argument_list
 %type <expressionList> function_call_argument_list
@@ -104,11 +111,13 @@ program : statement_list
 statement_list : statement
                     {
                         $$ = new StatementList();
+                        $<statement>1->lineNumber = @1.first_line;
                         $$->push_back($<statement>1);
                     }
                | statement_list statement
                     {
                         $$ = $1;
+                        $<statement>2->lineNumber = @2.first_line;
                         $1->push_back($<statement>2);
                     }
                ;
@@ -131,6 +140,11 @@ statement : TOKEN_IMPORT reference TOKEN_SEMICOLON
                 {
                     $$ = new ReturnStatementNode(*$2);
                 }
+          | TOKEN_YIELD expression TOKEN_SEMICOLON
+                {
+                    // hands the value to the caller of the generator, which resumes it for the next one
+                    $$ = new YieldStatementNode(*$2);
+                }
           | block
                 {
                     $$ = $1;
@@ -151,12 +165,71 @@ statement : TOKEN_IMPORT reference TOKEN_SEMICOLON
                 {
                     $$ = new ForLoopNode($3, $5, $7, *$9);
                 }
-          /*
-            range-based for-loop
+          | TOKEN_FOR TOKEN_LEFT_PARENTHESIS variable_declaration TOKEN_COLON expression TOKEN_RANGE expression TOKEN_RIGHT_PARENTHESIS block
+                {
+                    // range-based for-loop over start (inclusive) to end (exclusive)
+                    $$ = new RangeLoopNode($3, $5, $7, *$9);
+                }
           | TOKEN_FOR TOKEN_LEFT_PARENTHESIS variable_declaration TOKEN_COLON expression TOKEN_RIGHT_PARENTHESIS block
-          */
+                {
+                    // range-based for-loop over the elements of a collection
+                    $$ = new RangeLoopNode($3, $5, *$7);
+                }
+          | TOKEN_PARALLEL TOKEN_FOR TOKEN_LEFT_PARENTHESIS variable_declaration TOKEN_COLON expression TOKEN_RANGE expression TOKEN_RIGHT_PARENTHESIS reduction_list block
+                {
+                    // iterations run concurrently on the runtime's thread pool
+                    $$ = new ParallelLoopNode($4, $6, $8, *$10, *$11);
+                }
+          | TOKEN_PARALLEL TOKEN_FOR TOKEN_LEFT_PARENTHESIS variable_declaration TOKEN_COLON expression TOKEN_RIGHT_PARENTHESIS reduction_list block
+                {
+                    $$ = new ParallelLoopNode($4, $6, *$8, *$9);
+                }
+          | TOKEN_SELECT TOKEN_LEFT_BRACE select_cases TOKEN_RIGHT_BRACE
+                {
+                    // receive from whichever channel has a value first
+                    $$ = new SelectStatementNode(*$3);
+                }
           ;
 
+select_cases : select_case
+                {
+                    $$ = new SelectCaseList();
+                    $$->push_back($1);
+                }
+             | select_cases select_case
+                {
+                    $1->push_back($2);
+                }
+             ;
+
+select_case : TOKEN_CASE TOKEN_LEFT_PARENTHESIS variable_declaration TOKEN_COLON expression TOKEN_RIGHT_PARENTHESIS block
+                {
+                    $$ = new SelectCaseNode($3, *$5, *$7);
+                    $$->lineNumber = @1.first_line;
+                }
+            ;
+
+reduction_list : %empty
+                    {
+                        $$ = new IdentifierList();
+                    }
+               | TOKEN_REDUCE TOKEN_LEFT_PARENTHESIS reduction_variables TOKEN_RIGHT_PARENTHESIS
+                    {
+                        $$ = $3;
+                    }
+               ;
+
+reduction_variables : identifier
+                        {
+                            $$ = new IdentifierList();
+                            $$->push_back($1);
+                        }
+                    | reduction_variables TOKEN_COMMA identifier
+                        {
+                            $1->push_back($3);
+                        }
+                    ;
+
 reference : identifier
             {
                 $$ = new IdentifierList();
@@ -167,6 +240,12 @@ reference : identifier
                 $$ = $1;
                 $$->push_back($3);
             }
+          | reference TOKEN_PERIOD TOKEN_SELECT
+            {
+                // select is only a keyword at the start of a statement, e.g. simd.select is a function
+                $$ = $1;
+                $$->push_back(new IdentifierNode("select"));
+            }
           ;
 
 function_declaration : TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type block
@@ -178,6 +257,44 @@ function_declaration : TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function
                             IdentifierNode* voidType = new IdentifierNode("Void");
                             $$ = new FunctionDeclarationNode(*voidType, *$2, *$4, *$6);
                         }
+                     | TOKEN_GENERATOR TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type block
+                        {
+                            // returns a Generator<type>, the block runs lazily up to each yield
+                            $$ = new FunctionDeclarationNode(*$8, *$3, *$5, *$9, FunctionDeclarationNode::GENERATOR);
+                        }
+                     | TOKEN_ASYNC TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type block
+                        {
+                            // returns a Future<type>, the block runs on the thread pool
+                            $$ = new FunctionDeclarationNode(*$8, *$3, *$5, *$9, FunctionDeclarationNode::ASYNC);
+                        }
+                     | TOKEN_ASYNC TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS block
+                        {
+                            IdentifierNode* voidType = new IdentifierNode("Void");
+                            $$ = new FunctionDeclarationNode(*voidType, *$3, *$5, *$7, FunctionDeclarationNode::ASYNC);
+                        }
+                     | TOKEN_MEMOIZE TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type block
+                        {
+                            // calls with the same arguments return the cached result
+                            FunctionDeclarationNode* function = new FunctionDeclarationNode(*$8, *$3, *$5, *$9);
+                            function->memoized = true;
+                            $$ = function;
+                        }
+                     | TOKEN_MEMOIZE TOKEN_LEFT_PARENTHESIS TOKEN_INTEGER_LITERAL TOKEN_RIGHT_PARENTHESIS TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type block
+                        {
+                            // caches at most that many results, the least recently used one makes room
+                            FunctionDeclarationNode* function = new FunctionDeclarationNode(*$11, *$6, *$8, *$12);
+                            function->memoized = true;
+                            function->cacheLimit = atol($3->c_str());
+                            delete $3;
+                            $$ = function;
+                        }
+                     | TOKEN_CONST TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type block
+                        {
+                            // calls with constant arguments are evaluated by the compiler
+                            FunctionDeclarationNode* function = new FunctionDeclarationNode(*$8, *$3, *$5, *$9);
+                            function->constant = true;
+                            $$ = function;
+                        }
                      | TOKEN_EXTERNAL TOKEN_FUNCTION identifier TOKEN_LEFT_PARENTHESIS function_declaration_argument_list TOKEN_RIGHT_PARENTHESIS TOKEN_COLON type TOKEN_EQUALS identifier TOKEN_SEMICOLON
                         {
                             $$ = new ExternalFunctionDeclarationNode(*$8, *$3, *$5, *$10);
@@ -229,33 +346,23 @@ assignment_statement : variable_declaration TOKEN_EQUALS expression
                         }
                      | assignable TOKEN_ADD_ASSIGN expression
                         {
-                            auto variableReference = new ReferenceNode(*$1);
-                            auto calculation = new BinaryOperatorNode(*variableReference, (int)TOKEN_PLUS, *$3);
-                            $$ = new AssignmentNode($1, *calculation);
+                            $$ = new AssignmentNode($1, (int)TOKEN_PLUS, *$3);
                         }
                      | assignable TOKEN_SUBTRACT_ASSIGN expression
                         {
-                            auto variableReference = new ReferenceNode(*$1);
-                            auto calculation = new BinaryOperatorNode(*variableReference, (int)TOKEN_MINUS, *$3);
-                            $$ = new AssignmentNode($1, *calculation);
+                            $$ = new AssignmentNode($1, (int)TOKEN_MINUS, *$3);
                         }
                      | assignable TOKEN_MULTIPLY_ASSIGN expression
                         {
-                            auto variableReference = new ReferenceNode(*$1);
-                            auto calculation = new BinaryOperatorNode(*variableReference, (int)TOKEN_MULTIPLY, *$3);
-                            $$ = new AssignmentNode($1, *calculation);
+                            $$ = new AssignmentNode($1, (int)TOKEN_MULTIPLY, *$3);
                         }
                      | assignable TOKEN_DIVIDE_ASSIGN expression
                         {
-                            auto variableReference = new ReferenceNode(*$1);
-                            auto calculation = new BinaryOperatorNode(*variableReference, (int)TOKEN_DIVIDE, *$3);
-                            $$ = new AssignmentNode($1, *calculation);
+                            $$ = new AssignmentNode($1, (int)TOKEN_DIVIDE, *$3);
                         }
                      | assignable TOKEN_MODULO_ASSIGN expression
                         {
-                            auto variableReference = new ReferenceNode(*$1);
-                            auto calculation = new BinaryOperatorNode(*variableReference, (int)TOKEN_PERCENT, *$3);
-                            $$ = new AssignmentNode($1, *calculation);
+                            $$ = new AssignmentNode($1, (int)TOKEN_PERCENT, *$3);
                         }
                      ;
 
@@ -263,6 +370,10 @@ assignable : identifier
                 {
                     $$ = new AssignableNode(*$1);
                 }
+           | identifier TOKEN_LEFT_BRACKET expression TOKEN_RIGHT_BRACKET
+                {
+                    $$ = new AssignableNode(*$1, $3);
+                }
            ;
 
 variable_declaration : identifier TOKEN_COLON type
@@ -324,10 +435,63 @@ expression : reference TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS
                 {
                     $$ = new FunctionCallNode(*$1, *$3);
                 }
+           | TOKEN_SPAWN reference TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS
+                {
+                    $$ = new SpawnNode(*$2);
+                }
+           | TOKEN_SPAWN reference TOKEN_LEFT_PARENTHESIS function_call_argument_list TOKEN_RIGHT_PARENTHESIS
+                {
+                    $$ = new SpawnNode(*$2, *$4);
+                }
+           | TOKEN_AWAIT identifier
+                {
+                    $$ = new AwaitNode(*$2);
+                }
            | reference
                 {
                     $$ = new ReferenceNode(*$1);
                 }
+           | identifier TOKEN_LEFT_BRACKET expression TOKEN_RIGHT_BRACKET
+                {
+                    // element of a collection
+                    $$ = new ReferenceNode(*new AssignableNode(*$1, $3));
+                }
+           | TOKEN_ARRAY TOKEN_LESS_THAN type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS expression TOKEN_RIGHT_PARENTHESIS
+                {
+                    $$ = new CollectionNode("Array<" + $3->name + ">", $6);
+                }
+           | TOKEN_LIST TOKEN_LESS_THAN type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS
+                {
+                    $$ = new CollectionNode("List<" + $3->name + ">", nullptr);
+                }
+           | TOKEN_LIST TOKEN_LESS_THAN type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS expression TOKEN_RIGHT_PARENTHESIS
+                {
+                    // initial capacity
+                    $$ = new CollectionNode("List<" + $3->name + ">", $6);
+                }
+           | TOKEN_MAP TOKEN_LESS_THAN type TOKEN_COMMA type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS
+                {
+                    $$ = new CollectionNode("Map<" + $3->name + ", " + $5->name + ">", nullptr);
+                }
+           | TOKEN_MAP TOKEN_LESS_THAN type TOKEN_COMMA type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS expression TOKEN_RIGHT_PARENTHESIS
+                {
+                    // initial capacity
+                    $$ = new CollectionNode("Map<" + $3->name + ", " + $5->name + ">", $8);
+                }
+           | TOKEN_ATOMIC TOKEN_LESS_THAN type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS expression TOKEN_RIGHT_PARENTHESIS
+                {
+                    $$ = new AtomicNode("Atomic<" + $3->name + ">", *$6);
+                }
+           | TOKEN_CHANNEL TOKEN_LESS_THAN type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS TOKEN_RIGHT_PARENTHESIS
+                {
+                    // unbuffered, a send waits for its receiver
+                    $$ = new ChannelNode("Channel<" + $3->name + ">", nullptr);
+                }
+           | TOKEN_CHANNEL TOKEN_LESS_THAN type TOKEN_GREATER_THAN TOKEN_LEFT_PARENTHESIS expression TOKEN_RIGHT_PARENTHESIS
+                {
+                    // buffered, room for capacity values
+                    $$ = new ChannelNode("Channel<" + $3->name + ">", $6);
+                }
            | literal_value
            | TOKEN_LEFT_PARENTHESIS expression TOKEN_RIGHT_PARENTHESIS
                 {
@@ -439,6 +603,43 @@ type : TOKEN_BOOLEAN
         {
             $$ = new IdentifierNode("String");
         }
+     | TOKEN_ARRAY TOKEN_LESS_THAN type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Array<" + $3->name + ">");
+        }
+     | TOKEN_LIST TOKEN_LESS_THAN type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("List<" + $3->name + ">");
+        }
+     | TOKEN_VECTOR TOKEN_LESS_THAN type TOKEN_COMMA TOKEN_INTEGER_LITERAL TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Vector<" + $3->name + ", " + *$5 + ">");
+        }
+     | TOKEN_FUTURE TOKEN_LESS_THAN type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Future<" + $3->name + ">");
+        }
+     | TOKEN_ATOMIC TOKEN_LESS_THAN type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Atomic<" + $3->name + ">");
+        }
+     | TOKEN_CHANNEL TOKEN_LESS_THAN type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Channel<" + $3->name + ">");
+        }
+     | TOKEN_GENERATOR_TYPE TOKEN_LESS_THAN type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Generator<" + $3->name + ">");
+        }
+     | TOKEN_MAP TOKEN_LESS_THAN type TOKEN_COMMA type TOKEN_GREATER_THAN
+        {
+            $$ = new IdentifierNode("Map<" + $3->name + ", " + $5->name + ">");
+        }
+     | identifier
+        {
+            // types provided by packages, e.g. File
+            $$ = $1;
+        }
      ;
 
 %%
@@ -0,0 +1,75 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "perf-map-listener.h"
+#include <string>
+#include <iostream>
+#include <unistd.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Object/SymbolSize.h>
+
+using namespace std;
+using namespace llvm;
+using namespace llvm::object;
+
+PerfMapListener::PerfMapListener() {
+    // perf looks for this exact name
+    const string mapPath = "/tmp/perf-" + to_string(getpid()) + ".map";
+    mapFile = fopen(mapPath.c_str(), "a");
+    if (mapFile == nullptr) {
+        cerr << "warning: Unable to open perf map file " << mapPath << endl;
+    }
+}
+
+PerfMapListener::~PerfMapListener() {
+    if (mapFile != nullptr) {
+        fclose(mapFile);
+    }
+}
+
+void PerfMapListener::NotifyObjectEmitted(const ObjectFile& object, const RuntimeDyld::LoadedObjectInfo& loadedObject) {
+    if (mapFile == nullptr) {
+        return;
+    }
+    // the debug object has symbol addresses relocated to where the code was loaded
+    OwningBinary<ObjectFile> debugObjectOwner = loadedObject.getObjectForDebug(object);
+    const ObjectFile* debugObject = debugObjectOwner.getBinary();
+    if (debugObject == nullptr) {
+        return;
+    }
+    for (const pair<SymbolRef, uint64_t>& symbolSize : computeSymbolSizes(*debugObject)) {
+        const SymbolRef& symbol = symbolSize.first;
+        Expected<SymbolRef::Type> type = symbol.getType();
+        if (!type) {
+            consumeError(type.takeError());
+            continue;
+        }
+        if (*type != SymbolRef::ST_Function) {
+            continue;
+        }
+        Expected<StringRef> name = symbol.getName();
+        Expected<uint64_t> address = symbol.getAddress();
+        if (!name || !address) {
+            consumeError(name.takeError());
+            consumeError(address.takeError());
+            continue;
+        }
+        fprintf(mapFile, "%llx %llx %s\n", (unsigned long long) *address, (unsigned long long) symbolSize.second, name->str().c_str());
+    }
+    fflush(mapFile);
+}
@@ -0,0 +1,21 @@
+#ifndef PERF_MAP_LISTENER_H
+#define PERF_MAP_LISTENER_H
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <cstdio>
+
+// Writes /tmp/perf-<pid>.map entries for JIT compiled functions so that perf
+// can name samples taken in code run via --execute.
+class PerfMapListener : public llvm::JITEventListener {
+private:
+    FILE* mapFile = nullptr;
+
+public:
+    PerfMapListener();
+    ~PerfMapListener();
+
+    void NotifyObjectEmitted(const llvm::object::ObjectFile& object, const llvm::RuntimeDyld::LoadedObjectInfo& loadedObject) override;
+};
+
+#endif
+
@@ -0,0 +1,95 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "remark-handler.h"
+#include "size-report.h"
+#include <cstdlib>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace std;
+using namespace llvm;
+
+extern const char* currentParseFile;
+
+// remarks the size report is built from
+static const char* INLINER_PASS = "inline";
+static const char* PROLOGUE_EPILOGUE_PASS = "prologepilog";
+
+RemarkHandler::RemarkHandler(const string& filter, SizeReport* sizeReport) : printRemarks(!filter.empty()), filter(filter), sizeReport(sizeReport) {}
+
+bool RemarkHandler::isEnabled(StringRef passName) const {
+    if (sizeReport != nullptr && (passName == INLINER_PASS || passName == PROLOGUE_EPILOGUE_PASS)) {
+        return true;
+    }
+    return printRemarks && filter.match(passName);
+}
+
+bool RemarkHandler::isAnalysisRemarkEnabled(StringRef passName) const {
+    return isEnabled(passName);
+}
+
+bool RemarkHandler::isMissedOptRemarkEnabled(StringRef passName) const {
+    return isEnabled(passName);
+}
+
+bool RemarkHandler::isPassedOptRemarkEnabled(StringRef passName) const {
+    return isEnabled(passName);
+}
+
+bool RemarkHandler::isAnyRemarkEnabled() const {
+    return true;
+}
+
+bool RemarkHandler::handleDiagnostics(const DiagnosticInfo& diagnostic) {
+    const DiagnosticInfoOptimizationBase* remark = dyn_cast<DiagnosticInfoOptimizationBase>(&diagnostic);
+    if (remark == nullptr) {
+        // errors and warnings keep the default handling
+        return false;
+    }
+    if (!remark->isEnabled()) {
+        return true;
+    }
+
+    if (sizeReport != nullptr) {
+        const string functionName = remark->getFunction().getName().str();
+        if (remark->getPassName() == INLINER_PASS && remark->isPassed()) {
+            sizeReport->recordInlinedCall(functionName);
+        }
+        else if (remark->getPassName() == PROLOGUE_EPILOGUE_PASS && remark->getRemarkName() == "StackSize") {
+            // "<bytes> stack bytes in function"
+            sizeReport->recordStackSize(functionName, strtoull(remark->getMsg().c_str(), nullptr, 10));
+        }
+    }
+    if (!printRemarks || !filter.match(remark->getPassName())) {
+        return true;
+    }
+
+    const char* kind = remark->isPassed() ? "passed" : (remark->isMissed() ? "missed" : "analysis");
+    raw_ostream& output = errs();
+    // file:line:column from the line tables, see DebugInformation::setLocation
+    if (remark->isLocationAvailable()) {
+        output << remark->getLocationStr();
+    }
+    else {
+        output << (currentParseFile != nullptr ? currentParseFile : "<unknown>");
+        output << " (function " << remark->getFunction().getName() << ")";
+    }
+    output << ": remark: " << remark->getMsg() << " [" << kind << ", " << remark->getPassName() << "]\n";
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef REMARK_HANDLER_H
+#define REMARK_HANDLER_H
+
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/Support/Regex.h>
+#include <string>
+
+class SizeReport;
+
+// Enables LLVM optimization remarks (passed, missed and analysis) of the
+// passes whose name matches a filter and prints them as diagnostics
+// pointing to the Oolong source. Also feeds the inlining and stack frame
+// remarks into the size report, if there is one.
+class RemarkHandler : public llvm::DiagnosticHandler {
+private:
+    bool printRemarks;
+    mutable llvm::Regex filter;
+    SizeReport* sizeReport;
+
+    bool isEnabled(llvm::StringRef passName) const;
+
+public:
+    RemarkHandler(const std::string& filter, SizeReport* sizeReport);
+
+    bool isAnalysisRemarkEnabled(llvm::StringRef passName) const override;
+    bool isMissedOptRemarkEnabled(llvm::StringRef passName) const override;
+    bool isPassedOptRemarkEnabled(llvm::StringRef passName) const override;
+    bool isAnyRemarkEnabled() const override;
+    bool handleDiagnostics(const llvm::DiagnosticInfo& diagnostic) override;
+};
+
+#endif
@@ -0,0 +1,242 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "simd.h"
+#include "code-generation.h"
+#include "common.h"
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+using namespace std;
+using namespace llvm;
+
+static const string PACKAGE_PREFIX = "simd.";
+
+void Simd::declare() {
+    if (declared) {
+        return;
+    }
+    declared = true;
+    for (unsigned width : { 2, 4, 8, 16 }) {
+        for (const string elementTypeName : { "Integer", "Double" }) {
+            declareFunctions(elementTypeName, width);
+        }
+        declareMaskFunctions(width);
+    }
+}
+
+void Simd::declareFunctions(const string& elementTypeName, unsigned width) {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Collections& collections = context->getCollections();
+    Type* elementType = typeConverter.getType(elementTypeName);
+    Type* vectorType = typeConverter.getType(TypeConverter::getVectorTypeName(elementTypeName, width));
+    Type* maskType = typeConverter.getType(TypeConverter::getVectorTypeName("Boolean", width));
+    Type* arrayType = typeConverter.getType("Array<" + elementTypeName + ">");
+    Type* integerType = typeConverter.getIntegerType();
+    // elements are only guaranteed to be aligned to their own size
+    const unsigned alignment = elementType->getPrimitiveSizeInBits() / 8;
+
+    // loadN(Array<T>, Integer) : Vector<T, N>, elements index to index + N - 1
+    Function* function = createFunction(vectorType, "load" + to_string(width), { arrayType, integerType });
+    Function::arg_iterator arguments = function->arg_begin();
+    Value* array = &*arguments++;
+    Value* index = &*arguments++;
+    LoadInst* load = new LoadInst(getVectorPointer(array, index, vectorType), "", false, context->currentBlock());
+    load->setAlignment(alignment);
+    collections.setElementAccess(load, elementType);
+    finishFunction(load);
+
+    // store(Array<T>, Integer, Vector<T, N>)
+    function = createFunction(typeConverter.getVoidType(), "store", { arrayType, integerType, vectorType });
+    arguments = function->arg_begin();
+    array = &*arguments++;
+    index = &*arguments++;
+    Value* vector = &*arguments++;
+    StoreInst* store = new StoreInst(vector, getVectorPointer(array, index, vectorType), context->currentBlock());
+    store->setAlignment(alignment);
+    collections.setElementAccess(store, elementType);
+    finishFunction(nullptr);
+
+    // splatN(T) : Vector<T, N>, the value in every lane
+    function = createFunction(vectorType, "splat" + to_string(width), { elementType });
+    finishFunction(broadcast(&*function->arg_begin(), width));
+
+    // get(Vector<T, N>, Integer) : T, set(Vector<T, N>, Integer, T) : Vector<T, N>, lane indices wrap around
+    function = createFunction(elementType, "get", { vectorType, integerType });
+    arguments = function->arg_begin();
+    vector = &*arguments++;
+    index = getLaneIndex(&*arguments++, width);
+    finishFunction(ExtractElementInst::Create(vector, index, "", context->currentBlock()));
+
+    function = createFunction(vectorType, "set", { vectorType, integerType, elementType });
+    arguments = function->arg_begin();
+    vector = &*arguments++;
+    index = getLaneIndex(&*arguments++, width);
+    Value* value = &*arguments++;
+    finishFunction(InsertElementInst::Create(vector, value, index, "", context->currentBlock()));
+
+    // sum, minimum and maximum of all lanes
+    function = createFunction(elementType, "sum", { vectorType });
+    finishFunction(reduce(&*function->arg_begin(), SUM));
+    function = createFunction(elementType, "minimum", { vectorType });
+    finishFunction(reduce(&*function->arg_begin(), MINIMUM));
+    function = createFunction(elementType, "maximum", { vectorType });
+    finishFunction(reduce(&*function->arg_begin(), MAXIMUM));
+
+    // reverse(Vector<T, N>) : Vector<T, N>, rotate(Vector<T, N>) : Vector<T, N> moves every lane down by one
+    std::vector<int> reversed;
+    std::vector<int> rotated;
+    for (unsigned lane=0; lane<width; lane++) {
+        reversed.push_back(width - 1 - lane);
+        rotated.push_back((lane + 1) % width);
+    }
+    function = createFunction(vectorType, "reverse", { vectorType });
+    finishFunction(shuffle(&*function->arg_begin(), reversed));
+    function = createFunction(vectorType, "rotate", { vectorType });
+    finishFunction(shuffle(&*function->arg_begin(), rotated));
+
+    // select(Vector<Boolean, N>, Vector<T, N>, Vector<T, N>) : Vector<T, N>, lanes of the first vector where the mask is true
+    function = createFunction(vectorType, "select", { maskType, vectorType, vectorType });
+    arguments = function->arg_begin();
+    Value* mask = &*arguments++;
+    Value* whenTrue = &*arguments++;
+    Value* whenFalse = &*arguments++;
+    finishFunction(SelectInst::Create(mask, whenTrue, whenFalse, "", context->currentBlock()));
+}
+
+void Simd::declareMaskFunctions(unsigned width) {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* booleanType = typeConverter.getBooleanType();
+    Type* maskType = typeConverter.getType(TypeConverter::getVectorTypeName("Boolean", width));
+
+    // all(Vector<Boolean, N>) : Boolean, any(Vector<Boolean, N>) : Boolean
+    Function* function = createFunction(booleanType, "all", { maskType });
+    finishFunction(reduce(&*function->arg_begin(), ALL));
+    function = createFunction(booleanType, "any", { maskType });
+    finishFunction(reduce(&*function->arg_begin(), ANY));
+}
+
+/* Internal function of the simd package, code is generated into its entry block until finishFunction */
+Function* Simd::createFunction(Type* returnType, const string& name, const vector<Type*>& arguments) {
+    Function* function = context->createBuiltinFunction(returnType, PACKAGE_PREFIX + name, arguments);
+    context->pushBlock(&function->getEntryBlock());
+    return function;
+}
+
+void Simd::finishFunction(Value* returnValue) {
+    ReturnInst::Create(context->getLLVMContext(), returnValue, context->currentBlock());
+    context->popBlock();
+}
+
+/* Pointer to the elements index to index + N - 1 of the Array, after checking both ends are in bounds */
+Value* Simd::getVectorPointer(Value* array, Value* index, Type* vectorType) {
+    Collections& collections = context->getCollections();
+    Type* integerType = context->getTypeConverter().getIntegerType();
+    Value* first = collections.getElementPointer(array, index);
+    Value* lastIndex = BinaryOperator::CreateNSWAdd(index, ConstantInt::get(integerType, vectorType->getVectorNumElements() - 1), "lastIndex", context->currentBlock());
+    collections.getElementPointer(array, lastIndex);
+    return new BitCastInst(first, vectorType->getPointerTo(), "", context->currentBlock());
+}
+
+/* Combine all lanes by repeatedly folding the upper half of the remaining lanes onto the lower half */
+Value* Simd::reduce(Value* vector, Reduction reduction) {
+    BasicBlock* block = context->currentBlock();
+    const unsigned width = vector->getType()->getVectorNumElements();
+    const bool isInteger = vector->getType()->getVectorElementType()->isIntegerTy();
+    Value* result = vector;
+    for (unsigned lanes=width/2; lanes>0; lanes/=2) {
+        std::vector<int> upperHalf(width, -1);
+        for (unsigned lane=0; lane<lanes; lane++) {
+            upperHalf[lane] = lane + lanes;
+        }
+        Value* upper = shuffle(result, upperHalf);
+        switch (reduction) {
+            case SUM:       { result = BinaryOperator::Create(isInteger ? Instruction::Add : Instruction::FAdd, result, upper, "", block); } break;
+            case ALL:       { result = BinaryOperator::Create(Instruction::And, result, upper, "", block); } break;
+            case ANY:       { result = BinaryOperator::Create(Instruction::Or, result, upper, "", block); } break;
+            case MINIMUM:
+            case MAXIMUM:   {
+                                CmpInst::Predicate predicate = reduction == MINIMUM ? (isInteger ? CmpInst::ICMP_SLT : CmpInst::FCMP_OLT)
+                                                                                    : (isInteger ? CmpInst::ICMP_SGT : CmpInst::FCMP_OGT);
+                                Value* comparison = CmpInst::Create(isInteger ? Instruction::ICmp : Instruction::FCmp, predicate, result, upper, "", block);
+                                result = SelectInst::Create(comparison, result, upper, "", block);
+                            } break;
+        }
+    }
+    return ExtractElementInst::Create(result, ConstantInt::get(Type::getInt32Ty(context->getLLVMContext()), 0), "", block);
+}
+
+/* Lanes of the vector in the given order, -1 for lanes whose value doesn't matter */
+Value* Simd::shuffle(Value* vector, const std::vector<int>& lanes) {
+    Type* int32Type = Type::getInt32Ty(context->getLLVMContext());
+    std::vector<Constant*> mask;
+    for (int lane : lanes) {
+        mask.push_back(lane < 0 ? UndefValue::get(int32Type) : ConstantInt::get(int32Type, lane));
+    }
+    return new ShuffleVectorInst(vector, UndefValue::get(vector->getType()), ConstantVector::get(mask), "", context->currentBlock());
+}
+
+Value* Simd::getLaneIndex(Value* index, unsigned width) {
+    return BinaryOperator::Create(Instruction::And, index, ConstantInt::get(index->getType(), width - 1), "lane", context->currentBlock());
+}
+
+Value* Simd::broadcast(Value* scalar, unsigned width) {
+    Type* vectorType = VectorType::get(scalar->getType(), width);
+    Type* int32Type = Type::getInt32Ty(context->getLLVMContext());
+    Value* vector = InsertElementInst::Create(UndefValue::get(vectorType), scalar, ConstantInt::get(int32Type, 0), "", context->currentBlock());
+    return shuffle(vector, std::vector<int>(width, 0));
+}
+
+/* Bring both operands of a lane-wise operation to the same vector type. Scalars are broadcast to all lanes,
+   Integer lanes become Double lanes when the other operand is a Double, like for scalar operations. */
+bool Simd::matchOperands(Value*& left, Value*& right) {
+    TypeConverter& typeConverter = context->getTypeConverter();
+    Type* doubleType = typeConverter.getDoubleType();
+    Type* vectorType = left->getType()->isVectorTy() ? left->getType() : right->getType();
+    const unsigned width = vectorType->getVectorNumElements();
+    Type* elementType = vectorType->getVectorElementType();
+    for (Value* operand : { left, right }) {
+        Type* operandType = operand->getType();
+        if (operandType->isVectorTy() && operandType->getVectorNumElements() != width) {
+            error(*context, "Unable to combine " + typeConverter.getTypeName(left->getType()) + " and " + typeConverter.getTypeName(right->getType()));
+            return false;
+        }
+        if ((operandType->isVectorTy() ? operandType->getVectorElementType() : operandType) == doubleType) {
+            elementType = doubleType;
+        }
+    }
+    Type* targetType = VectorType::get(elementType, width);
+    for (Value** operand : { &left, &right }) {
+        if (!(*operand)->getType()->isVectorTy()) {
+            Value* scalar = typeConverter.convertType(*operand, elementType);
+            if (scalar == nullptr) {
+                return false;
+            }
+            *operand = broadcast(scalar, width);
+        }
+        *operand = typeConverter.convertType(*operand, targetType);
+        if (*operand == nullptr) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class Function;
+    class Type;
+    class Value;
+}
+
+class CodeGenerationContext;
+
+// Vector<T, N> support: lane-wise operators (used by BinaryOperatorNode) and the functions of the
+// simd package, which are generated when the package is imported. Everything maps directly to LLVM
+// vector instructions, so kernels written with them are vectorized regardless of the auto-vectorizer.
+class Simd {
+private:
+    enum Reduction { SUM, MINIMUM, MAXIMUM, ALL, ANY };
+
+    CodeGenerationContext* context;
+    bool declared = false;
+
+    void declareFunctions(const std::string& elementTypeName, unsigned width);
+    void declareMaskFunctions(unsigned width);
+    llvm::Function* createFunction(llvm::Type* returnType, const std::string& name, const std::vector<llvm::Type*>& arguments);
+    void finishFunction(llvm::Value* returnValue);
+    llvm::Value* getVectorPointer(llvm::Value* array, llvm::Value* index, llvm::Type* vectorType);
+    llvm::Value* reduce(llvm::Value* vector, Reduction reduction);
+    llvm::Value* shuffle(llvm::Value* vector, const std::vector<int>& lanes);
+    llvm::Value* getLaneIndex(llvm::Value* index, unsigned width);
+
+public:
+    Simd(CodeGenerationContext* context) : context(context) {}
+
+    void declare();
+    llvm::Value* broadcast(llvm::Value* scalar, unsigned width);
+    bool matchOperands(llvm::Value*& left, llvm::Value*& right);
+};
+
+#endif
@@ -0,0 +1,231 @@
+
+// Oolong - A compiler for the Oolong programming language.
+// Copyright (C) 2017  Andrew Groot
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "size-report.h"
+#include "common.h"
+#include <cstring>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Object/Archive.h>
+#include <llvm/Object/Binary.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace std;
+using namespace llvm;
+using namespace llvm::object;
+
+static int64_t countInstructions(Function& function) {
+    int64_t count = 0;
+    for (Instruction& instruction : instructions(function)) {
+        // debug information is not code
+        if (!isa<DbgInfoIntrinsic>(instruction)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+SizeReport::FunctionSize& SizeReport::getFunction(const string& name) {
+    auto it = functionIndices.find(name);
+    if (it != functionIndices.end()) {
+        return functions[it->second];
+    }
+    FunctionSize function;
+    function.name = name;
+    functionIndices[name] = functions.size();
+    functions.push_back(function);
+    return functions.back();
+}
+
+void SizeReport::collectBeforeOptimization(Module& module) {
+    for (Function& function : module) {
+        if (!function.isDeclaration()) {
+            FunctionSize& size = getFunction(function.getName().str());
+            size.instructionsBefore = countInstructions(function);
+            size.inlinedCalls = 0;
+        }
+    }
+}
+
+/* The coroutine passes split generator and async functions into .resume, .destroy and .cleanup functions, which
+   did not exist before optimization */
+static string splitFunctionSource(const string& name) {
+    for (const char* suffix : {".resume", ".destroy", ".cleanup"}) {
+        const size_t length = strlen(suffix);
+        if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0) {
+            return name.substr(0, name.size() - length);
+        }
+    }
+    return "";
+}
+
+void SizeReport::collectAfterOptimization(Module& module) {
+    for (Function& function : module) {
+        if (function.isDeclaration()) {
+            // only runtime functions that are still called after optimization
+            if (!function.use_empty() && !function.isIntrinsic()) {
+                getFunction(function.getName().str()).runtime = true;
+            }
+        }
+        else {
+            FunctionSize& size = getFunction(function.getName().str());
+            size.instructionsAfter = countInstructions(function);
+            if (size.instructionsBefore < 0) {
+                string source = splitFunctionSource(size.name);
+                auto it = functionIndices.find(source);
+                if (it != functionIndices.end() && functions[it->second].instructionsBefore >= 0) {
+                    size.splitFrom = source;
+                }
+            }
+        }
+    }
+}
+
+void SizeReport::collectCodeSizes(StringRef object) {
+    for (auto& size : getFunctionSizes(object)) {
+        auto it = functionIndices.find(size.first);
+        if (it != functionIndices.end() && !functions[it->second].runtime) {
+            functions[it->second].bytes = size.second;
+        }
+    }
+}
+
+void SizeReport::collectRuntimeCodeSizes(const string& archiveLocation) {
+    auto archiveBuffer = MemoryBuffer::getFile(archiveLocation);
+    if (!archiveBuffer) {
+        return;
+    }
+    Expected<unique_ptr<Archive>> archive = Archive::create((*archiveBuffer)->getMemBufferRef());
+    if (!archive) {
+        consumeError(archive.takeError());
+        return;
+    }
+    Error error = Error::success();
+    for (const Archive::Child& child : (*archive)->children(error)) {
+        Expected<unique_ptr<Binary>> binary = child.getAsBinary();
+        if (!binary) {
+            consumeError(binary.takeError());
+            continue;
+        }
+        ObjectFile* objectFile = dyn_cast<ObjectFile>(binary->get());
+        if (objectFile == nullptr) {
+            continue;
+        }
+        for (auto& size : getFunctionSizes(objectFile->getData())) {
+            auto it = functionIndices.find(size.first);
+            if (it != functionIndices.end() && functions[it->second].runtime) {
+                functions[it->second].bytes = size.second;
+            }
+        }
+    }
+    consumeError(move(error));
+}
+
+void SizeReport::recordInlinedCall(const string& caller) {
+    FunctionSize& function = getFunction(caller);
+    function.inlinedCalls = function.inlinedCalls < 0 ? 1 : function.inlinedCalls + 1;
+}
+
+void SizeReport::recordStackSize(const string& function, uint64_t size) {
+    getFunction(function).stackSize = size;
+}
+
+/* Module and function names may contain quotes, backslashes and control characters */
+static void writeJSONString(raw_ostream& output, const string& value) {
+    output << '"';
+    for (char character : value) {
+        if (character == '"' || character == '\\') {
+            output << '\\' << character;
+        }
+        else if ((unsigned char) character < 0x20) {
+            output << format("\\u%04x", character);
+        }
+        else {
+            output << character;
+        }
+    }
+    output << '"';
+}
+
+void SizeReport::write(raw_ostream& output, const string& moduleName, bool json) {
+    if (json) {
+        output << "{\"module\": ";
+        writeJSONString(output, moduleName);
+        output << ", \"functions\": [";
+        bool first = true;
+        for (FunctionSize& function : functions) {
+            if (!function.runtime && function.instructionsBefore < 0 && function.splitFrom.empty()) {
+                // e.g. constructors added for the runtime
+                continue;
+            }
+            output << (first ? "\n" : ",\n");
+            first = false;
+            output << "  {\"name\": ";
+            writeJSONString(output, function.name);
+            output << ", \"runtime\": " << (function.runtime ? "true" : "false");
+            output << ", \"splitFrom\": ";
+            if (function.splitFrom.empty()) {
+                output << "null";
+            }
+            else {
+                writeJSONString(output, function.splitFrom);
+            }
+            const pair<const char*, int64_t> values[] = {
+                {"irInstructionsBefore", function.instructionsBefore},
+                {"irInstructionsAfter", function.instructionsAfter},
+                {"bytes", function.bytes},
+                {"inlinedCalls", function.inlinedCalls},
+                {"stackSize", function.stackSize}
+            };
+            for (auto& value : values) {
+                output << ", \"" << value.first << "\": ";
+                if (value.second < 0) {
+                    output << "null";
+                }
+                else {
+                    output << value.second;
+                }
+            }
+            output << "}";
+        }
+        output << "\n]}\n";
+        return;
+    }
+
+    // one function per line with the name last, so the report can be piped to sort -k<column>
+    output << "Code size report for " << moduleName << "\n";
+    output << left_justify("kind", 8);
+    for (const char* column : {"ir-before", "ir-after", "bytes", "inlined", "stack"}) {
+        output << " " << right_justify(column, 10);
+    }
+    output << "  function\n";
+    for (FunctionSize& function : functions) {
+        if (!function.runtime && function.instructionsBefore < 0 && function.splitFrom.empty()) {
+            continue;
+        }
+        output << left_justify(function.runtime ? "runtime" : "oolong", 8);
+        for (int64_t value : {function.instructionsBefore, function.instructionsAfter, function.bytes, function.inlinedCalls, function.stackSize}) {
+            output << " " << right_justify(value < 0 ? "-" : to_string(value), 10);
+        }
+        output << "  " << function.name << "\n";
+    }
+}
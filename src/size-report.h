@@ -0,0 +1,46 @@
+#ifndef SIZE_REPORT_H
+#define SIZE_REPORT_H
+
+#include <llvm/ADT/StringRef.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class Module;
+    class raw_ostream;
+}
+
+// Code size of every function of a module and every runtime function it uses
+// (--size-report), including the coroutine parts split from generator and async functions. Values that are
+// unknown for a function are reported as -1.
+class SizeReport {
+private:
+    struct FunctionSize {
+        std::string name;
+        bool runtime = false;
+        std::string splitFrom; // the generator or async function a coroutine part was split from
+        int64_t instructionsBefore = -1;
+        int64_t instructionsAfter = -1;
+        int64_t bytes = -1;
+        int64_t inlinedCalls = -1;
+        int64_t stackSize = -1;
+    };
+
+    std::vector<FunctionSize> functions;
+    std::map<std::string, size_t> functionIndices;
+
+    FunctionSize& getFunction(const std::string& name);
+
+public:
+    void collectBeforeOptimization(llvm::Module& module);
+    void collectAfterOptimization(llvm::Module& module);
+    void collectCodeSizes(llvm::StringRef object);
+    void collectRuntimeCodeSizes(const std::string& archiveLocation);
+    void recordInlinedCall(const std::string& caller);
+    void recordStackSize(const std::string& function, uint64_t size);
+    void write(llvm::raw_ostream& output, const std::string& moduleName, bool json);
+};
+
+#endif
@@ -64,6 +64,19 @@ Type* TypeConverter::getDoubleType() {
     return TypeConverter::getDoubleType(context->getLLVMContext());
 }
 
+// Vector<T, N> of SIMD lanes, Boolean vectors are the result of lane-wise comparisons
+void TypeConverter::createVectorTypes() {
+    for (const string elementTypeName : { "Boolean", "Integer", "Double" }) {
+        for (unsigned width : { 2, 4, 8, 16 }) {
+            types[getVectorTypeName(elementTypeName, width)] = VectorType::get(types[elementTypeName], width);
+        }
+    }
+}
+
+string TypeConverter::getVectorTypeName(const string& elementTypeName, unsigned width) {
+    return "Vector<" + elementTypeName + ", " + to_string(width) + ">";
+}
+
 Type* TypeConverter::getType(const string& name) {
     if (types.find(name) == types.end()) {
         error(*context, "Unable to find type with name: " + name);
@@ -94,6 +107,7 @@ string TypeConverter::getTypeName(Type* type) {
                                                 // TODO: determine external behavior
                                                 return "Array<" + getTypeName(type->getArrayElementType()) + ">";
                                             }
+        case Type::TypeID::VectorTyID:      return getVectorTypeName(getTypeName(type->getVectorElementType()), type->getVectorNumElements());
         case Type::TypeID::PointerTyID:     {
                                                 Type* pointerElementType = type->getPointerElementType();
                                                 if (pointerElementType->isStructTy()) {
@@ -130,6 +144,11 @@ bool TypeConverter::canConvertType(Type* sourceType, Type* targetType) {
             return true;
         }
     }
+    // lane-wise Integer to Double
+    if (sourceType->isVectorTy() && targetType->isVectorTy()
+            && sourceType->getVectorNumElements() == targetType->getVectorNumElements()) {
+        return canConvertType(sourceType->getVectorElementType(), targetType->getVectorElementType());
+    }
 
     return false;
 }
@@ -154,6 +173,12 @@ Value* TypeConverter::convertType(Value* value, Type* targetType) {
             return cast;
         }
     }
+    // lane-wise Integer to Double
+    if (valueType->isVectorTy() && targetType->isVectorTy()
+            && valueType->getVectorNumElements() == targetType->getVectorNumElements()
+            && valueType->getVectorElementType() == integerType && targetType->getVectorElementType() == doubleType) {
+        return new SIToFPInst(value, targetType, "", context->currentBlock());
+    }
 
     return error(*context, "No valid conversion found for " + getTypeName(valueType) + " to " + getTypeName(targetType));
 }
@@ -165,3 +190,9 @@ StructType* TypeConverter::createType(ArrayRef<Type*> members, const string& nam
     return newType;
 }
 
+// type whose layout is only known to the runtime, Oolong code passes references around
+StructType* TypeConverter::createOpaqueType(const string& name) {
+    StructType* newType = StructType::create(context->getLLVMContext(), name);
+    types[name] = newType->getPointerTo();
+    return newType;
+}
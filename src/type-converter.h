@@ -13,12 +13,15 @@ private:
     CodeGenerationContext* context;
     std::map<std::string, llvm::Type*> types;
 
+    void createVectorTypes();
+
 public:
     TypeConverter(CodeGenerationContext* context) : context(context) {
         types["Void"] = getVoidType();
         types["Boolean"] = getBooleanType();
         types["Integer"] = getIntegerType();
         types["Double"] = getDoubleType();
+        createVectorTypes();
     }
 
     static llvm::Type* getVoidType(llvm::LLVMContext& llvmContext);
@@ -31,12 +34,15 @@ public:
     llvm::Type* getIntegerType();
     llvm::Type* getDoubleType();
 
+    static std::string getVectorTypeName(const std::string& elementTypeName, unsigned width);
+
     llvm::Type*  getType(const std::string& name);
     std::string  getTypeName(llvm::Type* type);
     bool         canConvertType(llvm::Type* targetType, llvm::Type* value);
     llvm::Value* convertType(llvm::Value* value, llvm::Type* targetType);
 
     llvm::StructType* createType(llvm::ArrayRef<llvm::Type*> members, const std::string& name);
+    llvm::StructType* createOpaqueType(const std::string& name);
 };
 
 #endif